@@ -0,0 +1,13 @@
+#pragma once
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT 4
+#define MALLOC_CAP_SPIRAM 1024
+#define MALLOC_CAP_INTERNAL 2048
+static inline void* heap_caps_malloc(size_t size, unsigned) { return malloc(size); }
+static inline void* heap_caps_realloc(void* ptr, size_t size, unsigned) { return realloc(ptr, size); }
+static inline void heap_caps_free(void* ptr) { free(ptr); }
+static inline void* heap_caps_aligned_alloc(size_t align, size_t size, unsigned)
+{
+    return aligned_alloc(align, (size + align - 1) / align * align);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+// Declarations only: tests that call the httpd API provide the definitions
+typedef void* httpd_handle_t;
+typedef int httpd_method_t;
+#define HTTP_DELETE 0
+#define HTTP_GET 1
+#define HTTP_POST 3
+#define HTTPD_SOCK_ERR_FAIL -1
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+#define HTTPD_RESP_USE_STRLEN -1
+#define ESP_ERR_HTTPD_RESULT_TRUNC 0x8003
+typedef enum {
+    HTTPD_400_BAD_REQUEST,
+    HTTPD_404_NOT_FOUND,
+    HTTPD_408_REQ_TIMEOUT,
+    HTTPD_500_INTERNAL_SERVER_ERROR,
+    HTTPD_411_LENGTH_REQUIRED
+} httpd_err_code_t;
+typedef struct httpd_req {
+    httpd_handle_t handle;
+    int method;
+    const char uri[512];
+    size_t content_len;
+    void* aux;
+    void* user_ctx;
+    void* sess_ctx;
+    void (*free_ctx)(void*);
+    bool ignore_sess_ctx_changes;
+} httpd_req_t;
+typedef struct httpd_uri {
+    const char* uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t*);
+    void* user_ctx;
+} httpd_uri_t;
+typedef void (*httpd_free_ctx_fn_t)(void*);
+typedef void (*httpd_work_fn_t)(void*);
+typedef int (*httpd_send_func_t)(httpd_handle_t hd, int sockfd, const char* buf, size_t buf_len, int flags);
+struct httpd_config_t
+{
+    int server_port;
+    size_t stack_size;
+    int task_priority;
+    int max_uri_handlers;
+    void* uri_match_fn;
+};
+#define HTTPD_DEFAULT_CONFIG() httpd_config_t{}
+
+esp_err_t httpd_resp_send(httpd_req_t*, const char*, ssize_t);
+esp_err_t httpd_resp_send_chunk(httpd_req_t*, const char*, ssize_t);
+static inline esp_err_t httpd_resp_sendstr_chunk(httpd_req_t* req, const char* str)
+{
+    return httpd_resp_send_chunk(req, str, str ? HTTPD_RESP_USE_STRLEN : 0);
+}
+static inline esp_err_t httpd_resp_sendstr(httpd_req_t* req, const char* str)
+{
+    return httpd_resp_send(req, str, HTTPD_RESP_USE_STRLEN);
+}
+esp_err_t httpd_resp_send_err(httpd_req_t*, httpd_err_code_t, const char*);
+esp_err_t httpd_resp_set_type(httpd_req_t*, const char*);
+esp_err_t httpd_resp_set_status(httpd_req_t*, const char*);
+esp_err_t httpd_resp_set_hdr(httpd_req_t*, const char*, const char*);
+int httpd_req_recv(httpd_req_t*, char*, size_t);
+size_t httpd_req_get_hdr_value_len(httpd_req_t*, const char*);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t*, const char*, char*, size_t);
+size_t httpd_req_get_url_query_len(httpd_req_t*);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t*, char*, size_t);
+int httpd_req_to_sockfd(httpd_req_t*);
+esp_err_t httpd_register_uri_handler(httpd_handle_t, const httpd_uri_t*);
+esp_err_t httpd_unregister_uri(httpd_handle_t, const char*);
+esp_err_t httpd_sess_trigger_close(httpd_handle_t, int);
+void httpd_sess_set_ctx(httpd_handle_t, int, void*, httpd_free_ctx_fn_t);
+esp_err_t httpd_queue_work(httpd_handle_t, httpd_work_fn_t, void*);
+esp_err_t httpd_start(httpd_handle_t*, const httpd_config_t*);
+esp_err_t httpd_stop(httpd_handle_t);
+bool httpd_uri_match_wildcard(const char*, const char*, size_t);
+esp_err_t httpd_socket_send(httpd_handle_t, int, const char*, size_t, int);
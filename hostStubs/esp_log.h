@@ -0,0 +1,12 @@
+#pragma once
+#include <stdio.h>
+#include "esp_err.h"
+
+#define ESP_LOGI(tag, fmt, ...) printf("I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) printf("W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGE(tag, fmt, ...) printf("E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) do {} while(0)
+#define ESP_LOGV(tag, fmt, ...) do {} while(0)
+typedef int (*vprintf_like_t)(const char*, va_list);
+static inline vprintf_like_t esp_log_set_vprintf(vprintf_like_t) { return nullptr; }
+static inline uint32_t esp_log_timestamp() { return 0; }
@@ -0,0 +1,9 @@
+#pragma once
+#include <stdint.h>
+#include <random>
+
+static inline uint32_t esp_random()
+{
+    static std::random_device rd;
+    return rd();
+}
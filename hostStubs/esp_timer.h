@@ -0,0 +1,24 @@
+#pragma once
+#include <stdint.h>
+#include <chrono>
+
+static inline int64_t esp_timer_get_time()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// Timers never fire
+typedef void* esp_timer_handle_t;
+struct esp_timer_create_args_t
+{
+    int dispatch_method;
+    void (*callback)(void*);
+    void* arg;
+    const char* name;
+};
+#define ESP_TIMER_TASK 0
+static inline int esp_timer_create(const esp_timer_create_args_t*, esp_timer_handle_t*) { return 0; }
+static inline int esp_timer_start_once(esp_timer_handle_t, uint64_t) { return 0; }
+static inline int esp_timer_start_periodic(esp_timer_handle_t, uint64_t) { return 0; }
+static inline int esp_timer_stop(esp_timer_handle_t) { return 0; }
+static inline int esp_timer_delete(esp_timer_handle_t) { return 0; }
@@ -0,0 +1,67 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <assert.h>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+typedef uint32_t EventBits_t;
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffff
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(x) (x)
+#define configMAX_TASK_NAME_LEN 16
+#define tskNO_AFFINITY 0x7fffffff
+
+// Tasks are detached threads. A task can't be deleted, and has no real handle
+typedef void* TaskHandle_t;
+typedef void (*TaskFunction_t)(void*);
+struct StaticTask_t {};
+static inline void vTaskDelay(uint32_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
+static inline TaskHandle_t xTaskGetCurrentTaskHandle() { return nullptr; }
+static inline TaskHandle_t xTaskGetHandle(const char*) { return nullptr; }
+static inline char* pcTaskGetName(TaskHandle_t) { static char name[] = "main"; return name; }
+static inline void vTaskDelete(void*) {}
+static inline void taskYIELD() { std::this_thread::yield(); }
+static inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char*, uint32_t, void* arg,
+    UBaseType_t, TaskHandle_t* handle, BaseType_t)
+{
+    std::thread([func, arg] { func(arg); }).detach();
+    if (handle) {
+        *handle = (TaskHandle_t)1;
+    }
+    return pdPASS;
+}
+static inline TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t func, const char*, uint32_t,
+    void* arg, UBaseType_t, StackType_t*, StaticTask_t*, BaseType_t)
+{
+    std::thread([func, arg] { func(arg); }).detach();
+    return (TaskHandle_t)1;
+}
+
+struct StaticEventGroup_t
+{
+    std::mutex mutex;
+    std::condition_variable cond;
+    EventBits_t bits = 0;
+};
+typedef StaticEventGroup_t* EventGroupHandle_t;
+
+// Software timers never fire
+typedef void* TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t);
+static inline TimerHandle_t xTimerCreate(const char*, uint32_t, int, void*, TimerCallbackFunction_t) { return nullptr; }
+static inline int xTimerStart(TimerHandle_t, uint32_t) { return pdPASS; }
+static inline int xTimerDelete(TimerHandle_t, uint32_t) { return pdPASS; }
+static inline void* pvTimerGetTimerID(TimerHandle_t) { return nullptr; }
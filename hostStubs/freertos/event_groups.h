@@ -0,0 +1,47 @@
+#pragma once
+#include "FreeRTOS.h"
+
+// Number of blocking waits, which benchmarks report as a measure of task switches
+inline long gEventGroupWaits = 0;
+
+static inline EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t* mem) { return mem; }
+static inline EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    return group->bits;
+}
+static inline EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    group->bits |= bits;
+    group->cond.notify_all();
+    return group->bits;
+}
+static inline EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    std::lock_guard<std::mutex> lock(group->mutex);
+    auto ret = group->bits;
+    group->bits &= ~bits;
+    return ret;
+}
+static inline EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+    BaseType_t clearOnExit, BaseType_t waitForAll, TickType_t ticks)
+{
+    std::unique_lock<std::mutex> lock(group->mutex);
+    auto satisfied = [&] {
+        return waitForAll ? ((group->bits & bits) == bits) : ((group->bits & bits) != 0);
+    };
+    if (!satisfied()) {
+        gEventGroupWaits++;
+        if (ticks == portMAX_DELAY) {
+            group->cond.wait(lock, satisfied);
+        } else {
+            group->cond.wait_for(lock, std::chrono::milliseconds(ticks), satisfied);
+        }
+    }
+    auto ret = group->bits;
+    if (satisfied() && clearOnExit) {
+        group->bits &= ~bits;
+    }
+    return ret;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "FreeRTOS.h"
+
+// All semaphores are recursive mutexes
+struct StaticSemaphore_t
+{
+    std::recursive_timed_mutex mutex;
+};
+typedef StaticSemaphore_t* SemaphoreHandle_t;
+static inline SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t* mem) { return mem; }
+static inline SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* mem) { return mem; }
+static inline BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY) {
+        sem->mutex.lock();
+        return pdTRUE;
+    }
+    return sem->mutex.try_lock_for(std::chrono::milliseconds(ticks)) ? pdTRUE : pdFALSE;
+}
+static inline BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    sem->mutex.unlock();
+    return pdTRUE;
+}
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) { return xSemaphoreTakeRecursive(sem, ticks); }
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) { return xSemaphoreGiveRecursive(sem); }
@@ -0,0 +1,54 @@
+#pragma once
+// The mbedtls generic message digest API, on top of OpenSSL (link with -lcrypto)
+#include <stddef.h>
+#include <openssl/evp.h>
+
+typedef enum { MBEDTLS_MD_NONE, MBEDTLS_MD_MD5, MBEDTLS_MD_SHA256 } mbedtls_md_type_t;
+typedef struct { mbedtls_md_type_t type; } mbedtls_md_info_t;
+typedef struct
+{
+    const mbedtls_md_info_t* info;
+    EVP_MD_CTX* ctx;
+} mbedtls_md_context_t;
+#define MBEDTLS_MD_MAX_SIZE 64
+
+static inline const mbedtls_md_info_t* mbedtls_md_info_from_type(mbedtls_md_type_t type)
+{
+    static const mbedtls_md_info_t md5 = { MBEDTLS_MD_MD5 }, sha256 = { MBEDTLS_MD_SHA256 };
+    return (type == MBEDTLS_MD_MD5) ? &md5 : (type == MBEDTLS_MD_SHA256) ? &sha256 : nullptr;
+}
+static inline unsigned char mbedtls_md_get_size(const mbedtls_md_info_t* info)
+{
+    return (info->type == MBEDTLS_MD_MD5) ? 16 : 32;
+}
+static inline void mbedtls_md_init(mbedtls_md_context_t* ctx)
+{
+    ctx->info = nullptr;
+    ctx->ctx = nullptr;
+}
+static inline void mbedtls_md_free(mbedtls_md_context_t* ctx)
+{
+    if (ctx->ctx) {
+        EVP_MD_CTX_free(ctx->ctx);
+    }
+    ctx->ctx = nullptr;
+}
+static inline int mbedtls_md_setup(mbedtls_md_context_t* ctx, const mbedtls_md_info_t* info, int)
+{
+    ctx->info = info;
+    ctx->ctx = EVP_MD_CTX_new();
+    return ctx->ctx ? 0 : -1;
+}
+static inline int mbedtls_md_starts(mbedtls_md_context_t* ctx)
+{
+    auto md = (ctx->info->type == MBEDTLS_MD_MD5) ? EVP_md5() : EVP_sha256();
+    return (EVP_DigestInit_ex(ctx->ctx, md, nullptr) == 1) ? 0 : -1;
+}
+static inline int mbedtls_md_update(mbedtls_md_context_t* ctx, const unsigned char* data, size_t len)
+{
+    return (EVP_DigestUpdate(ctx->ctx, data, len) == 1) ? 0 : -1;
+}
+static inline int mbedtls_md_finish(mbedtls_md_context_t* ctx, unsigned char* out)
+{
+    return (EVP_DigestFinal_ex(ctx->ctx, out, nullptr) == 1) ? 0 : -1;
+}
@@ -0,0 +1,3 @@
+#pragma once
+typedef struct { int freq_mhz; } rtc_cpu_freq_config_t;
+static inline void rtc_clk_cpu_freq_get_config(rtc_cpu_freq_config_t* config) { config->freq_mhz = 240; }
@@ -0,0 +1,414 @@
+#ifndef BINLOG_HPP
+#define BINLOG_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include "buffer.hpp"
+
+/** Deferred formatting of printf-style log messages. Instead of formatting the message on
+ * the logging task, its arguments are captured as tagged binary values, together with the
+ * address of the format string, and the text is produced later from the format string and
+ * the captured values - on the device by a low-priority task, or on a host by a decoder
+ * of a binary log dump.
+ * Only what is needed to reproduce the text is captured: integers and pointers by size,
+ * floating point values as double, and strings by value, as they may not outlive the call.
+ * Conversions that can't be captured (%n, long double, wide strings) make the encoder
+ * fail, and the message has to be formatted synchronously instead.
+ *
+ * The binary dump is a sequence of frames, in native (little endian) byte order:
+ *   FrameHeader, followed by \c len bytes of payload, depending on the frame type:
+ *   kFrameFormat: uint32 id, format string (not null-terminated)
+ *   kFrameTask:   uint32 id, task name (not null-terminated)
+ *   kFrameRecord: RecordHeader, encoded arguments
+ *   kFrameText:   a message that was formatted on the device
+ * A format string or task name is sent once, before the first record that refers to it.
+ */
+namespace binlog
+{
+enum ArgTag: uint8_t {
+    kArgInt32 = 1, kArgInt64, kArgDouble, kArgStr
+};
+enum: uint8_t { kMaxStrLen = 255 };
+enum FrameType: uint8_t {
+    kFrameFormat = 1, kFrameTask, kFrameRecord, kFrameText
+};
+struct FrameHeader
+{
+    uint8_t type;
+    uint8_t reserved;
+    uint16_t len;
+};
+struct RecordHeader
+{
+    uint32_t fmtId;
+    uint32_t timestamp;
+    uint32_t taskId;
+};
+
+/** A parsed printf conversion specification */
+struct Spec
+{
+    enum: uint8_t { kLenNone, kLenChar, kLenShort, kLenLong, kLenLongLong, kLenIntMax,
+                    kLenSize, kLenPtrDiff, kLenLongDouble };
+    enum: int { kNone = -1, kStar = -2 };
+    const char* flags; // flag characters, up to flagsEnd
+    const char* flagsEnd;
+    const char* end; // past the conversion character
+    int width;
+    int prec;
+    uint8_t lenMod;
+    char conv;
+    /** Parses the specification starting at the '%' at \c pct
+     * @returns false if the format string ends inside the specification
+     */
+    bool parse(const char* pct)
+    {
+        const char* p = flags = pct + 1;
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0') {
+            p++;
+        }
+        flagsEnd = p;
+        width = parseNum(p);
+        if (*p == '.') {
+            p++;
+            prec = parseNum(p);
+            if (prec == kNone) {
+                prec = 0; // just a '.' is zero precision
+            }
+        } else {
+            prec = kNone;
+        }
+        switch (*p) {
+            case 'h': p++; if (*p == 'h') { p++; lenMod = kLenChar; } else { lenMod = kLenShort; } break;
+            case 'l': p++; if (*p == 'l') { p++; lenMod = kLenLongLong; } else { lenMod = kLenLong; } break;
+            case 'q': p++; lenMod = kLenLongLong; break;
+            case 'j': p++; lenMod = kLenIntMax; break;
+            case 'z': p++; lenMod = kLenSize; break;
+            case 't': p++; lenMod = kLenPtrDiff; break;
+            case 'L': p++; lenMod = kLenLongDouble; break;
+            default: lenMod = kLenNone; break;
+        }
+        conv = *p;
+        if (!conv) {
+            return false;
+        }
+        end = p + 1;
+        return true;
+    }
+    static int parseNum(const char*& p)
+    {
+        if (*p == '*') {
+            p++;
+            return kStar;
+        }
+        if (*p < '0' || *p > '9') {
+            return kNone;
+        }
+        int val = 0;
+        for (; *p >= '0' && *p <= '9'; p++) {
+            val = val * 10 + (*p - '0');
+        }
+        return val;
+    }
+    /** Size of the integer argument, according to the length modifier */
+    int intArgSize() const
+    {
+        switch (lenMod) {
+            case kLenLong: return sizeof(long);
+            case kLenLongLong: return sizeof(long long);
+            case kLenIntMax: return sizeof(intmax_t);
+            case kLenSize: return sizeof(size_t);
+            case kLenPtrDiff: return sizeof(ptrdiff_t);
+            default: return sizeof(int); // char and short are promoted to int
+        }
+    }
+};
+
+/** Encodes the arguments of a printf call into \c buf. The va_list is not consumed.
+ * @returns the encoded size, or -1 if a conversion can't be captured, or if the
+ * arguments don't fit in \c bufSize bytes
+ */
+static inline int encodeArgs(char* buf, int bufSize, const char* fmt, va_list args)
+{
+    char* wptr = buf;
+    char* end = buf + bufSize;
+    va_list ap;
+    va_copy(ap, args);
+    auto putInt = [&](uint64_t val, int size) {
+        if (end - wptr < 1 + size) {
+            return false;
+        }
+        *(wptr++) = (size > 4) ? kArgInt64 : kArgInt32;
+        if (size > 4) {
+            memcpy(wptr, &val, 8);
+        } else {
+            uint32_t val32 = val;
+            memcpy(wptr, &val32, 4);
+        }
+        wptr += (size > 4) ? 8 : 4;
+        return true;
+    };
+    int ret = -1;
+    for (const char* p = fmt; (p = strchr(p, '%'));) {
+        if (p[1] == '%') {
+            p += 2;
+            continue;
+        }
+        Spec spec;
+        if (!spec.parse(p)) {
+            goto out;
+        }
+        p = spec.end;
+        if (spec.width == Spec::kStar && !putInt(va_arg(ap, int), sizeof(int))) {
+            goto out;
+        }
+        if (spec.prec == Spec::kStar) {
+            spec.prec = va_arg(ap, int);
+            if (!putInt(spec.prec, sizeof(int))) {
+                goto out;
+            }
+        }
+        switch (spec.conv) {
+        case 'c':
+            if (spec.lenMod == Spec::kLenLong) {
+                goto out; // wide char
+            }
+            // fall through
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': {
+            int size = spec.intArgSize();
+            uint64_t val;
+            if (size == sizeof(int)) {
+                val = va_arg(ap, unsigned int);
+            } else if (size == sizeof(long)) {
+                val = va_arg(ap, unsigned long);
+            } else {
+                val = va_arg(ap, unsigned long long);
+            }
+            if (!putInt(val, size)) {
+                goto out;
+            }
+            break;
+        }
+        case 'p':
+            if (!putInt((uintptr_t)va_arg(ap, void*), sizeof(void*))) {
+                goto out;
+            }
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+            if (spec.lenMod == Spec::kLenLongDouble || end - wptr < 1 + (int)sizeof(double)) {
+                goto out;
+            }
+            double val = va_arg(ap, double);
+            *(wptr++) = kArgDouble;
+            memcpy(wptr, &val, sizeof(double));
+            wptr += sizeof(double);
+            break;
+        }
+        case 's': {
+            if (spec.lenMod == Spec::kLenLong) {
+                goto out; // wide string
+            }
+            const char* str = va_arg(ap, const char*);
+            if (!str) {
+                str = "(null)";
+            }
+            // with a precision, the string doesn't have to be null-terminated
+            size_t len = strnlen(str, (spec.prec >= 0 && spec.prec < kMaxStrLen) ? spec.prec : kMaxStrLen);
+            if (end - wptr < (int)(2 + len)) {
+                goto out;
+            }
+            *(wptr++) = kArgStr;
+            *(wptr++) = len;
+            memcpy(wptr, str, len);
+            wptr += len;
+            break;
+        }
+        default: // %n and unknown conversions
+            goto out;
+        }
+    }
+    ret = wptr - buf;
+out:
+    va_end(ap);
+    return ret;
+}
+
+/** Reproduces the text of a message from its null-terminated format string and the
+ * arguments encoded by encodeArgs(), and appends it to \c out, without a null terminator.
+ * Strings are output as captured, i.e. possibly truncated to kMaxStrLen.
+ * @returns false if the arguments don't match the format string. The text is still
+ * output, with the unmatched conversions copied as they are
+ */
+static inline bool formatArgs(DynBuffer& out, const char* fmt, const char* args, int argsLen)
+{
+    const char* rptr = args;
+    const char* rend = args + argsLen;
+    auto getTag = [&](int size) -> uint8_t {
+        return (rend - rptr >= 1 + size) ? *rptr : 0;
+    };
+    auto getInt = [&](int64_t& val) {
+        uint8_t tag = getTag(4);
+        if (tag == kArgInt32) {
+            int32_t val32;
+            memcpy(&val32, rptr + 1, 4);
+            val = val32;
+            rptr += 5;
+        } else if (tag == kArgInt64 && getTag(8)) {
+            memcpy(&val, rptr + 1, 8);
+            rptr += 9;
+        } else {
+            return 0;
+        }
+        return (int)tag;
+    };
+    // DynBuffer::printf() includes the null terminator in the data
+    auto put = [&out](const char* spec, auto... vals) {
+        if (out.printf(spec, vals...) >= 0) {
+            out.setDataSize(out.dataSize() - 1);
+        }
+    };
+    bool ok = true;
+    const char* p = fmt;
+    for (;;) {
+        const char* pct = strchr(p, '%');
+        if (!pct) {
+            out.append(p, strlen(p));
+            break;
+        }
+        out.append(p, pct - p);
+        if (pct[1] == '%') {
+            out.appendChar('%');
+            p = pct + 2;
+            continue;
+        }
+        Spec spec;
+        if (!spec.parse(pct)) {
+            out.append(pct, strlen(pct));
+            ok = false;
+            break;
+        }
+        p = spec.end;
+        // Rebuild the specification without '*' and with the length modifier of the
+        // captured value
+        int64_t val;
+        bool leftJustify = false;
+        bool matched = true;
+        if (spec.width == Spec::kStar) {
+            if (!getInt(val)) {
+                matched = false;
+            } else if (val < 0) {
+                leftJustify = true; // negative '*' width is the '-' flag
+                spec.width = -val;
+            } else {
+                spec.width = val;
+            }
+        }
+        if (spec.prec == Spec::kStar) {
+            if (!getInt(val)) {
+                matched = false;
+            } else {
+                spec.prec = (val < 0) ? (int)Spec::kNone : val; // negative precision is as if omitted
+            }
+        }
+        char specBuf[32];
+        char* sptr = specBuf;
+        *(sptr++) = '%';
+        int flagsLen = spec.flagsEnd - spec.flags;
+        if (flagsLen > 8) {
+            flagsLen = 8;
+        }
+        memcpy(sptr, spec.flags, flagsLen);
+        sptr += flagsLen;
+        if (leftJustify) {
+            *(sptr++) = '-';
+        }
+        if (spec.width >= 0) {
+            sptr += sprintf(sptr, "%d", spec.width);
+        }
+        char* precPos = sptr;
+        if (spec.prec >= 0) {
+            sptr += sprintf(sptr, ".%d", spec.prec);
+        }
+        char conv = spec.conv;
+        if (matched) switch (conv) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c': case 'p': {
+            int tag = getInt(val);
+            if (!tag) {
+                matched = false;
+                break;
+            }
+            if (conv == 'p') {
+                out.append("0x", 2);
+                conv = 'x';
+            }
+            bool isSigned = (conv == 'd' || conv == 'i');
+            if (tag == kArgInt64) {
+                *(sptr++) = 'l';
+                *(sptr++) = 'l';
+                *(sptr++) = conv;
+                *sptr = 0;
+                if (isSigned) {
+                    put(specBuf, (long long)val);
+                } else {
+                    put(specBuf, (unsigned long long)val);
+                }
+                break;
+            }
+            // char and short modifiers truncate the value
+            if (spec.lenMod == Spec::kLenChar || spec.lenMod == Spec::kLenShort) {
+                *(sptr++) = 'h';
+                if (spec.lenMod == Spec::kLenChar) {
+                    *(sptr++) = 'h';
+                }
+            }
+            *(sptr++) = conv;
+            *sptr = 0;
+            if (isSigned) {
+                put(specBuf, (int)val);
+            } else {
+                put(specBuf, (unsigned int)val);
+            }
+            break;
+        }
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': {
+            if (getTag(sizeof(double)) != kArgDouble) {
+                matched = false;
+                break;
+            }
+            double dval;
+            memcpy(&dval, rptr + 1, sizeof(double));
+            rptr += 1 + sizeof(double);
+            *(sptr++) = conv;
+            *sptr = 0;
+            put(specBuf, dval);
+            break;
+        }
+        case 's': {
+            uint8_t len;
+            if (getTag(1) != kArgStr || rend - rptr < 2 + (len = rptr[1])) {
+                matched = false;
+                break;
+            }
+            // the captured string is not null-terminated, and is already truncated to the
+            // precision, so its length is passed as precision instead
+            memcpy(precPos, ".*s", 4);
+            put(specBuf, (int)len, rptr + 2);
+            rptr += 2 + len;
+            break;
+        }
+        default:
+            matched = false;
+            break;
+        }
+        if (!matched) {
+            out.append(pct, spec.end - pct);
+            ok = false;
+        }
+    }
+    return ok && rptr == rend;
+}
+}
+#endif
@@ -0,0 +1,118 @@
+// Host tool that converts a binary log dump back to text. The dump is what a NetLogger
+// log connection with format=bin sends, e.g.:
+//   curl -s http://<device>/log?format=bin > log.bin && binLogDecode log.bin
+// or, to follow a live log:
+//   curl -sN http://<device>/log?format=bin | binLogDecode -t
+// Build: g++ -O2 -std=gnu++17 -I../mySystem binLogDecode.cpp -o binLogDecode
+#include "binLog.hpp"
+#include <string>
+#include <unordered_map>
+#include <stdio.h>
+#include <string.h>
+
+using namespace binlog;
+
+static void usage()
+{
+    fprintf(stderr, "Usage: binLogDecode [-t] [dumpfile]\n"
+        "  -t  Prefix each message with the name of the task that logged it\n"
+        "Reads the dump from stdin if no file is specified\n");
+}
+
+int main(int argc, char** argv)
+{
+    bool showTask = false;
+    const char* fname = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            showTask = true;
+        } else if (argv[i][0] == '-' && argv[i][1]) {
+            usage();
+            return 1;
+        } else {
+            fname = argv[i];
+        }
+    }
+    FILE* in = (fname && strcmp(fname, "-")) ? fopen(fname, "rb") : stdin;
+    if (!in) {
+        perror("Error opening dump file");
+        return 1;
+    }
+    std::unordered_map<uint32_t, std::string> formats;
+    std::unordered_map<uint32_t, std::string> tasks;
+    std::string payload;
+    DynBuffer text(256);
+    long numRecords = 0, numErrors = 0;
+    for (;;) {
+        FrameHeader hdr;
+        if (fread(&hdr, sizeof(hdr), 1, in) != 1) {
+            break;
+        }
+        payload.resize(hdr.len);
+        if (hdr.len && fread(&payload[0], hdr.len, 1, in) != 1) {
+            fprintf(stderr, "Dump is truncated\n");
+            numErrors++;
+            break;
+        }
+        uint32_t id;
+        if (hdr.type != kFrameText && hdr.len < sizeof(id)) {
+            fprintf(stderr, "Frame of type %d is too short\n", hdr.type);
+            numErrors++;
+            continue;
+        }
+        memcpy(&id, payload.data(), sizeof(id));
+        switch (hdr.type) {
+        case kFrameText:
+            fwrite(payload.data(), 1, payload.size(), stdout);
+            break;
+        case kFrameFormat:
+            formats[id] = payload.substr(sizeof(id));
+            break;
+        case kFrameTask:
+            tasks[id] = payload.substr(sizeof(id));
+            break;
+        case kFrameRecord: {
+            RecordHeader rec;
+            if (payload.size() < sizeof(rec)) {
+                fprintf(stderr, "Record frame is too short\n");
+                numErrors++;
+                break;
+            }
+            memcpy(&rec, payload.data(), sizeof(rec));
+            numRecords++;
+            auto fmt = formats.find(rec.fmtId);
+            if (fmt == formats.end()) {
+                printf("<unknown format string 0x%08x at %u ms>\n", rec.fmtId, rec.timestamp);
+                numErrors++;
+                break;
+            }
+            text.clear();
+            if (showTask) {
+                auto task = tasks.find(rec.taskId);
+                if (task != tasks.end()) {
+                    text.printf("[%s] ", task->second.c_str());
+                } else {
+                    text.printf("[0x%08x] ", rec.taskId);
+                }
+                text.setDataSize(text.dataSize() - 1); // printf() includes the null terminator
+            }
+            if (!formatArgs(text, fmt->second.c_str(), payload.data() + sizeof(rec), payload.size() - sizeof(rec))) {
+                numErrors++;
+            }
+            fwrite(text.buf(), 1, text.dataSize(), stdout);
+            break;
+        }
+        default:
+            fprintf(stderr, "Unknown frame type %d\n", hdr.type);
+            numErrors++;
+            break;
+        }
+    }
+    if (in != stdin) {
+        fclose(in);
+    }
+    if (numErrors) {
+        fprintf(stderr, "%ld records decoded, %ld errors\n", numRecords, numErrors);
+    }
+    return numErrors ? 2 : 0;
+}
@@ -0,0 +1,137 @@
+// Host test of the binary log encoding: messages reproduced from the captured arguments
+// must match vsnprintf(). Also compares the cost of capturing vs formatting a message.
+// Build: g++ -O2 -std=gnu++17 -I../mySystem binLogTest.cpp -o binLogTest
+#include "binLog.hpp"
+#include <chrono>
+#include <string>
+#include <assert.h>
+#include <stdint.h>
+#include <inttypes.h>
+
+using namespace binlog;
+
+static int gNumChecked = 0;
+
+void check(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    char encoded[512];
+    int len = encodeArgs(encoded, sizeof(encoded), fmt, args); // doesn't consume args
+    char expected[1024];
+    vsnprintf(expected, sizeof(expected), fmt, args);
+    va_end(args);
+    assert(len >= 0);
+    DynBuffer out;
+    bool ok = formatArgs(out, fmt, encoded, len);
+    std::string actual(out.buf(), out.dataSize());
+    if (!ok || actual != expected) {
+        fprintf(stderr, "Mismatch for format '%s':\nexpected: '%s'\nactual:   '%s'\n", fmt, expected, actual.c_str());
+        abort();
+    }
+    gNumChecked++;
+}
+
+bool encodes(const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    char encoded[64];
+    int len = encodeArgs(encoded, sizeof(encoded), fmt, args);
+    va_end(args);
+    return len >= 0;
+}
+
+void testFormats()
+{
+    check("no args");
+    check("");
+    check("100%% sure %d%%", 5);
+    check("I (%u) %s: connected to %s, rssi %d\n", 123456u, "wifi", "MyNetwork", -67);
+    check("%d %i %u %x %X %o %c", -1, 2147483647, 4294967295u, 0xdeadbeef, 0xabcdefu, 0755, 'z');
+    check("%5d|%-5d|%05d|%+d|% d|%.3d|%#x|%#o", 42, 42, 42, 42, 42, 7, 255, 8);
+    check("%hhd %hhu %hd %hu", 300, 300, 70000, 70000);
+    check("%ld %lu %lx", -1234567L, 1234567UL, 0xfedcbaUL);
+    check("%lld %llu %llx %" PRId64 " %" PRIu64, -123456789012345LL, 18446744073709551615ULL,
+          0x123456789abcdefULL, (int64_t)-5, (uint64_t)6);
+    check("%zu %zd %td %jd", (size_t)12345, (ssize_t)-3, (ptrdiff_t)-100, (intmax_t)99);
+    check("%p %p", (void*)0x3ffb1234, (void*)16);
+    check("%f %.2f %e %E %g %G %10.3f %-10.1f|", 3.14159, 2.71828, 12345.678, 0.000123, 1e-10, 1e20, -1.5, 2.25);
+    check("%a", 1.0);
+    check("%f %f", (double)1.0f / 3, -0.0);
+    check("[%s] [%10s] [%-10s] [%.3s] [%.*s]", "str", "right", "left", "truncated", 2, "ab\0cd");
+    check("%s", (const char*)nullptr);
+    check("%*d|%-*d|%.*f|%*.*f|", 6, 1, 6, 2, 3, 1.23456, 10, 2, 9.87654);
+    check("%*d|%.*f|", -6, 1, -1, 1.5); // negative width and precision
+    check("%.*s", 3, "abc"); // not null-terminated beyond the precision
+    check("%.0f %.f %#.0f", 2.5, 3.5, 1.0);
+    std::string longStr(300, 'x');
+    char expected[512];
+    char encoded[512];
+    // strings are truncated to kMaxStrLen
+    auto enc = [&](const char* fmt, ...) {
+        va_list args;
+        va_start(args, fmt);
+        int len = encodeArgs(encoded, sizeof(encoded), fmt, args);
+        va_end(args);
+        return len;
+    };
+    int len = enc("%s", longStr.c_str());
+    assert(len == 2 + kMaxStrLen);
+    DynBuffer out;
+    assert(formatArgs(out, "%s", encoded, len));
+    assert(out.dataSize() == kMaxStrLen);
+    snprintf(expected, sizeof(expected), "%.255s", longStr.c_str());
+    assert(memcmp(out.buf(), expected, kMaxStrLen) == 0);
+
+    // unsupported conversions
+    assert(!encodes("%n", &len));
+    assert(!encodes("%Lf", (long double)1.0));
+    assert(!encodes("%ls", L"wide"));
+    assert(!encodes("%lc", (wint_t)'w'));
+    assert(!encodes("trailing %"));
+    assert(encodes("%s", "fits"));
+    assert(!encodes("%s %s", longStr.c_str() + 250, longStr.c_str() + 200)); // doesn't fit
+
+    // arguments that don't match the format are output as the specification
+    len = enc("%d", 5);
+    out.clear();
+    assert(!formatArgs(out, "%d %s %f", encoded, len));
+    assert(std::string(out.buf(), out.dataSize()) == "5 %s %f");
+    out.clear();
+    assert(!formatArgs(out, "%s", encoded, len));
+    assert(std::string(out.buf(), out.dataSize()) == "%s");
+    out.clear();
+    assert(!formatArgs(out, "x", encoded, len)); // extra arguments
+    printf("%d formats checked\n", gNumChecked);
+}
+
+volatile int gSink;
+void benchCapture()
+{
+    enum { kCount = 1000000 };
+    const char* fmt = "I (%u) %s: Connected to %s, channel %d, rssi %d\n";
+    char buf[256];
+    auto capture = [&](bool binary, ...) {
+        va_list args;
+        va_start(args, binary);
+        int ret = binary ? encodeArgs(buf, sizeof(buf), fmt, args) : vsnprintf(buf, sizeof(buf), fmt, args);
+        va_end(args);
+        return ret;
+    };
+    for (bool binary: {false, true}) {
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < kCount; i++) {
+            gSink = capture(binary, i * 13u, "wifi", "MyNetwork", i & 15, -40 - (i & 31));
+        }
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / kCount;
+        printf("%-9s: %5.1f ns per message\n", binary ? "encode" : "vsnprintf", ns);
+    }
+}
+
+int main()
+{
+    testFormats();
+    benchCapture();
+    return 0;
+}
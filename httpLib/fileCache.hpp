@@ -0,0 +1,145 @@
+#ifndef FILE_CACHE_HPP
+#define FILE_CACHE_HPP
+
+#include <stdlib.h>
+#include <time.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include "utils.hpp"
+
+/** LRU cache of the content of small files, together with the precomputed headers of
+ * their HTTP responses, so that a hit can be served without touching the file system.
+ * The total size of the cached content is kept within a byte budget, by evicting the
+ * least recently used entries. Entries are reference counted, so an entry that is
+ * being sent stays valid even if it is evicted or invalidated meanwhile.
+ * Thread-safe
+ */
+class FileCache
+{
+public:
+    /** Precomputed response headers of a file */
+    struct Headers
+    {
+        char etag[48];
+        char lastModified[32] = {0}; // empty if the modification time is unknown
+        const char* contentType = nullptr; // static string
+        time_t mtime = 0;
+        bool gzipped = false;
+    };
+    struct Entry: public Headers
+    {
+        std::string key;
+        char* data;
+        int size;
+        Entry(const std::string& aKey, const Headers& hdrs, char* aData, int aSize)
+        : Headers(hdrs), key(aKey), data(aData), size(aSize) {}
+        ~Entry() { free(data); }
+    };
+    typedef std::shared_ptr<Entry> EntryPtr;
+    struct Stats
+    {
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+        uint32_t evictions = 0;
+        int numEntries = 0;
+        int numBytes = 0;
+    };
+protected:
+    typedef std::list<EntryPtr> LruList; // most recently used first
+    Mutex mMutex;
+    LruList mLru;
+    std::unordered_map<std::string, LruList::iterator> mEntries;
+    int mBudget = 0;
+    int mMaxFileSize = 0;
+    bool mUsePsram = false;
+    Stats mStats;
+    void removeEntry(LruList::iterator it)
+    {
+        mStats.numBytes -= (*it)->size;
+        mEntries.erase((*it)->key);
+        mLru.erase(it);
+    }
+public:
+    /** Sets the byte budget and the size of the largest file to be cached, and clears
+     * the cache. A budget of 0 disables it */
+    void configure(int budget, int maxFileSize, bool usePsram)
+    {
+        MutexLocker locker(mMutex);
+        clear();
+        mBudget = budget;
+        mMaxFileSize = std::min(maxFileSize, budget);
+        mUsePsram = usePsram;
+    }
+    bool enabled() const { return mBudget > 0; }
+    int maxFileSize() const { return mMaxFileSize; }
+    /** Allocates the memory for the content of an entry, to be passed to add() */
+    char* allocData(int size)
+    {
+        if (!size) {
+            size = 1;
+        }
+        return (char*)(mUsePsram ? utils::mallocTrySpiram(size) : malloc(size));
+    }
+    /** Looks up an entry, and counts a hit or a miss */
+    EntryPtr get(const std::string& key)
+    {
+        MutexLocker locker(mMutex);
+        auto it = mEntries.find(key);
+        if (it == mEntries.end()) {
+            mStats.misses++;
+            return nullptr;
+        }
+        mStats.hits++;
+        mLru.splice(mLru.begin(), mLru, it->second);
+        return mLru.front();
+    }
+    /** Adds an entry, which takes ownership of \c data, and evicts least recently used
+     * ones to make room for it. An entry that is larger than the allowed file size is
+     * not cached, but still returned, so that the caller can send it */
+    EntryPtr add(const std::string& key, const Headers& hdrs, char* data, int size)
+    {
+        auto entry = std::make_shared<Entry>(key, hdrs, data, size);
+        MutexLocker locker(mMutex);
+        auto it = mEntries.find(key);
+        if (it != mEntries.end()) {
+            removeEntry(it->second);
+        }
+        if (size > mMaxFileSize) {
+            return entry;
+        }
+        while (mStats.numBytes + size > mBudget) {
+            removeEntry(std::prev(mLru.end()));
+            mStats.evictions++;
+        }
+        mLru.push_front(entry);
+        mEntries[key] = mLru.begin();
+        mStats.numBytes += size;
+        return entry;
+    }
+    void remove(const std::string& key)
+    {
+        MutexLocker locker(mMutex);
+        auto it = mEntries.find(key);
+        if (it != mEntries.end()) {
+            removeEntry(it->second);
+        }
+    }
+    void clear()
+    {
+        MutexLocker locker(mMutex);
+        mEntries.clear();
+        mLru.clear();
+        mStats.numBytes = 0;
+    }
+    Stats stats()
+    {
+        MutexLocker locker(mMutex);
+        Stats ret = mStats;
+        ret.numEntries = mEntries.size();
+        return ret;
+    }
+};
+
+#endif
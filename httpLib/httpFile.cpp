@@ -1,10 +1,121 @@
 #include <esp_http_server.h>
 #include <utils.hpp>
+#include <jsonWriter.hpp>
+#include <eventGroup.hpp>
+#include <task.hpp>
+#include <esp_timer.h>
+#if __has_include(<esp_random.h>)
+    #include <esp_random.h>
+#else
+    #include <esp_system.h>
+#endif
+#include <mbedtls/md.h>
 #include <dirent.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+#include "httpFile.hpp"
+#include "ioBufPool.hpp"
+#include "fileCache.hpp"
 
-static constexpr int kFileIoBufSize = 1024;
 static constexpr const char* TAG = "HTTPFS";
+// A multiple of the TCP MSS, so that a chunk is sent in full segments
+static constexpr int kTcpMss = 1436;
+static constexpr int kDefaultIoBufSize = 4 * kTcpMss;
+// Uploads are written in multiples of this
+static constexpr int kFsSectorSize = 512;
+// Two per download in progress
+static constexpr int kDefaultNumIoBufs = 4;
+static IoBufPool sIoBufPool(kDefaultIoBufSize, kDefaultNumIoBufs, true);
+// Disabled until configured with httpFsConfigCache()
+static FileCache sFileCache;
+
+void httpFsConfigIoBufs(int bufSize, int numBufs, bool usePsram)
+{
+    sIoBufPool.configure(bufSize, numBufs, usePsram);
+}
+
+/** Reads and writes files on a background task, so that a handler can send a buffer
+ * while the next one is being read, or receive one while the previous one is being
+ * written */
+class FileIoTask
+{
+public:
+    struct Job
+    {
+        FILE* file;
+        char* buf;
+        int size;
+        bool isWrite;
+        int result;
+        EventGroup done;
+        Job(FILE* aFile, char* aBuf, int aSize, bool aIsWrite=false)
+        : file(aFile), buf(aBuf), size(aSize), isWrite(aIsWrite) {}
+    };
+protected:
+    enum: EventBits_t { kEvtHaveJob = 1, kEvtJobDone = 1 };
+    enum { kStackSize = 2560, kPrio = 5 }; // the priority of the httpd task
+    Mutex mMutex;
+    EventGroup mEvents;
+    std::vector<Job*> mJobs;
+    Task mTask;
+    bool mTaskFailed = false;
+    static void execute(Job& job)
+    {
+        job.result = job.isWrite
+            ? fwrite(job.buf, 1, job.size, job.file)
+            : fread(job.buf, 1, job.size, job.file);
+        job.done.setBits(kEvtJobDone);
+    }
+    void taskFunc()
+    {
+        for (;;) {
+            mEvents.waitForOneAndReset(kEvtHaveJob, -1);
+            for (;;) {
+                Job* job;
+                {
+                    MutexLocker locker(mMutex);
+                    if (mJobs.empty()) {
+                        break;
+                    }
+                    job = mJobs.front();
+                    mJobs.erase(mJobs.begin());
+                }
+                execute(*job);
+            }
+        }
+    }
+public:
+    /** Starts reading into the job's buffer, or writing it. The job must not be
+     * destroyed before wait() returns */
+    void submit(Job& job)
+    {
+        {
+            MutexLocker locker(mMutex);
+            if (!mTask.handle() && !mTaskFailed) {
+                mTaskFailed = !mTask.createTask("httpfs-io", false, kStackSize, tskNO_AFFINITY,
+                    kPrio, this, &FileIoTask::taskFunc);
+            }
+            if (!mTaskFailed) {
+                mJobs.push_back(&job);
+                mEvents.setBits(kEvtHaveJob);
+                return;
+            }
+        }
+        execute(job);
+    }
+    /** @returns the result of fread() or fwrite() */
+    static int wait(Job& job)
+    {
+        job.done.waitForOneAndReset(kEvtJobDone, -1);
+        return job.result;
+    }
+};
+static FileIoTask sFileIo;
+/** Counts uploads and deletions. Used in the ETag of files when the file system
+ * doesn't keep modification times (i.e. SPIFFS without CONFIG_SPIFFS_USE_MTIME) */
+static uint32_t sFsGeneration = 0;
 
 const char* urlGetPathAfterSlashCnt(const char* url, int slashCnt)
 {
@@ -34,6 +145,77 @@ const char* fileGetExtension(const std::string& str) {
     }
     return nullptr;
 }
+static bool reqGetHeader(httpd_req_t* req, const char* name, std::string& val)
+{
+    auto len = httpd_req_get_hdr_value_len(req, name);
+    if (!len) {
+        return false;
+    }
+    val.resize(len + 1);
+    if (httpd_req_get_hdr_value_str(req, name, &val[0], len + 1) != ESP_OK) {
+        return false;
+    }
+    val.resize(len);
+    return true;
+}
+/** Running digest of an upload, to be checked against the one that the client sent,
+ * as a hex string, in an X-Content-SHA256 or X-Content-MD5 header */
+class UploadDigest
+{
+protected:
+    mbedtls_md_context_t mCtx;
+    std::string mExpected;
+    bool mActive = false;
+public:
+    UploadDigest() { mbedtls_md_init(&mCtx); }
+    ~UploadDigest() { mbedtls_md_free(&mCtx); }
+    /** @returns false if the client sent an invalid digest */
+    bool init(httpd_req_t* req)
+    {
+        mbedtls_md_type_t type;
+        if (reqGetHeader(req, "X-Content-SHA256", mExpected)) {
+            type = MBEDTLS_MD_SHA256;
+        } else if (reqGetHeader(req, "X-Content-MD5", mExpected)) {
+            type = MBEDTLS_MD_MD5;
+        } else {
+            return true;
+        }
+        auto info = mbedtls_md_info_from_type(type);
+        if (!info || mExpected.size() != 2u * mbedtls_md_get_size(info)) {
+            return false;
+        }
+        if (mbedtls_md_setup(&mCtx, info, 0) || mbedtls_md_starts(&mCtx)) {
+            return false;
+        }
+        mActive = true;
+        return true;
+    }
+    bool active() const { return mActive; }
+    void update(const char* data, int len)
+    {
+        if (mActive) {
+            mbedtls_md_update(&mCtx, (const unsigned char*)data, len);
+        }
+    }
+    bool matches()
+    {
+        if (!mActive) {
+            return true;
+        }
+        unsigned char digest[MBEDTLS_MD_MAX_SIZE];
+        if (mbedtls_md_finish(&mCtx, digest)) {
+            return false;
+        }
+        char hex[3];
+        for (size_t i = 0; i < mExpected.size() / 2; i++) {
+            snprintf(hex, sizeof(hex), "%02x", digest[i]);
+            if (strncasecmp(hex, mExpected.c_str() + 2 * i, 2) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
 static esp_err_t fsFilePostHandler(httpd_req_t* req)
 {
     auto fn = urlGetPathAfterSlashCnt(req->uri, 1);
@@ -43,8 +225,18 @@ static esp_err_t fsFilePostHandler(httpd_req_t* req)
     }
     std::string fname = fn;
     unescapeUrlParam(&fname[0], fname.size());
+    fname.resize(strlen(fname.c_str()));
 
-    std::unique_ptr<char[]> rxBuf(new char[kFileIoBufSize]);
+    UploadDigest digest;
+    if (!digest.init(req)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid content digest");
+        return ESP_FAIL;
+    }
+    IoBufPool::Buf bufs[2] = { sIoBufPool.get(), sIoBufPool.get() };
+    if (!bufs[0]) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
     int contentLen = req->content_len;
     ESP_LOGI(TAG, "Receiving file '%s' of size %d...", fname.c_str(), contentLen);
 
@@ -53,33 +245,100 @@ static esp_err_t fsFilePostHandler(httpd_req_t* req)
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to open file for writing");
         return ESP_FAIL;
     }
-
+    // A GET while the file is being written may cache or make an ETag for the partial
+    // content, so this is repeated when it's complete or removed
+    auto fileChanged = [&fname]() {
+        sFsGeneration++;
+        httpFsCacheInvalidate(fname.c_str());
+    };
+    fileChanged();
+    // We write in large blocks, so the stdio buffer would only split them
+    setvbuf(file.get(), nullptr, _IONBF, 0);
+    // Allocate the file's space in advance, rather than extending it with each write.
+    // Not all file systems support that (i.e. SPIFFS doesn't)
+    if (contentLen > 0 && ftruncate(fileno(file.get()), contentLen) != 0) {
+        ESP_LOGD(TAG, "Can't pre-allocate file: %s", strerror(errno));
+    }
+    // Each block is received into one buffer, while the previous one is being written
+    // from the other one by the file I/O task. Without a second buffer, receive and
+    // write alternate. Blocks are whole sectors, so that they are written without
+    // read-modify-write by the file system, unless the buffers are smaller than a sector
+    int blockSize = bufs[0].size() & ~(kFsSectorSize - 1);
+    if (!blockSize) {
+        blockSize = bufs[0].size();
+    }
+    FileIoTask::Job job(file.get(), nullptr, 0, true); // the write in progress
+    bool writing = false;
+    auto finishWrite = [&]() {
+        if (!writing) {
+            return true;
+        }
+        writing = false;
+        return FileIoTask::wait(job) == job.size;
+    };
+    // Deletes the incomplete file. If there is no message, the connection is broken
+    // and no response is sent
+    auto fail = [&](httpd_err_code_t code, const char* msg) {
+        finishWrite();
+        file.reset();
+        remove(fname.c_str());
+        fileChanged();
+        if (msg) {
+            ESP_LOGE(TAG, "Error receiving file '%s': %s", fname.c_str(), msg);
+            httpd_resp_send_err(req, code, msg);
+        }
+        return ESP_FAIL;
+    };
     int displayCtr = 0;
+    int cur = 0;
     for (int remain = contentLen; remain > 0;) {
         /* Read the data for the request */
-        int recvLen;
-        for (int numWaits = 0; numWaits < 4; numWaits++) {
-            recvLen = httpd_req_recv(req, rxBuf.get(), std::min(remain, kFileIoBufSize));
-            if (recvLen != HTTPD_SOCK_ERR_TIMEOUT) {
-                break;
+        char* buf = bufs[cur].data();
+        int blockLen = std::min(remain, blockSize);
+        for (int fill = 0; fill < blockLen;) {
+            int recvLen;
+            for (int numWaits = 0; numWaits < 4; numWaits++) {
+                recvLen = httpd_req_recv(req, buf + fill, blockLen - fill);
+                if (recvLen != HTTPD_SOCK_ERR_TIMEOUT) {
+                    break;
+                }
             }
+            if (recvLen <= 0) {
+                ESP_LOGI(TAG, "File recv error %d", recvLen);
+                return fail(HTTPD_500_INTERNAL_SERVER_ERROR, nullptr);
+            }
+            fill += recvLen;
         }
-
-        if (recvLen < 0) {
-            ESP_LOGI(TAG, "File recv error %d", recvLen);
-            return ESP_FAIL;
-        }
-        remain -= recvLen;
-        displayCtr += recvLen;
+        remain -= blockLen;
+        digest.update(buf, blockLen);
+        displayCtr += blockLen;
         if (displayCtr > 10240) {
             displayCtr = 0;
             printf("FS: Recv %d of %d bytes\r", contentLen - remain, contentLen);
         }
-        if (fwrite(rxBuf.get(), 1, recvLen, file.get()) != recvLen) {
-            ESP_LOGE(TAG, "Error writing to file");
-            return ESP_FAIL;
+        if (!finishWrite()) {
+            return fail(HTTPD_500_INTERNAL_SERVER_ERROR, "Error writing to file");
+        }
+        job.buf = buf;
+        job.size = blockLen;
+        if (bufs[cur ^ 1]) {
+            sFileIo.submit(job);
+            writing = true;
+            cur ^= 1;
+        } else if (fwrite(buf, 1, blockLen, file.get()) != (size_t)blockLen) {
+            return fail(HTTPD_500_INTERNAL_SERVER_ERROR, "Error writing to file");
         }
     }
+    if (!finishWrite()) {
+        return fail(HTTPD_500_INTERNAL_SERVER_ERROR, "Error writing to file");
+    }
+    if (!digest.matches()) {
+        return fail(HTTPD_400_BAD_REQUEST, "Content digest mismatch");
+    }
+    if (fclose(file.release()) != 0) {
+        return fail(HTTPD_500_INTERNAL_SERVER_ERROR, "Error closing file");
+    }
+    fileChanged();
     httpd_resp_send(req, "OK\r\n", 4);
     ESP_LOGI(TAG, "Success receiving file '%s'", fname.c_str());
     return ESP_OK;
@@ -94,42 +353,29 @@ bool respondWithDirContent(const std::string& dirname, httpd_req_t* req)
         return false;
     }
     struct stat info;
-    std::string buf;
-    buf.reserve(300);
-    buf = "{\"dir\":\"";
-    buf.append(dirname).append("\",\"l\":[");
-    httpd_resp_send_chunk(req, buf.c_str(), buf.size());
-    int cnt = 0;
-    std::string fname;
     std::string fullName;
+    HttpJsonWriter json(req);
+    json.beginObject().kv("dir", dirname.c_str()).key("l").beginArray();
     for(;;) {
         struct dirent* entry = readdir(dir);
         if (!entry) {
             break;
         }
-        fname = entry->d_name;
-        std::string buf;
-        fname = jsonStringEscape(fname.c_str());
-        buf = (cnt++) ? ",{\"n\":\"" : "{\"n\":\"";
-        buf.append(fname).append("\",\"");
-        fullName = dirname + '/' + fname;
+        json.beginObject().kv("n", entry->d_name);
+        fullName.assign(dirname).append(1, '/').append(entry->d_name);
         if (stat(fullName.c_str(), &info) != 0) {
             ESP_LOGE(TAG, "Can't stat '%s'", fullName.c_str());
-            buf.append("e\":1}");
-            httpd_resp_send_chunk(req, buf.c_str(), buf.size());
-            continue;
-        }
-        if (info.st_mode & S_IFDIR) { // path is a dir
-            buf.append("d\":1}");
+            json.kv("e", 1);
+        } else if (info.st_mode & S_IFDIR) { // path is a dir
+            json.kv("d", 1);
         } else {
-            buf.append("s\":").append(std::to_string(info.st_size)) += '}';
+            json.kv("s", (long)info.st_size);
         }
-        httpd_resp_send_chunk(req, buf.c_str(), buf.size());
+        json.endObject();
     }
     closedir(dir);
-    httpd_resp_sendstr_chunk(req, "]}");
-    httpd_resp_send_chunk(req, nullptr, 0);
-    return true;
+    json.endArray().endObject();
+    return json.finish();
 }
 static esp_err_t fsDirListHandler(httpd_req_t* req)
 {
@@ -140,12 +386,20 @@ static esp_err_t fsDirListHandler(httpd_req_t* req)
     }
     std::string dirname(fn);
     unescapeUrlParam(&dirname[0], dirname.size());
+    dirname.resize(strlen(dirname.c_str()));
     ESP_LOGI(TAG, "List dir '%s'", dirname.c_str());
     return respondWithDirContent(dirname, req) ? ESP_OK : ESP_FAIL;
 }
-bool respondWithFileContent(const std::string& fname, httpd_req_t* req)
+/** Sends \c len bytes of the file, starting at \c offset, or up to the end of the file
+ * if \c len is negative */
+bool respondWithFileContent(const std::string& fname, httpd_req_t* req, const char* contentType,
+    long offset, long len)
 {
-    std::unique_ptr<char[]> rxBuf(new char[kFileIoBufSize]);
+    IoBufPool::Buf bufs[2] = { sIoBufPool.get(), sIoBufPool.get() };
+    if (!bufs[0]) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return false;
+    }
     FileHandle file(fopen(fname.c_str(), "r"));
     if (!file) {
         std::string msg = "Error opening file: ";
@@ -153,37 +407,323 @@ bool respondWithFileContent(const std::string& fname, httpd_req_t* req)
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, msg.c_str());
         return false;
     }
+    // We read in large blocks, so the stdio buffer would only add a copy
+    setvbuf(file.get(), nullptr, _IONBF, 0);
+    if (offset && fseek(file.get(), offset, SEEK_SET) != 0) {
+        ESP_LOGE(TAG, "Error seeking in file '%s': %s", fname.c_str(), strerror(errno));
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Error seeking in file");
+        return false;
+    }
 
     ESP_LOGI(TAG, "Sending file '%s'...", fname.c_str());
-    const char* ext = fileGetExtension(fname);
-    const char* contentType = (ext && (strcasecmp(ext, "html") == 0))
-        ? "text/html"
-        : "application/octet-stream";
     httpd_resp_set_type(req, contentType);
-    for (;;) {
-        /* Read the data for the request */
-        int readLen = fread(rxBuf.get(), 1, kFileIoBufSize, file.get());
-        if (readLen > 0) {
-            if (httpd_resp_send_chunk(req, rxBuf.get(), readLen) != ESP_OK) {
-                ESP_LOGE(TAG, "Error sending file data, aborting");
-                return false;
-            }
-            if (readLen != kFileIoBufSize) {
-                break;
-            }
-        } else if (readLen == 0) {
-            break;
-        } else {
+    // Double buffering: while one buffer is being sent, the next one is read into
+    // the other one by the file I/O task. Without a second buffer, read and send alternate
+    int bufSize = bufs[0].size();
+    long remain = (len < 0) ? LONG_MAX : len; // not yet requested from the file
+    auto nextReadSize = [&]() {
+        int size = std::min<long>(bufSize, remain);
+        remain -= size;
+        return size;
+    };
+    int readSize = nextReadSize();
+    int readLen = fread(bufs[0].data(), 1, readSize, file.get());
+    for (int cur = 0;; cur ^= 1) {
+        if (readLen < 0 || ferror(file.get())) {
             ESP_LOGE(TAG, "Error reading file '%s': %s", fname.c_str(), strerror(errno));
             return false;
         }
+        if (readLen == 0) {
+            break;
+        }
+        bool more = readLen == readSize && remain > 0;
+        auto& next = bufs[cur ^ 1];
+        bool readingAhead = more && next;
+        if (readingAhead) {
+            readSize = nextReadSize();
+        }
+        FileIoTask::Job job(file.get(), next.data(), readSize);
+        if (readingAhead) {
+            sFileIo.submit(job);
+        }
+        bool sent = httpd_resp_send_chunk(req, bufs[cur].data(), readLen) == ESP_OK;
+        if (readingAhead) {
+            readLen = FileIoTask::wait(job); // even if sending failed, as the job uses the buffer
+        }
+        if (!sent) {
+            ESP_LOGE(TAG, "Error sending file data, aborting");
+            return false;
+        }
+        if (!more) {
+            break;
+        }
+        if (!readingAhead) {
+            readSize = nextReadSize();
+            readLen = fread(bufs[cur].data(), 1, readSize, file.get());
+            cur ^= 1; // stay on the same buffer
+        }
     }
     httpd_resp_send_chunk(req, nullptr, 0);
     ESP_LOGI(TAG, "File sent successfully");
     return true;
 }
 
-esp_err_t httpGetHandler(const char* urlPath, httpd_req_t* req)
+static const struct { const char* ext; const char* type; } sMimeTypes[] = {
+    { "html", "text/html" }, { "htm", "text/html" }, { "css", "text/css" },
+    { "js", "application/javascript" }, { "mjs", "application/javascript" },
+    { "json", "application/json" }, { "map", "application/json" },
+    { "txt", "text/plain" }, { "log", "text/plain" }, { "csv", "text/csv" },
+    { "xml", "text/xml" }, { "svg", "image/svg+xml" }, { "png", "image/png" },
+    { "jpg", "image/jpeg" }, { "jpeg", "image/jpeg" }, { "gif", "image/gif" },
+    { "ico", "image/x-icon" }, { "webp", "image/webp" }, { "woff", "font/woff" },
+    { "woff2", "font/woff2" }, { "ttf", "font/ttf" }, { "wasm", "application/wasm" },
+    { "wav", "audio/wav" }, { "mp3", "audio/mpeg" }, { "ogg", "audio/ogg" },
+    { "flac", "audio/flac" }, { "pdf", "application/pdf" }
+};
+const char* fileGetMimeType(const std::string& fname)
+{
+    const char* ext = fileGetExtension(fname);
+    if (ext) {
+        for (auto& item: sMimeTypes) {
+            if (strcasecmp(ext, item.ext) == 0) {
+                return item.type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+static bool reqAcceptsGzip(httpd_req_t* req)
+{
+    std::string accept;
+    if (!reqGetHeader(req, "Accept-Encoding", accept)) {
+        return false;
+    }
+    auto pos = accept.find("gzip");
+    if (pos == std::string::npos) {
+        return false;
+    }
+    // gzip;q=0 explicitly refuses it
+    pos += 4;
+    while (pos < accept.size() && accept[pos] == ' ') {
+        pos++;
+    }
+    if (accept.compare(pos, 3, ";q=") != 0) {
+        return true;
+    }
+    return strtof(accept.c_str() + pos + 3, nullptr) > 0;
+}
+/** Parses an IMF-fixdate, i.e. "Sun, 06 Nov 1994 08:49:37 GMT", the format
+ * that we send in Last-Modified and clients send back in If-Modified-Since
+ * @returns -1 if the date can't be parsed
+ */
+static time_t parseHttpDate(const char* str)
+{
+    static const char* months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    int day, year, hour, min, sec;
+    if (sscanf(str, "%*3s, %d %3s %d %d:%d:%d", &day, month, &year, &hour, &min, &sec) != 6) {
+        return -1;
+    }
+    const char* found = strstr(months, month);
+    if (!found || strlen(month) != 3 || (found - months) % 3) {
+        return -1;
+    }
+    // days since the epoch of the civil date, with the year starting on 1 March
+    int mon = (found - months) / 3 + 1;
+    int y = year - (mon <= 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long days = era * 146097L + doe - 719468;
+    return ((days * 24 + hour) * 60 + min) * 60L + sec;
+}
+static void fileMakeEtag(const struct stat& info, bool gzipped, char* buf, int bufSize)
+{
+    if (info.st_mtime) {
+        snprintf(buf, bufSize, "\"%lx-%llx%s\"", (long)info.st_size,
+            (long long)info.st_mtime, gzipped ? "-gz" : "");
+    } else {
+        // the ETag must change when a file is replaced, and after a reboot, as the
+        // file system may have been flashed. The time since boot would be nearly the
+        // same on every boot
+        static uint32_t bootId = esp_random();
+        snprintf(buf, bufSize, "\"%lx-%x-%x%s\"", (long)info.st_size, (unsigned)bootId,
+            (unsigned)sFsGeneration, gzipped ? "-gz" : "");
+    }
+}
+/** Whether the client's cached copy, as described by the If-None-Match or
+ * If-Modified-Since request header, is still valid */
+static bool reqCacheIsFresh(httpd_req_t* req, const char* etag, time_t mtime)
+{
+    std::string val;
+    if (reqGetHeader(req, "If-None-Match", val)) {
+        // takes precedence over If-Modified-Since
+        size_t tagLen = strlen(etag);
+        for (size_t pos = 0; pos < val.size();) {
+            size_t end = val.find(',', pos);
+            if (end == std::string::npos) {
+                end = val.size();
+            }
+            while (pos < end && val[pos] == ' ') {
+                pos++;
+            }
+            if (val.compare(pos, 2, "W/") == 0) {
+                pos += 2;
+            }
+            if (val[pos] == '*' || (end - pos >= tagLen && val.compare(pos, tagLen, etag) == 0)) {
+                return true;
+            }
+            pos = end + 1;
+        }
+        return false;
+    }
+    if (mtime && reqGetHeader(req, "If-Modified-Since", val)) {
+        time_t since = parseHttpDate(val.c_str());
+        return since != -1 && mtime <= since;
+    }
+    return false;
+}
+/** Parses the value of a Range header
+ * @returns 1 if it specifies a satisfiable byte range, -1 if the range is beyond the
+ * end of the file, and 0 if the header must be ignored and the whole file sent. That
+ * includes requests for several ranges: we don't send multipart/byteranges responses,
+ * as media players and download managers only ask for one range
+ */
+static int parseRangeHeader(const char* str, long fileSize, long& start, long& len)
+{
+    if (strncmp(str, "bytes=", 6) != 0 || strchr(str, ',')) {
+        return 0;
+    }
+    str += 6;
+    char* end;
+    long first, last;
+    if (*str == '-') { // the last N bytes
+        long n = strtol(str + 1, &end, 10);
+        if (end == str + 1 || *end || n < 0) {
+            return 0;
+        }
+        if (n == 0 || fileSize == 0) {
+            return -1;
+        }
+        first = (n >= fileSize) ? 0 : fileSize - n;
+        last = fileSize - 1;
+    } else {
+        first = strtol(str, &end, 10);
+        if (end == str || *end != '-' || first < 0) {
+            return 0;
+        }
+        str = end + 1;
+        if (*str) {
+            last = strtol(str, &end, 10);
+            if (end == str || *end || last < first) {
+                return 0;
+            }
+        } else {
+            last = fileSize - 1;
+        }
+        if (first >= fileSize) {
+            return -1;
+        }
+        if (last >= fileSize) {
+            last = fileSize - 1;
+        }
+    }
+    start = first;
+    len = last - first + 1;
+    return 1;
+}
+/** Whether the If-Range request header, if any, allows to send only a range, i.e. the
+ * file is still the one that the client has the rest of */
+static bool reqIfRangeMatches(httpd_req_t* req, const char* etag, const char* lastModified)
+{
+    std::string val;
+    if (!reqGetHeader(req, "If-Range", val)) {
+        return true;
+    }
+    if (val[0] == '"') {
+        return val == etag; // strong comparison, so a weak ETag never matches
+    }
+    return lastModified && val == lastModified;
+}
+/** Sets the headers that all file responses have. The header values must stay valid
+ * until the response is sent */
+static void setFileRespHeaders(httpd_req_t* req, const FileCache::Headers& hdrs, bool isStatic)
+{
+    httpd_resp_set_hdr(req, "ETag", hdrs.etag);
+    if (hdrs.lastModified[0]) {
+        httpd_resp_set_hdr(req, "Last-Modified", hdrs.lastModified);
+    }
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    // Cache, but revalidate on every use, which costs only a stat() if unchanged
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    if (isStatic) {
+        httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    }
+    if (hdrs.gzipped) {
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+}
+static bool respondNotModified(httpd_req_t* req, const FileCache::Headers& hdrs)
+{
+    if (!reqCacheIsFresh(req, hdrs.etag, hdrs.mtime)) {
+        return false;
+    }
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, nullptr, 0);
+    return true;
+}
+/** Sends a whole cached file, with a single send */
+static esp_err_t respondWithCacheEntry(const FileCache::Entry& entry, httpd_req_t* req)
+{
+    httpd_resp_set_type(req, entry.contentType);
+    return httpd_resp_send(req, entry.data, entry.size);
+}
+/** Reads a file into a new cache entry
+ * @returns nullptr if out of memory or the file can't be read */
+static FileCache::EntryPtr cacheLoadFile(const std::string& key, const std::string& fname,
+    const FileCache::Headers& hdrs, int size)
+{
+    char* data = sFileCache.allocData(size);
+    if (!data) {
+        return nullptr;
+    }
+    FileHandle file(fopen(fname.c_str(), "r"));
+    if (!file) {
+        free(data);
+        return nullptr;
+    }
+    setvbuf(file.get(), nullptr, _IONBF, 0);
+    if (size && fread(data, 1, size, file.get()) != (size_t)size) {
+        free(data);
+        return nullptr;
+    }
+    return sFileCache.add(key, hdrs, data, size);
+}
+/** Keys of the two variants of a static file in the cache: for clients that accept
+ * gzip encoding, and for those that don't */
+static std::string cacheKey(const std::string& fname, bool gzipVariant)
+{
+    return gzipVariant ? "gz:" + fname : fname;
+}
+void httpFsCacheInvalidate(const char* fname)
+{
+    std::string name(fname);
+    if (name.size() > 3 && name.compare(name.size() - 3, 3, ".gz") == 0) {
+        name.resize(name.size() - 3);
+    }
+    sFileCache.remove(cacheKey(name, false));
+    sFileCache.remove(cacheKey(name, true));
+}
+FileCache::Stats httpFsCacheStats()
+{
+    return sFileCache.stats();
+}
+void httpFsConfigCache(int budget, int maxFileSize, bool usePsram)
+{
+    sFileCache.configure(budget, maxFileSize, usePsram);
+}
+esp_err_t httpGetHandler(const char* urlPath, httpd_req_t* req, bool isStatic)
 {
     std::string fname(urlPath);
     auto pos = fname.find('?');
@@ -191,19 +731,87 @@ esp_err_t httpGetHandler(const char* urlPath, httpd_req_t* req)
         fname.resize(pos);
     }
     unescapeUrlParam(&fname[0], fname.size());
+    fname.resize(strlen(fname.c_str())); // the unescaped name may be shorter
     ESP_LOGI(TAG, "Get file '%s'", fname.c_str());
+    bool acceptsGzip = isStatic && reqAcceptsGzip(req);
+    // Range requests are rare for static files, they always go to the file
+    bool useCache = isStatic && sFileCache.enabled() && !httpd_req_get_hdr_value_len(req, "Range");
+    std::string key;
+    if (useCache) {
+        key = cacheKey(fname, acceptsGzip);
+        auto entry = sFileCache.get(key);
+        if (entry) {
+            ESP_LOGI(TAG, "Sending '%s' from cache", fname.c_str());
+            setFileRespHeaders(req, *entry, isStatic);
+            if (respondNotModified(req, *entry)) {
+                return ESP_OK;
+            }
+            return respondWithCacheEntry(*entry, req);
+        }
+    }
     struct stat info;
-    if (stat(fname.c_str(), &info) != 0) {
-        std::string msg = "File/directory '";
-        msg.append(fname).append("' not found");
-        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, msg.c_str());
-        return ESP_FAIL;
+    std::string gzName;
+    if (acceptsGzip) {
+        gzName = fname + ".gz";
+        if (stat(gzName.c_str(), &info) != 0 || (info.st_mode & S_IFDIR)) {
+            gzName.clear();
+        }
     }
-    if (info.st_mode & S_IFDIR) { // path is a dir
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Is a diectory");
-        return ESP_FAIL;
+    if (gzName.empty()) {
+        if (stat(fname.c_str(), &info) != 0) {
+            std::string msg = "File/directory '";
+            msg.append(fname).append("' not found");
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, msg.c_str());
+            return ESP_FAIL;
+        }
+        if (info.st_mode & S_IFDIR) { // path is a dir
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Is a diectory");
+            return ESP_FAIL;
+        }
+    }
+    FileCache::Headers hdrs;
+    hdrs.gzipped = !gzName.empty();
+    hdrs.mtime = info.st_mtime;
+    hdrs.contentType = fileGetMimeType(fname);
+    fileMakeEtag(info, hdrs.gzipped, hdrs.etag, sizeof(hdrs.etag));
+    struct tm tm;
+    if (info.st_mtime && gmtime_r(&info.st_mtime, &tm)) {
+        strftime(hdrs.lastModified, sizeof(hdrs.lastModified), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    }
+    setFileRespHeaders(req, hdrs, isStatic);
+    if (respondNotModified(req, hdrs)) {
+        ESP_LOGI(TAG, "File '%s' not modified", fname.c_str());
+        return ESP_OK;
+    }
+    const std::string& sendName = hdrs.gzipped ? gzName : fname;
+    if (useCache && info.st_size <= sFileCache.maxFileSize()) {
+        auto entry = cacheLoadFile(key, sendName, hdrs, info.st_size);
+        if (entry) {
+            return respondWithCacheEntry(*entry, req);
+        }
+    }
+    long start = 0, len = -1;
+    char contentRange[72]; // "bytes " and three longs
+    std::string range;
+    if (reqGetHeader(req, "Range", range) &&
+        reqIfRangeMatches(req, hdrs.etag, hdrs.lastModified[0] ? hdrs.lastModified : nullptr)) {
+        int ret = parseRangeHeader(range.c_str(), info.st_size, start, len);
+        if (ret < 0) {
+            ESP_LOGI(TAG, "Range '%s' of file '%s' not satisfiable", range.c_str(), fname.c_str());
+            snprintf(contentRange, sizeof(contentRange), "bytes */%ld", (long)info.st_size);
+            httpd_resp_set_hdr(req, "Content-Range", contentRange);
+            httpd_resp_set_status(req, "416 Range Not Satisfiable");
+            httpd_resp_send(req, nullptr, 0);
+            return ESP_OK;
+        }
+        if (ret > 0) {
+            snprintf(contentRange, sizeof(contentRange), "bytes %ld-%ld/%ld",
+                start, start + len - 1, (long)info.st_size);
+            httpd_resp_set_hdr(req, "Content-Range", contentRange);
+            httpd_resp_set_status(req, "206 Partial Content");
+        }
     }
-    if (!respondWithFileContent(fname, req)) {
+    if (!respondWithFileContent(sendName, req, hdrs.contentType, start, len)) {
         return ESP_FAIL;
     }
     return ESP_OK;
@@ -215,7 +823,7 @@ static esp_err_t fsWwwGetHandler(httpd_req_t* req) {
     }
     std::string fname = "/spiffs";
     fname.append(req->uri + 4);
-    return httpGetHandler(fname.c_str(), req);
+    return httpGetHandler(fname.c_str(), req, true);
 }
 
 static esp_err_t fsFileGetHandler(httpd_req_t *req)
@@ -273,6 +881,7 @@ static esp_err_t fsFileDelHandler(httpd_req_t *req)
     }
     std::string fname(fn);
     unescapeUrlParam(&fname[0], fname.size());
+    fname.resize(strlen(fname.c_str()));
     struct stat info;
     if (stat(fname.c_str(), &info) != 0) {
         std::string msg = "File/directory '";
@@ -280,12 +889,15 @@ static esp_err_t fsFileDelHandler(httpd_req_t *req)
         httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, msg.c_str());
         return ESP_FAIL;
     }
+    sFsGeneration++;
     bool ok;
     if (info.st_mode & S_IFDIR) { // path is a dir
         ESP_LOGI(TAG, "Deleting directory '%s'", fname.c_str());
         ok = delDirectory(fname.c_str());
+        sFileCache.clear();
     } else {
         ok = remove(fname.c_str()) == 0;
+        httpFsCacheInvalidate(fname.c_str());
     }
     if (ok) {
         httpd_resp_send(req, "OK", 2);
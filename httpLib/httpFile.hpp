@@ -1,7 +1,32 @@
 #ifndef HTTP_FILE_H
 #define HTTP_FILE_H
 #include <esp_http_server.h>
+#include "fileCache.hpp"
 
 void httpFsRegisterHandlers(httpd_handle_t server);
-esp_err_t httpGetHandler(const char* urlPath, httpd_req_t* req);
+/** Sends the content of a file, with validators (ETag, Last-Modified) so that clients
+ * can cache it, and a 304 response if the client's copy is still valid
+ * @param isStatic The file is a static web asset. Then, if the client accepts gzip
+ * encoding and a \c <file>.gz exists, that one is sent, with Content-Encoding: gzip
+ */
+esp_err_t httpGetHandler(const char* urlPath, httpd_req_t* req, bool isStatic=false);
+/** Configures the pool of I/O buffers that the file handlers share. A download uses
+ * two buffers, to read the next one while sending the current one, and an upload one.
+ * Buffers are allocated on first use and kept, up to \c numBufs of them
+ * @param bufSize Size of a buffer, preferably a multiple of the TCP MSS
+ * @param usePsram Allocate the buffers in PSRAM, if available
+ */
+void httpFsConfigIoBufs(int bufSize, int numBufs, bool usePsram);
+/** Configures the in-memory cache of static files (the ones under /www), which is
+ * disabled by default. A cached file is sent without accessing the file system, so
+ * files that are modified other than via the /file and /delfile handlers must be
+ * invalidated with httpFsCacheInvalidate()
+ * @param budget Total size of the cached files. 0 disables the cache
+ * @param maxFileSize Larger files are not cached
+ * @param usePsram Keep the cached files in PSRAM, if available
+ */
+void httpFsConfigCache(int budget, int maxFileSize, bool usePsram);
+/** Removes a file from the cache, after it was modified or deleted */
+void httpFsCacheInvalidate(const char* fname);
+FileCache::Stats httpFsCacheStats();
 #endif
@@ -0,0 +1,823 @@
+// Host harness that runs the httpFile handlers against a local stand-in for the httpd
+// API, checks the responses and measures the throughput of downloads and uploads.
+// The cost of the flash file system and of the network is modelled by sleeping:
+// each file system read or write, as newlib with its 128-byte stdio buffer would issue
+// them, has a fixed cost plus a per-byte cost, and so does each sent chunk. The absolute
+// numbers are only as good as the model, but the effect of the number and size of reads
+// and sends, and of overlapping them, is the same as on the device.
+// The file system calls of httpFile.cpp are intercepted with the linker's --wrap, and
+// _FORTIFY_SOURCE must be off, so that they are not redirected to the checked variants.
+// Build: g++ -O2 -U_FORTIFY_SOURCE -std=gnu++17 -I../mySystem -I../hostStubs httpFileTest.cpp
+//     httpFile.cpp ../mySystem/utils-parse.cpp -lpthread -lcrypto -o httpFileTest
+//     -Wl,--wrap=fopen,--wrap=fclose,--wrap=fseek,--wrap=stat,--wrap=fread,--wrap=fwrite,--wrap=setvbuf,--wrap=remove
+#include "httpFile.hpp"
+#include <string>
+#include <map>
+#include <memory>
+#include <functional>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+#include <utils.hpp>
+#include <mbedtls/md.h>
+
+bool utils::sHaveSpiRam = false;
+
+// Cost model, in microseconds
+struct CostModel
+{
+    double fsReadCall = 60;   // per read call to the file system
+    double fsWriteCall = 60;
+    double fsPerKb = 400;     // ~2.5 MB/s flash / SD read throughput
+    double fsWritePerKb = 800;
+    double sendCall = 150;    // per chunk: chunk header, data and trailer socket sends
+    double netPerKb = 800;    // ~1.2 MB/s Wi-Fi throughput
+    double recvCall = 100;
+};
+static CostModel gCost;
+static bool gSimulateCosts = true;
+
+// Sleeps until a per-thread virtual clock, which accumulates the modelled costs, so that
+// the sleep granularity of the OS doesn't distort short operations
+static void spend(double us)
+{
+    if (!gSimulateCosts) {
+        return;
+    }
+    using Clock = std::chrono::steady_clock;
+    thread_local Clock::time_point virtualTime;
+    auto now = Clock::now();
+    if (virtualTime < now) {
+        virtualTime = now;
+    }
+    virtualTime += std::chrono::nanoseconds((long)(us * 1000));
+    if (virtualTime - now > std::chrono::milliseconds(1)) {
+        std::this_thread::sleep_until(virtualTime);
+    }
+}
+
+// File system: paths under /spiffs are mapped to a local directory. Reads and writes
+// are charged as newlib on the device would issue them to the file system: with the
+// default 128-byte stdio buffer, a read refills the buffer as many times as needed,
+// while on an unbuffered stream it reads directly into the caller's buffer
+static std::string gSpiffsDir;
+static std::string mapPath(const char* path)
+{
+    if (strncmp(path, "/spiffs/", 8) == 0) {
+        return gSpiffsDir + (path + 7);
+    }
+    return path;
+}
+struct FileModel
+{
+    int bufSize = 128;
+    int bufAvail = 0; // of read data in the modelled stdio buffer
+    int bufUsed = 0; // by written data
+};
+static Mutex gFilesMutex;
+static std::map<FILE*, FileModel> gFiles;
+static long gNumFsReads = 0;
+extern "C" FILE* __real_fopen(const char* path, const char* mode);
+extern "C" int __real_stat(const char* path, struct stat* st);
+extern "C" size_t __real_fread(void* buf, size_t size, size_t n, FILE* file);
+extern "C" size_t __real_fwrite(const void* buf, size_t size, size_t n, FILE* file);
+extern "C" int __real_fclose(FILE* file);
+extern "C" int __real_remove(const char* path);
+extern "C" int __wrap_remove(const char* path)
+{
+    return __real_remove(mapPath(path).c_str());
+}
+static long gNumFsStats = 0;
+extern "C" int __wrap_stat(const char* path, struct stat* st)
+{
+    gNumFsStats++;
+    spend(gCost.fsReadCall);
+    return __real_stat(mapPath(path).c_str(), st);
+}
+extern "C" FILE* __wrap_fopen(const char* path, const char* mode)
+{
+    FILE* file = __real_fopen(mapPath(path).c_str(), mode);
+    if (file) {
+        MutexLocker locker(gFilesMutex);
+        gFiles[file] = FileModel();
+    }
+    return file;
+}
+static long gNumFsSeeks = 0;
+extern "C" int __real_fseek(FILE* file, long offset, int whence);
+extern "C" int __wrap_fseek(FILE* file, long offset, int whence)
+{
+    gNumFsSeeks++;
+    spend(gCost.fsReadCall);
+    return __real_fseek(file, offset, whence);
+}
+extern "C" int __wrap_fclose(FILE* file)
+{
+    {
+        MutexLocker locker(gFilesMutex);
+        gFiles.erase(file);
+    }
+    return __real_fclose(file);
+}
+extern "C" int __wrap_setvbuf(FILE* file, char*, int mode, size_t size)
+{
+    MutexLocker locker(gFilesMutex);
+    gFiles[file].bufSize = (mode == _IONBF) ? 0 : (size ? size : 128);
+    return 0;
+}
+extern "C" size_t __wrap_fread(void* buf, size_t size, size_t n, FILE* file)
+{
+    size_t ret = __real_fread(buf, size, n, file);
+    size_t len = size * n;
+    double cost = 0;
+    {
+        MutexLocker locker(gFilesMutex);
+        auto& model = gFiles[file];
+        if (!model.bufSize) {
+            gNumFsReads++;
+            cost = gCost.fsReadCall + gCost.fsPerKb * len / 1024;
+        } else {
+            size_t fromBuf = std::min(len, (size_t)model.bufAvail);
+            model.bufAvail -= fromBuf;
+            for (len -= fromBuf; len > 0;) {
+                gNumFsReads++;
+                cost += gCost.fsReadCall + gCost.fsPerKb * model.bufSize / 1024;
+                size_t chunk = std::min(len, (size_t)model.bufSize);
+                model.bufAvail = model.bufSize - chunk;
+                len -= chunk;
+            }
+        }
+    }
+    spend(cost);
+    return ret;
+}
+static long gNumFsWrites = 0;
+extern "C" size_t __wrap_fwrite(const void* buf, size_t size, size_t n, FILE* file)
+{
+    size_t len = size * n;
+    int numCalls = 0;
+    {
+        // newlib fills the stdio buffer and writes it when full, but writes data of at
+        // least the buffer's size directly, in one call
+        MutexLocker locker(gFilesMutex);
+        auto& model = gFiles[file];
+        if (!model.bufSize) {
+            numCalls = 1;
+        } else if (model.bufUsed + len < (size_t)model.bufSize) {
+            model.bufUsed += len;
+        } else {
+            size_t remain = len;
+            if (model.bufUsed) {
+                remain -= model.bufSize - model.bufUsed;
+                numCalls++;
+            }
+            if (remain >= (size_t)model.bufSize) {
+                numCalls++;
+                remain %= model.bufSize;
+            }
+            model.bufUsed = remain;
+        }
+        gNumFsWrites += numCalls;
+    }
+    spend(gCost.fsWriteCall * numCalls + gCost.fsWritePerKb * len / 1024);
+    return __real_fwrite(buf, size, n, file);
+}
+
+// httpd stand-in
+struct TestReq: public httpd_req_t
+{
+    std::map<std::string, std::string> reqHeaders;
+    std::map<std::string, std::string> respHeaders;
+    std::string status = "200 OK";
+    std::string body;
+    std::string reqBody;
+    size_t recvPos = 0;
+    long contentLen = -1; // of the request, if not the size of reqBody
+    long numChunks = 0;
+    bool finished = false;
+    std::function<void()> onRecv; // called before each receive of the request body
+    TestReq(const char* aUri): httpd_req_t{}
+    {
+        strncpy((char*)uri, aUri, sizeof(uri) - 1);
+    }
+};
+static std::map<std::string, const httpd_uri_t*> gHandlers;
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t, const httpd_uri_t* uri)
+{
+    gHandlers[std::to_string(uri->method) + uri->uri] = uri;
+    return ESP_OK;
+}
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type)
+{
+    static_cast<TestReq*>(req)->respHeaders["Content-Type"] = type;
+    return ESP_OK;
+}
+esp_err_t httpd_resp_set_hdr(httpd_req_t* req, const char* name, const char* val)
+{
+    static_cast<TestReq*>(req)->respHeaders[name] = val;
+    return ESP_OK;
+}
+esp_err_t httpd_resp_set_status(httpd_req_t* req, const char* status)
+{
+    static_cast<TestReq*>(req)->status = status;
+    return ESP_OK;
+}
+esp_err_t httpd_resp_send_chunk(httpd_req_t* req, const char* data, ssize_t len)
+{
+    auto& r = *static_cast<TestReq*>(req);
+    assert(!r.finished);
+    if (len == HTTPD_RESP_USE_STRLEN) {
+        len = data ? strlen(data) : 0;
+    }
+    if (!len) {
+        r.finished = true;
+        return ESP_OK;
+    }
+    spend(gCost.sendCall + gCost.netPerKb * len / 1024);
+    r.body.append(data, len);
+    r.numChunks++;
+    return ESP_OK;
+}
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* data, ssize_t len)
+{
+    httpd_resp_send_chunk(req, data, len);
+    static_cast<TestReq*>(req)->finished = true;
+    return ESP_OK;
+}
+esp_err_t httpd_resp_send_err(httpd_req_t* req, httpd_err_code_t code, const char* msg)
+{
+    auto& r = *static_cast<TestReq*>(req);
+    r.status = (code == HTTPD_404_NOT_FOUND) ? "404" : (code == HTTPD_400_BAD_REQUEST) ? "400" : "500";
+    r.body = msg ? msg : "";
+    r.finished = true;
+    return ESP_OK;
+}
+int httpd_req_recv(httpd_req_t* req, char* buf, size_t len)
+{
+    auto& r = *static_cast<TestReq*>(req);
+    if (r.onRecv) {
+        r.onRecv();
+    }
+    if (r.recvPos == r.reqBody.size()) {
+        return HTTPD_SOCK_ERR_FAIL; // the client closed the connection
+    }
+    len = std::min(len, std::min(r.reqBody.size() - r.recvPos, (size_t)1436)); // a TCP segment at a time
+    spend(gCost.recvCall + gCost.netPerKb * len / 1024);
+    memcpy(buf, r.reqBody.data() + r.recvPos, len);
+    r.recvPos += len;
+    return len;
+}
+size_t httpd_req_get_hdr_value_len(httpd_req_t* req, const char* name)
+{
+    auto& hdrs = static_cast<TestReq*>(req)->reqHeaders;
+    auto it = hdrs.find(name);
+    return (it == hdrs.end()) ? 0 : it->second.size();
+}
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t* req, const char* name, char* buf, size_t size)
+{
+    auto& hdrs = static_cast<TestReq*>(req)->reqHeaders;
+    auto it = hdrs.find(name);
+    if (it == hdrs.end()) {
+        return ESP_FAIL;
+    }
+    snprintf(buf, size, "%s", it->second.c_str());
+    return (it->second.size() < size) ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+size_t httpd_req_get_url_query_len(httpd_req_t* req)
+{
+    auto q = strchr(req->uri, '?');
+    return q ? strlen(q + 1) : 0;
+}
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* req, char* buf, size_t size)
+{
+    auto q = strchr(req->uri, '?');
+    if (!q) {
+        return ESP_FAIL;
+    }
+    snprintf(buf, size, "%s", q + 1);
+    return ESP_OK;
+}
+
+static esp_err_t request(TestReq& req, int method=HTTP_GET)
+{
+    std::string uri = req.uri;
+    for (auto& item: gHandlers) {
+        auto& handler = *item.second;
+        size_t prefixLen = strlen(handler.uri) - 1; // all handlers are "/prefix/*"
+        if (handler.method == method && uri.compare(0, prefixLen, handler.uri, prefixLen) == 0) {
+            req.content_len = (req.contentLen < 0) ? req.reqBody.size() : req.contentLen;
+            return handler.handler(&req);
+        }
+    }
+    assert(false);
+    return ESP_FAIL;
+}
+
+static std::string makeFile(const std::string& path, size_t size)
+{
+    std::string data(size, 0);
+    uint32_t state = size;
+    for (auto& ch: data) {
+        state = state * 1103515245 + 12345;
+        ch = state >> 16;
+    }
+    FILE* f = __real_fopen(path.c_str(), "w");
+    __real_fwrite(data.data(), 1, size, f);
+    __real_fclose(f);
+    return data;
+}
+
+static void benchDownload(const char* name, const std::string& uri, const std::string& expected, int rounds,
+    const char* range=nullptr)
+{
+    long readsBefore = gNumFsReads;
+    long chunks = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        TestReq req(uri.c_str());
+        if (range) {
+            req.reqHeaders["Range"] = range;
+        }
+        assert(request(req) == ESP_OK);
+        assert(req.finished && req.body == expected);
+        chunks += req.numChunks;
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-18s %8zu bytes: %7.1f KB/s, %5ld fs reads, %4ld chunks per request\n", name, expected.size(),
+        expected.size() * rounds / 1024.0 / sec, (gNumFsReads - readsBefore) / rounds, chunks / rounds);
+}
+
+static void benchUpload(const char* name, const std::string& data, int rounds)
+{
+    long writesBefore = gNumFsWrites;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        TestReq req(name);
+        req.reqBody = data;
+        assert(request(req, HTTP_POST) == ESP_OK);
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("upload %8zu bytes: %7.1f KB/s, %5ld fs writes per request\n", data.size(),
+        data.size() * rounds / 1024.0 / sec, (gNumFsWrites - writesBefore) / rounds);
+}
+
+// A repeated page load, with the validator that the first response had
+static void benchRevalidate(const char* uri, int rounds)
+{
+    TestReq first(uri);
+    assert(request(first) == ESP_OK);
+    long readsBefore = gNumFsReads, statsBefore = gNumFsStats;
+    size_t bytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        TestReq req(uri);
+        req.reqHeaders["Accept-Encoding"] = "gzip, deflate";
+        req.reqHeaders["If-None-Match"] = first.respHeaders["ETag"];
+        assert(request(req) == ESP_OK && req.status == "304 Not Modified");
+        bytes += req.body.size();
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("%-18s revalidated: %7.2f ms, %5ld fs reads, %ld stats, %zu body bytes per request\n", uri,
+        sec * 1000 / rounds, (gNumFsReads - readsBefore) / rounds, (gNumFsStats - statsBefore) / rounds,
+        bytes / rounds);
+}
+
+int main()
+{
+    char dirTemplate[] = "/tmp/httpFileTest.XXXXXX";
+    std::string dir = mkdtemp(dirTemplate);
+    gSpiffsDir = dir + "/spiffs";
+    mkdir(gSpiffsDir.c_str(), 0755);
+    httpFsRegisterHandlers(nullptr);
+
+    auto small = makeFile(gSpiffsDir + "/app.js", 40000);
+    auto page = makeFile(gSpiffsDir + "/index.html", 3000);
+    auto big = makeFile(dir + "/recording.wav", 1024 * 1024);
+    auto empty = makeFile(dir + "/empty", 0);
+    auto exact = makeFile(dir + "/exact", 4 * 1436 * 2); // a multiple of the buffer size
+
+    // correctness, without the cost model
+    gSimulateCosts = false;
+    {
+        TestReq req("/www/index.html");
+        assert(request(req) == ESP_OK && req.body == page);
+        assert(req.respHeaders["Content-Type"] == "text/html");
+    }
+    for (auto& file: {std::make_pair("/empty", &empty), std::make_pair("/exact", &exact),
+                      std::make_pair("/recording.wav", &big)}) {
+        TestReq req(("/file" + dir + file.first).c_str());
+        assert(request(req) == ESP_OK);
+        assert(req.finished && req.body == *file.second);
+    }
+    {
+        TestReq req("/www/missing.js");
+        assert(request(req) == ESP_FAIL && req.status == "404");
+    }
+    {
+        std::string data = makeFile(dir + "/upload.tmp", 100000);
+        TestReq req(("/file" + dir + "/uploaded.bin").c_str());
+        req.reqBody = data;
+        assert(request(req, HTTP_POST) == ESP_OK);
+        TestReq get(("/file" + dir + "/uploaded.bin").c_str());
+        assert(request(get) == ESP_OK && get.body == data);
+    }
+    // uploads, with and without digests
+    {
+        auto upload = [&](const std::string& data, const char* hdrName=nullptr, std::string hdrVal="", long contentLen=-1) {
+            TestReq req(("/file" + dir + "/uploaded.bin").c_str());
+            req.reqBody = data;
+            req.contentLen = contentLen;
+            if (hdrName) {
+                req.reqHeaders[hdrName] = hdrVal;
+            }
+            auto ret = request(req, HTTP_POST);
+            assert(req.finished || ret == ESP_FAIL);
+            return std::make_pair(ret, req.status);
+        };
+        auto fileContent = [&]() {
+            std::string ret;
+            FILE* f = __real_fopen((dir + "/uploaded.bin").c_str(), "r");
+            if (!f) {
+                return std::string("<none>");
+            }
+            char buf[4096];
+            for (size_t n; (n = __real_fread(buf, 1, sizeof(buf), f)) > 0;) {
+                ret.append(buf, n);
+            }
+            __real_fclose(f);
+            return ret;
+        };
+        auto hexDigest = [](mbedtls_md_type_t type, const std::string& data) {
+            mbedtls_md_context_t ctx;
+            mbedtls_md_init(&ctx);
+            auto info = mbedtls_md_info_from_type(type);
+            mbedtls_md_setup(&ctx, info, 0);
+            mbedtls_md_starts(&ctx);
+            mbedtls_md_update(&ctx, (const unsigned char*)data.data(), data.size());
+            unsigned char digest[MBEDTLS_MD_MAX_SIZE];
+            mbedtls_md_finish(&ctx, digest);
+            mbedtls_md_free(&ctx);
+            std::string hex;
+            for (int i = 0; i < mbedtls_md_get_size(info); i++) {
+                char buf[3];
+                snprintf(buf, sizeof(buf), "%02x", digest[i]);
+                hex += buf;
+            }
+            return hex;
+        };
+        for (int bufSize: {4 * 1436, 1000, 512, 256}) { // and smaller than a sector
+            httpFsConfigIoBufs(bufSize, 4, false);
+            for (size_t size: {0, 1, 511, 512, 5632, 5633, 100000}) {
+                auto data = makeFile(dir + "/upload.tmp", size);
+                assert(upload(data).first == ESP_OK && fileContent() == data);
+            }
+        }
+        httpFsConfigIoBufs(4 * 1436, 4, false);
+        auto data = makeFile(dir + "/upload.tmp", 30000);
+        auto sha256 = hexDigest(MBEDTLS_MD_SHA256, data);
+        auto md5 = hexDigest(MBEDTLS_MD_MD5, data);
+        assert(upload(data, "X-Content-SHA256", sha256).first == ESP_OK && fileContent() == data);
+        assert(upload(data, "X-Content-MD5", md5).first == ESP_OK && fileContent() == data);
+        std::string upper = sha256;
+        for (auto& ch: upper) {
+            ch = toupper(ch);
+        }
+        assert(upload(data, "X-Content-SHA256", upper).first == ESP_OK);
+        std::string wrong = sha256;
+        wrong[10] = (wrong[10] == '0') ? '1' : '0';
+        auto ret = upload(data, "X-Content-SHA256", wrong);
+        assert(ret.first == ESP_FAIL && ret.second == "400" && fileContent() == "<none>");
+        ret = upload(data, "X-Content-MD5", sha256); // wrong length
+        assert(ret.first == ESP_FAIL && ret.second == "400");
+        // the connection breaks before all content is received
+        ret = upload(data, nullptr, "", data.size() + 10000);
+        assert(ret.first == ESP_FAIL && fileContent() == "<none>");
+    }
+    // several downloads at the same time, as a browser does
+    {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < 6; i++) {
+            threads.emplace_back([&]() {
+                for (int j = 0; j < 5; j++) {
+                    TestReq req(j & 1 ? "/www/app.js" : ("/file" + dir + "/recording.wav").c_str());
+                    assert(request(req) == ESP_OK);
+                    assert(req.body == (j & 1 ? small : big));
+                }
+            });
+        }
+        for (auto& thread: threads) {
+            thread.join();
+        }
+    }
+    // caching
+    {
+        TestReq req("/www/app.js");
+        assert(request(req) == ESP_OK && req.body == small);
+        assert(req.respHeaders["Content-Type"] == "application/javascript");
+        assert(req.respHeaders["Cache-Control"] == "no-cache");
+        auto etag = req.respHeaders["ETag"];
+        auto lastModified = req.respHeaders["Last-Modified"];
+        assert(etag.size() > 2 && etag.front() == '"' && !lastModified.empty());
+
+        TestReq cached("/www/app.js");
+        cached.reqHeaders["If-None-Match"] = "\"other\", W/" + etag;
+        assert(request(cached) == ESP_OK);
+        assert(cached.status == "304 Not Modified" && cached.body.empty() && cached.finished);
+        assert(cached.respHeaders["ETag"] == etag);
+
+        TestReq stale("/www/app.js");
+        stale.reqHeaders["If-None-Match"] = "\"other\"";
+        stale.reqHeaders["If-Modified-Since"] = lastModified; // ignored, If-None-Match takes precedence
+        assert(request(stale) == ESP_OK && stale.status == "200 OK" && stale.body == small);
+
+        TestReq sinceSame("/www/app.js");
+        sinceSame.reqHeaders["If-Modified-Since"] = lastModified;
+        assert(request(sinceSame) == ESP_OK && sinceSame.status == "304 Not Modified");
+
+        TestReq sinceOld("/www/app.js");
+        sinceOld.reqHeaders["If-Modified-Since"] = "Thu, 01 Jan 2015 00:00:00 GMT";
+        assert(request(sinceOld) == ESP_OK && sinceOld.body == small);
+
+        TestReq badDate("/www/app.js");
+        badDate.reqHeaders["If-Modified-Since"] = "yesterday";
+        assert(request(badDate) == ESP_OK && badDate.body == small);
+    }
+    {
+        // without modification times, the ETag changes when a file is uploaded
+        auto path = dir + "/nomtime.bin";
+        makeFile(path, 1000);
+        struct utimbuf times = {0, 0};
+        utime(path.c_str(), &times);
+        TestReq req(("/file" + path).c_str());
+        assert(request(req) == ESP_OK && req.respHeaders.count("Last-Modified") == 0);
+        auto etag = req.respHeaders["ETag"];
+        TestReq cached(("/file" + path).c_str());
+        cached.reqHeaders["If-None-Match"] = etag;
+        assert(request(cached) == ESP_OK && cached.status == "304 Not Modified");
+
+        TestReq upload(("/file" + dir + "/other.bin").c_str());
+        upload.reqBody = "data";
+        assert(request(upload, HTTP_POST) == ESP_OK);
+        TestReq after(("/file" + path).c_str());
+        after.reqHeaders["If-None-Match"] = etag;
+        assert(request(after) == ESP_OK && after.status == "200 OK" && after.body.size() == 1000);
+    }
+    // precompressed assets
+    {
+        auto gz = makeFile(gSpiffsDir + "/app.js.gz", 9000);
+        TestReq req("/www/app.js");
+        req.reqHeaders["Accept-Encoding"] = "gzip, deflate, br";
+        assert(request(req) == ESP_OK && req.body == gz);
+        assert(req.respHeaders["Content-Encoding"] == "gzip");
+        assert(req.respHeaders["Content-Type"] == "application/javascript");
+        assert(req.respHeaders["Vary"] == "Accept-Encoding");
+
+        TestReq cached("/www/app.js");
+        cached.reqHeaders["Accept-Encoding"] = "gzip";
+        cached.reqHeaders["If-None-Match"] = req.respHeaders["ETag"];
+        assert(request(cached) == ESP_OK && cached.status == "304 Not Modified");
+
+        for (const char* accept: {"", "deflate", "gzip;q=0, deflate"}) {
+            TestReq plain("/www/app.js");
+            if (*accept) {
+                plain.reqHeaders["Accept-Encoding"] = accept;
+            }
+            assert(request(plain) == ESP_OK && plain.body == small);
+            assert(plain.respHeaders.count("Content-Encoding") == 0);
+            assert(plain.respHeaders["ETag"] != req.respHeaders["ETag"]);
+        }
+        // /file/ always sends the file as it is
+        TestReq file(("/file" + gSpiffsDir + "/app.js").c_str());
+        file.reqHeaders["Accept-Encoding"] = "gzip";
+        assert(request(file) == ESP_OK && file.body == small);
+        assert(file.respHeaders["Content-Type"] == "application/javascript");
+
+        // only the compressed file is present
+        makeFile(gSpiffsDir + "/only.css.gz", 500);
+        TestReq onlyGz("/www/only.css");
+        onlyGz.reqHeaders["Accept-Encoding"] = "gzip";
+        assert(request(onlyGz) == ESP_OK && onlyGz.body.size() == 500);
+        assert(onlyGz.respHeaders["Content-Type"] == "text/css");
+        TestReq noGz("/www/only.css");
+        assert(request(noGz) == ESP_FAIL && noGz.status == "404");
+
+        // the name is shorter after unescaping, and the compressed file must still be found
+        auto escapedPlain = makeFile(gSpiffsDir + "/my page.html", 800);
+        auto escapedGz = makeFile(gSpiffsDir + "/my page.html.gz", 300);
+        TestReq escaped("/www/my%20page.html");
+        escaped.reqHeaders["Accept-Encoding"] = "gzip";
+        assert(request(escaped) == ESP_OK && escaped.body == escapedGz);
+        assert(escaped.respHeaders["Content-Encoding"] == "gzip");
+        TestReq escapedNoGz("/www/my%20page.html");
+        assert(request(escapedNoGz) == ESP_OK && escapedNoGz.body == escapedPlain);
+        assert(escapedNoGz.respHeaders.count("Content-Encoding") == 0);
+        remove((gSpiffsDir + "/app.js.gz").c_str());
+    }
+    // cache of static files
+    {
+        httpFsConfigCache(16384, 8192, false);
+        auto stats = [](uint32_t hits, uint32_t misses, uint32_t evictions) {
+            auto st = httpFsCacheStats();
+            return st.hits == hits && st.misses == misses && st.evictions == evictions;
+        };
+        TestReq first("/www/index.html");
+        assert(request(first) == ESP_OK && first.body == page && first.numChunks == 1);
+        assert(stats(0, 1, 0) && httpFsCacheStats().numEntries == 1);
+        long reads = gNumFsReads, fsStats = gNumFsStats;
+        TestReq hit("/www/index.html");
+        assert(request(hit) == ESP_OK && hit.body == page && hit.numChunks == 1);
+        assert(hit.respHeaders == first.respHeaders && hit.status == "200 OK");
+        assert(gNumFsReads == reads && gNumFsStats == fsStats);
+        assert(stats(1, 1, 0));
+        TestReq cached("/www/index.html");
+        cached.reqHeaders["If-None-Match"] = first.respHeaders["ETag"];
+        assert(request(cached) == ESP_OK && cached.status == "304 Not Modified" && cached.body.empty());
+        assert(stats(2, 1, 0));
+        TestReq range("/www/index.html");
+        range.reqHeaders["Range"] = "bytes=10-19";
+        assert(request(range) == ESP_OK && range.body == page.substr(10, 10));
+        assert(stats(2, 1, 0));
+
+        // too large for the cache
+        for (int i = 0; i < 2; i++) {
+            TestReq req("/www/app.js");
+            assert(request(req) == ESP_OK && req.body == small);
+        }
+        assert(stats(2, 3, 0) && httpFsCacheStats().numEntries == 1);
+
+        // the variants for clients that accept gzip and for those that don't
+        auto plain = makeFile(gSpiffsDir + "/small.js", 2000);
+        auto gz = makeFile(gSpiffsDir + "/small.js.gz", 700);
+        for (int i = 0; i < 2; i++) {
+            TestReq req("/www/small.js");
+            req.reqHeaders["Accept-Encoding"] = "gzip";
+            assert(request(req) == ESP_OK && req.body == gz && req.respHeaders["Content-Encoding"] == "gzip");
+            TestReq noGzip("/www/small.js");
+            assert(request(noGzip) == ESP_OK && noGzip.body == plain);
+            assert(noGzip.respHeaders.count("Content-Encoding") == 0);
+        }
+        assert(stats(4, 5, 0) && httpFsCacheStats().numEntries == 3);
+
+        // uploads and deletions invalidate
+        auto newPage = makeFile(dir + "/upload.tmp", 3500);
+        TestReq upload("/file/spiffs/index.html");
+        upload.reqBody = newPage;
+        assert(request(upload, HTTP_POST) == ESP_OK);
+        TestReq updated("/www/index.html");
+        assert(request(updated) == ESP_OK && updated.body == newPage);
+        TestReq del("/delfile/spiffs/small.js.gz");
+        assert(request(del) == ESP_OK);
+        TestReq afterDel("/www/small.js");
+        afterDel.reqHeaders["Accept-Encoding"] = "gzip";
+        assert(request(afterDel) == ESP_OK && afterDel.body == plain);
+        assert(afterDel.respHeaders.count("Content-Encoding") == 0);
+        assert(stats(4, 7, 0));
+        page = newPage;
+        // the same, with a name that is shorter after unescaping
+        makeFile(gSpiffsDir + "/new page.html", 1000);
+        TestReq escaped("/www/new%20page.html");
+        assert(request(escaped) == ESP_OK && escaped.body.size() == 1000);
+        auto escapedNew = makeFile(dir + "/upload.tmp", 1100);
+        TestReq escapedUpload("/file/spiffs/new%20page.html");
+        escapedUpload.reqBody = escapedNew;
+        assert(request(escapedUpload, HTTP_POST) == ESP_OK);
+        TestReq escapedUpdated("/www/new%20page.html");
+        assert(request(escapedUpdated) == ESP_OK && escapedUpdated.body == escapedNew);
+        TestReq escapedDel("/delfile/spiffs/new%20page.html");
+        assert(request(escapedDel) == ESP_OK);
+        TestReq escapedRemoved("/www/new%20page.html");
+        assert(request(escapedRemoved) == ESP_FAIL && escapedRemoved.status == "404");
+
+        // a GET during an upload caches the partial content, which must not outlive it
+        auto getDuringUpload = [](TestReq& upload) {
+            upload.onRecv = [&upload]() {
+                if (upload.recvPos >= 2000 && upload.onRecv) {
+                    auto onRecv = std::move(upload.onRecv); // the GET must not recurse
+                    TestReq get("/www/index.html");
+                    assert(request(get) == ESP_OK);
+                }
+            };
+        };
+        newPage = makeFile(dir + "/upload.tmp", 3600);
+        TestReq upload2("/file/spiffs/index.html");
+        upload2.reqBody = newPage;
+        getDuringUpload(upload2);
+        assert(request(upload2, HTTP_POST) == ESP_OK);
+        TestReq complete("/www/index.html");
+        assert(request(complete) == ESP_OK && complete.body == newPage);
+        page = newPage;
+        TestReq broken("/file/spiffs/index.html");
+        broken.reqBody = newPage;
+        broken.contentLen = newPage.size() + 1000;
+        getDuringUpload(broken);
+        assert(request(broken, HTTP_POST) == ESP_FAIL);
+        TestReq removed("/www/index.html");
+        assert(request(removed) == ESP_FAIL && removed.status == "404");
+        makeFile(gSpiffsDir + "/index.html", page.size());
+
+        // least recently used files are evicted
+        httpFsConfigCache(10000, 8192, false);
+        auto get = [](const std::string& name) {
+            TestReq req(("/www/" + name).c_str());
+            assert(request(req) == ESP_OK && req.body.size() == 3000);
+        };
+        for (int i = 0; i < 4; i++) {
+            makeFile(gSpiffsDir + "/f" + std::to_string(i), 3000);
+        }
+        auto before = httpFsCacheStats();
+        get("f0"); get("f1"); get("f2"); // 9000 bytes
+        get("f0");
+        get("f3"); // evicts f1
+        auto after = httpFsCacheStats();
+        assert(after.evictions - before.evictions == 1 && after.numBytes == 9000 && after.numEntries == 3);
+        get("f0"); get("f2"); get("f3");
+        assert(httpFsCacheStats().hits - after.hits == 3);
+        get("f1");
+        assert(httpFsCacheStats().misses - after.misses == 1);
+        httpFsConfigCache(0, 0, false);
+        assert(httpFsCacheStats().numEntries == 0);
+    }
+    // ranges
+    {
+        auto get = [&](const char* range, const char* ifRange=nullptr) {
+            TestReq* req = new TestReq(("/file" + dir + "/recording.wav").c_str());
+            req->reqHeaders["Range"] = range;
+            if (ifRange) {
+                req->reqHeaders["If-Range"] = ifRange;
+            }
+            assert(request(*req) == ESP_OK && req->finished);
+            assert(req->respHeaders["Accept-Ranges"] == "bytes");
+            return std::unique_ptr<TestReq>(req);
+        };
+        long size = big.size();
+        struct { const char* range; long start, len; } ranges[] = {
+            { "bytes=0-0", 0, 1 }, { "bytes=0-99", 0, 100 }, { "bytes=1000-", 1000, size - 1000 },
+            { "bytes=500000-500000", 500000, 1 }, { "bytes=-100", size - 100, 100 },
+            { "bytes=-2000000", 0, size }, { "bytes=1048000-2000000", 1048000, size - 1048000 },
+            { "bytes=5744-17231", 5744, 4 * 1436 * 2 }, // whole buffers
+            { "bytes=100-11587", 100, 4 * 1436 * 2 }, // unaligned
+        };
+        for (int bufSize: {4 * 1436, 1000}) { // and with buffers that aren't a divisor of the ranges
+            httpFsConfigIoBufs(bufSize, 4, false);
+            for (auto& range: ranges) {
+                auto req = get(range.range);
+                assert(req->status == "206 Partial Content");
+                assert(req->body == big.substr(range.start, range.len));
+                char expected[64];
+                snprintf(expected, sizeof(expected), "bytes %ld-%ld/%ld", range.start, range.start + range.len - 1, size);
+                assert(req->respHeaders["Content-Range"] == expected);
+            }
+        }
+        httpFsConfigIoBufs(4 * 1436, 4, false);
+        // ignored, the whole file is sent
+        for (const char* range: {"bytes=0-10,20-30", "items=0-10", "bytes=10-5", "bytes=abc", "bytes=--5", "bytes=5"}) {
+            auto req = get(range);
+            assert(req->status == "200 OK" && req->body == big);
+            assert(req->respHeaders.count("Content-Range") == 0);
+        }
+        for (const char* range: {"bytes=1048576-", "bytes=2000000-3000000", "bytes=-0"}) {
+            auto req = get(range);
+            assert(req->status == "416 Range Not Satisfiable" && req->body.empty());
+            assert(req->respHeaders["Content-Range"] == "bytes */1048576");
+        }
+        // resuming
+        auto full = get("bytes=0-");
+        auto etag = full->respHeaders["ETag"];
+        auto lastModified = full->respHeaders["Last-Modified"];
+        assert(get("bytes=100-", etag.c_str())->body == big.substr(100));
+        assert(get("bytes=100-", lastModified.c_str())->body == big.substr(100));
+        assert(get("bytes=100-", ("W/" + etag).c_str())->body == big);
+        assert(get("bytes=100-", "\"other\"")->body == big);
+        assert(get("bytes=100-", "Thu, 01 Jan 2015 00:00:00 GMT")->body == big);
+
+        TestReq empty(("/file" + dir + "/empty").c_str());
+        empty.reqHeaders["Range"] = "bytes=0-";
+        assert(request(empty) == ESP_OK && empty.status == "416 Range Not Satisfiable");
+    }
+    printf("Correctness tests passed\n");
+
+    gSimulateCosts = true;
+    benchDownload("/www/index.html", "/www/index.html", page, 20);
+    benchDownload("/www/app.js", "/www/app.js", small, 10);
+    benchDownload("/file/recording.wav", "/file" + dir + "/recording.wav", big, 2);
+    benchRevalidate("/www/app.js", 20);
+    httpFsConfigCache(65536, 49152, false);
+    benchDownload("cached index.html", "/www/index.html", page, 20);
+    benchDownload("cached app.js", "/www/app.js", small, 10);
+    httpFsConfigCache(0, 0, false);
+    benchUpload(("/file" + dir + "/uploaded.bin").c_str(), big, 2);
+    // resuming the download of the last 10%, or a player seeking near the end
+    benchDownload("bytes=943718-", "/file" + dir + "/recording.wav", big.substr(943718), 10, "bytes=943718-");
+
+    std::string cmd = "rm -rf " + dir;
+    int ret = system(cmd.c_str()) == 0 ? 0 : 1;
+    fflush(stdout);
+    _exit(ret); // the static file reader's task never ends, don't wait for it in its destructor
+}
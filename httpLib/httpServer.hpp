@@ -1,5 +1,6 @@
 #include <esp_http_server.h>
 #include "utils.hpp"
+#include "jsonWriter.hpp"
 #include <lwip/sockets.h>
 namespace http {
 extern const char* TAG;
@@ -183,16 +184,22 @@ static esp_err_t jsonSend(httpd_req_t* req, const std::string& json)
     ESP_ERROR_CHECK(httpd_resp_set_type(req, "text/json"));
     return httpd_resp_send(req, json.c_str(), json.size());
 }
+static esp_err_t jsonSend(httpd_req_t* req, const char* json, int len)
+{
+    ESP_ERROR_CHECK(httpd_resp_set_type(req, "text/json"));
+    return httpd_resp_send(req, json, len);
+}
 template<typename...Args>
 static void jsonSendError(httpd_req_t* req, Args&&... args)
 {
-    static const char prefix[] = "{\"err\":\"";
-    static const char suffix[] = "\"}";
-    std::string json = prefix;
-    (appendAny(json, std::forward<Args>(args)), ...);
-    json.append(suffix);
-    ESP_LOGW("HTTP", "Responding with JSON error: %.*s", json.size() - sizeof(prefix) - sizeof(suffix) + 2, json.c_str() + sizeof(prefix) - 1);
-    jsonSend(req,  json);
+    enum { kPrefixLen = 8, kSuffixLen = 2 }; // {"err":" and "}
+    SmallDynBuffer<256> buf;
+    JsonWriter<JsonDynBufferSink<SmallDynBuffer<256>>, 64> json(buf);
+    json.beginObject().key("err").valueConcat(std::forward<Args>(args)...).endObject();
+    json.finish();
+    ESP_LOGW("HTTP", "Responding with JSON error: %.*s", buf.dataSize() - kPrefixLen - kSuffixLen,
+        buf.buf() + kPrefixLen);
+    jsonSend(req, buf.buf(), buf.dataSize());
 }
 esp_err_t sendEspError(httpd_req_t* req, httpd_err_code_t code, esp_err_t err, const char* msg, int msgLen = -1);
 
@@ -0,0 +1,119 @@
+#ifndef IO_BUF_POOL_HPP
+#define IO_BUF_POOL_HPP
+
+#include <stdlib.h>
+#include <vector>
+#include <utility>
+#include "utils.hpp"
+
+/** Pool of equally sized I/O buffers, shared by the handlers that stream file data,
+ * so that large buffers don't have to be allocated and freed for every request, and
+ * don't fragment the heap. Buffers are allocated on first use and kept for reuse, up to
+ * the configured number. If more are needed at a time, temporary ones are allocated,
+ * and freed when released.
+ */
+class IoBufPool
+{
+public:
+    class Buf
+    {
+    protected:
+        IoBufPool* mPool = nullptr;
+        char* mData = nullptr;
+        int mSize = 0;
+        int mGeneration = -1; // configuration the buffer belongs to, -1 if temporary
+        friend class IoBufPool;
+        Buf(IoBufPool* pool, char* data, int size, int generation)
+        : mPool(pool), mData(data), mSize(size), mGeneration(generation) {}
+    public:
+        Buf() {}
+        Buf(Buf&& other) { *this = std::move(other); }
+        Buf& operator=(Buf&& other)
+        {
+            std::swap(mPool, other.mPool);
+            std::swap(mData, other.mData);
+            std::swap(mSize, other.mSize);
+            std::swap(mGeneration, other.mGeneration);
+            return *this;
+        }
+        ~Buf() { release(); }
+        char* data() const { return mData; }
+        int size() const { return mSize; }
+        explicit operator bool() const { return mData != nullptr; }
+        void release()
+        {
+            if (mData) {
+                mPool->put(mData, mGeneration);
+                mData = nullptr;
+            }
+        }
+    };
+protected:
+    Mutex mMutex;
+    std::vector<char*> mFree;
+    int mBufSize;
+    int mMaxBufs;
+    int mNumAllocated = 0; // pooled buffers, in use or free
+    int mGeneration = 0; // incremented by configure()
+    bool mUsePsram;
+    uint32_t mNumTempAllocs = 0;
+    void put(char* data, int generation)
+    {
+        MutexLocker locker(mMutex);
+        if (generation == mGeneration) {
+            mFree.push_back(data);
+        } else {
+            free(data); // temporary, or allocated before a reconfiguration
+        }
+    }
+public:
+    IoBufPool(int bufSize, int maxBufs, bool usePsram)
+    : mBufSize(bufSize), mMaxBufs(maxBufs), mUsePsram(usePsram) {}
+    ~IoBufPool()
+    {
+        for (auto buf: mFree) {
+            free(buf);
+        }
+    }
+    /** Changes the size and number of buffers. Buffers that are in use at the time are
+     * freed when released */
+    void configure(int bufSize, int maxBufs, bool usePsram)
+    {
+        MutexLocker locker(mMutex);
+        for (auto buf: mFree) {
+            free(buf);
+        }
+        mFree.clear();
+        mNumAllocated = 0;
+        mGeneration++;
+        mBufSize = bufSize;
+        mMaxBufs = maxBufs;
+        mUsePsram = usePsram;
+    }
+    int bufSize() const { return mBufSize; }
+    /** The number of buffers that had to be allocated temporarily, because all pooled
+     * ones were in use */
+    uint32_t numTempAllocs() const { return mNumTempAllocs; }
+    /** Returns a buffer, or an empty one if out of memory */
+    Buf get()
+    {
+        MutexLocker locker(mMutex);
+        if (!mFree.empty()) {
+            char* data = mFree.back();
+            mFree.pop_back();
+            return Buf(this, data, mBufSize, mGeneration);
+        }
+        char* data = (char*)(mUsePsram ? utils::mallocTrySpiram(mBufSize) : malloc(mBufSize));
+        if (!data) {
+            return Buf();
+        }
+        if (mNumAllocated < mMaxBufs) {
+            mNumAllocated++;
+            return Buf(this, data, mBufSize, mGeneration);
+        }
+        mNumTempAllocs++;
+        return Buf(this, data, mBufSize, -1);
+    }
+};
+
+#endif
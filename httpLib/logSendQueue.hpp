@@ -0,0 +1,116 @@
+#ifndef LOG_SEND_QUEUE_HPP
+#define LOG_SEND_QUEUE_HPP
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.hpp"
+
+/** Bounded queue of log messages waiting to be sent to a client. The messages are
+ * stored in a circular byte buffer that is allocated once, each one as a 16-bit length
+ * followed by the data, wrapping at the end of the buffer. When a message doesn't fit,
+ * the oldest ones are dropped to make room, and counted, so that a client that lags
+ * behind loses old lines instead of stalling the tasks that log.
+ * Not thread-safe, the owner does the locking.
+ */
+class LogSendQueue
+{
+protected:
+    enum: uint32_t { kLenSize = sizeof(uint16_t) };
+    char* mBuf;
+    uint32_t mSize;
+    uint32_t mHead = 0; // offset of the oldest message
+    uint32_t mDataSize = 0;
+    uint32_t mNumDropped = 0;
+    void copyIn(uint32_t ofs, const char* data, uint32_t len)
+    {
+        uint32_t toEnd = mSize - ofs;
+        if (len <= toEnd) {
+            memcpy(mBuf + ofs, data, len);
+        } else {
+            memcpy(mBuf + ofs, data, toEnd);
+            memcpy(mBuf, data + toEnd, len - toEnd);
+        }
+    }
+    void copyOut(uint32_t ofs, char* data, uint32_t len) const
+    {
+        uint32_t toEnd = mSize - ofs;
+        if (len <= toEnd) {
+            memcpy(data, mBuf + ofs, len);
+        } else {
+            memcpy(data, mBuf + ofs, toEnd);
+            memcpy(data + toEnd, mBuf, len - toEnd);
+        }
+    }
+    uint32_t wrap(uint32_t ofs) const { return (ofs >= mSize) ? ofs - mSize : ofs; }
+    uint16_t msgLenAt(uint32_t ofs) const
+    {
+        uint16_t len;
+        copyOut(ofs, (char*)&len, kLenSize);
+        return len;
+    }
+    void popFirst()
+    {
+        uint32_t recSize = kLenSize + msgLenAt(mHead);
+        mHead = wrap(mHead + recSize);
+        mDataSize -= recSize;
+    }
+public:
+    LogSendQueue(uint32_t size): mBuf((char*)malloc(size)), mSize(mBuf ? size : 0) {}
+    ~LogSendQueue() { free(mBuf); }
+    LogSendQueue(const LogSendQueue&) = delete;
+    bool empty() const { return mDataSize == 0; }
+    uint32_t dataSize() const { return mDataSize; }
+    /** Returns the number of messages dropped since the last call, and resets it */
+    uint32_t takeNumDropped()
+    {
+        uint32_t ret = mNumDropped;
+        mNumDropped = 0;
+        return ret;
+    }
+    /** Queues a message, dropping the oldest ones if there is no room for it. A message
+     * that is larger than the whole queue is dropped
+     * @returns false if the message was dropped
+     */
+    bool push(const char* data, uint32_t len)
+    {
+        uint32_t recSize = kLenSize + len;
+        if (len > 0xffff || recSize > mSize) {
+            mNumDropped++;
+            return false;
+        }
+        while (mSize - mDataSize < recSize) {
+            popFirst();
+            mNumDropped++;
+        }
+        uint32_t ofs = wrap(mHead + mDataSize);
+        uint16_t len16 = len;
+        copyIn(ofs, (const char*)&len16, kLenSize);
+        copyIn(wrap(ofs + kLenSize), data, len);
+        mDataSize += recSize;
+        return true;
+    }
+    /** Moves whole messages to the end of \c out, as long as they fit in \c maxLen bytes.
+     * A single message longer than maxLen is moved anyway.
+     * @returns the number of bytes moved
+     */
+    int popInto(DynBuffer& out, int maxLen)
+    {
+        int total = 0;
+        while (mDataSize) {
+            uint16_t len = msgLenAt(mHead);
+            if (total && total + len > maxLen) {
+                break;
+            }
+            if (len) {
+                copyOut(wrap(mHead + kLenSize), out.getAppendPtr(len), len);
+                out.expandDataSize(len);
+                total += len;
+            }
+            popFirst();
+        }
+        return total;
+    }
+};
+
+#endif
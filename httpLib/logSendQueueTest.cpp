@@ -0,0 +1,71 @@
+// Host test of LogSendQueue against a model with the same drop-oldest policy
+// Build: g++ -O2 -std=gnu++17 -I../mySystem logSendQueueTest.cpp -o logSendQueueTest
+#include "logSendQueue.hpp"
+#include <string>
+#include <deque>
+#include <assert.h>
+#include <stdio.h>
+
+static uint32_t gRandState = 12345;
+uint32_t rnd()
+{
+    gRandState = gRandState * 1103515245 + 12345;
+    return gRandState >> 8;
+}
+
+void testAgainstModel(uint32_t queueSize, uint32_t maxMsgLen, uint32_t maxPopLen)
+{
+    LogSendQueue queue(queueSize);
+    std::deque<std::string> model;
+    uint32_t modelSize = 0;
+    uint32_t modelDropped = 0;
+    long numPushed = 0, numReceived = 0;
+    std::string received, expected;
+    for (int i = 0; i < 200000; i++) {
+        if (rnd() % 3) {
+            std::string msg = std::to_string(numPushed++) + ":";
+            msg.resize(rnd() % maxMsgLen, 'a' + i % 26);
+            bool pushed = queue.push(msg.data(), msg.size());
+            if (2 + msg.size() > queueSize) {
+                assert(!pushed);
+                modelDropped++;
+            } else {
+                assert(pushed);
+                while (queueSize - modelSize < 2 + msg.size()) {
+                    modelSize -= 2 + model.front().size();
+                    model.pop_front();
+                    modelDropped++;
+                }
+                model.push_back(msg);
+                modelSize += 2 + msg.size();
+            }
+        } else {
+            DynBuffer out;
+            int len = queue.popInto(out, maxPopLen);
+            assert(len == out.dataSize());
+            expected.clear();
+            while (!model.empty() && (expected.empty() || expected.size() + model.front().size() <= maxPopLen)) {
+                expected += model.front();
+                modelSize -= 2 + model.front().size();
+                model.pop_front();
+                numReceived++;
+            }
+            assert(std::string(out.buf(), out.dataSize()) == expected);
+        }
+        assert(queue.dataSize() == modelSize);
+        if (rnd() % 50 == 0) {
+            assert(queue.takeNumDropped() == modelDropped);
+            modelDropped = 0;
+        }
+    }
+    printf("queue %u: %ld pushed, %ld received\n", queueSize, numPushed, numReceived);
+}
+
+int main()
+{
+    testAgainstModel(1024, 100, 400);
+    testAgainstModel(256, 300, 1000); // some messages larger than the queue
+    testAgainstModel(65536, 2000, 4096);
+    testAgainstModel(100, 30, 10); // pops one message at a time
+    return 0;
+}
@@ -4,12 +4,26 @@
 #include <sys/socket.h>
 #include "netLogger.hpp"
 #include "utils.hpp"
+#include "binLog.hpp"
+#if __has_include(<esp_memory_utils.h>)
+    #include <esp_memory_utils.h>
+#else
+    #include <soc/soc_memory_layout.h>
+#endif
+#include <algorithm>
 
 extern "C" int httpd_default_send(httpd_handle_t hd, int sockfd, const char *buf, size_t buf_len, int flags);
 NetLogger* NetLogger::gInstance = nullptr;
 
 int NetLogger::vprintf(const char * format, va_list args)
 {
+    // Only a format string in flash is known to outlive the call
+    if (gInstance->mBinQueue && esp_ptr_in_drom(format)) {
+        int ret = gInstance->binVprintf(format, args);
+        if (ret >= 0) {
+            return ret;
+        }
+    }
     MutexLocker lock(gInstance->mMutex);
     auto& buf = gInstance->mBuf;
     int num;
@@ -23,14 +37,271 @@ int NetLogger::vprintf(const char * format, va_list args)
             buf.resize(num + 32);
         }
     }
-    if (!gInstance->mDisableDefault) {
-        fwrite(buf.data(), 1, num, stdout);
+    // In binary mode, queue the text behind the deferred messages, so that it
+    // is not output before earlier ones
+    if (!gInstance->mBinQueue || !gInstance->queueText(buf.data(), num)) {
+        gInstance->outputText(buf.data(), num);
+    }
+    return num;
+}
+
+bool NetLogger::queueText(const char* text, int len)
+{
+    if (StreamItem::sizeFor(len) > mBinQueue->size() / 4) {
+        return false; // would take too much of the queue, output directly
+    }
+    MutexLocker lock(mBinMutex);
+    if (!mBinQueue->push(kItemText, text, len, esp_log_timestamp(), 0)) {
+        mBinDropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    return true;
+}
+
+void NetLogger::outputText(const char* data, int len)
+{
+    if (!mDisableDefault) {
+        fwrite(data, 1, len, stdout);
         fflush(stdout);
     }
-    if (gInstance->mSinkFunc) {
-        gInstance->mSinkFunc(buf.data(), num, gInstance->mSinkFuncUserp);
+    if (mSinkFunc) {
+        mSinkFunc(data, len, mSinkFuncUserp);
+    }
+}
+
+int NetLogger::binVprintf(const char* format, va_list args)
+{
+    MutexLocker lock(mBinMutex);
+    auto item = mBinQueue->reserve(kItemRecord, sizeof(BinRecord) + kMaxBinArgsSize,
+        esp_log_timestamp(), 0);
+    if (!item) {
+        mBinDropped.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    auto& rec = *reinterpret_cast<BinRecord*>(item->data());
+    int len = binlog::encodeArgs(item->data() + sizeof(BinRecord), kMaxBinArgsSize, format, args);
+    if (len < 0) {
+        mBinQueue->abort();
+        return -1;
+    }
+    rec.fmt = format;
+    rec.task = xTaskGetCurrentTaskHandle();
+    // the name is an array in the task control block
+    memcpy(rec.taskName, pcTaskGetName(rec.task), sizeof(rec.taskName));
+    mBinQueue->commit(item, sizeof(BinRecord) + len);
+    return 0;
+}
+
+bool NetLogger::enableBinaryMode(int queueSize, UBaseType_t prio, BaseType_t cpuCore)
+{
+    MutexLocker lock(mMutex);
+    if (mBinQueue) {
+        return true;
+    }
+    enum { kMinQueueSize = 4 * (sizeof(StreamItem) + sizeof(BinRecord) + kMaxBinArgsSize) };
+    mBinQueue = new StreamRingQueue(std::max(queueSize, (int)kMinQueueSize));
+    if (!mFormatTask.createTask("binlog", false, kFormatTaskStackSize, cpuCore, prio,
+        this, &NetLogger::formatTaskFunc)) {
+        delete mBinQueue;
+        mBinQueue = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void NetLogger::formatTaskFunc()
+{
+    DynBuffer text(kInitialBufSize);
+    for (;;) {
+        auto item = mBinQueue->peek(-1);
+        if (!item) {
+            break;
+        }
+        MutexLocker lock(mMutex);
+        uint32_t dropped = mBinDropped.load(std::memory_order_relaxed);
+        if (dropped != mBinDroppedReported) {
+            text.clear();
+            text.printf("W (%u) binlog: %u messages dropped\n", (unsigned)esp_log_timestamp(),
+                (unsigned)(dropped - mBinDroppedReported));
+            outputText(text.buf(), text.dataSize() - 1);
+            mBinDroppedReported = dropped;
+        }
+        if (item->type == kItemText) {
+            outputText(item->data(), item->dataLen);
+            mBinQueue->pop(item);
+            continue;
+        }
+        auto& rec = *reinterpret_cast<const BinRecord*>(item->data());
+        const char* args = item->data() + sizeof(BinRecord);
+        int argsLen = item->dataLen - sizeof(BinRecord);
+        // Format only if someone needs text
+        if (!mDisableDefault || (mSinkFunc && (mSinkFunc != logSink || (int)mConnections.size() > mNumBinConns))) {
+            text.clear();
+            binlog::formatArgs(text, rec.fmt, args, argsLen);
+            outputText(text.buf(), text.dataSize());
+        }
+        if (mNumBinConns) {
+            sendBinRecord(rec, item->timestamp, args, argsLen);
+        }
+        mBinQueue->pop(item);
+    }
+}
+
+bool NetLogger::LogConn::markSent(uint32_t id)
+{
+    auto it = std::lower_bound(sentIds.begin(), sentIds.end(), id);
+    if (it != sentIds.end() && *it == id) {
+        return false;
+    }
+    sentIds.insert(it, id);
+    return true;
+}
+
+void NetLogger::LogConn::forgetSent(uint32_t id)
+{
+    auto it = std::lower_bound(sentIds.begin(), sentIds.end(), id);
+    if (it != sentIds.end() && *it == id) {
+        sentIds.erase(it);
+    }
+}
+
+void NetLogger::updateTaskName(uint32_t id, const char* name)
+{
+    auto it = std::lower_bound(mTaskNames.begin(), mTaskNames.end(), id,
+        [](const TaskName& item, uint32_t val) { return item.id < val; });
+    if (it != mTaskNames.end() && it->id == id) {
+        if (strncmp(it->name, name, sizeof(it->name)) == 0) {
+            return;
+        }
+        // the task was deleted and its handle reused, send the new name
+        for (auto conn: mConnections) {
+            conn->forgetSent(id);
+        }
+    } else {
+        it = mTaskNames.insert(it, TaskName{id, {}});
+    }
+    memcpy(it->name, name, sizeof(it->name));
+}
+
+void NetLogger::sendBinRecord(const BinRecord& rec, uint32_t timestamp, const char* args, int argsLen)
+{
+    uint32_t taskId = (uintptr_t)rec.task;
+    MutexLocker lock(mListMutex);
+    updateTaskName(taskId, rec.taskName);
+    binlog::FrameHeader hdr = { binlog::kFrameRecord, 0, (uint16_t)(sizeof(binlog::RecordHeader) + argsLen) };
+    binlog::RecordHeader recHdr = { (uint32_t)(uintptr_t)rec.fmt, timestamp, taskId };
+    mFrameBuf.clear();
+    mFrameBuf.appendVal(hdr).appendVal(recHdr).append(args, argsLen);
+    for (auto conn: mConnections) {
+        if (conn->flags & LogConn::kFlagBinary) {
+            queueForSend(*conn, mFrameBuf.buf(), mFrameBuf.dataSize());
+        }
+    }
+}
+
+void NetLogger::appendBinDefinitions(LogConn& conn, const char* data, int len, DynBuffer& out)
+{
+    // The format strings and task names are sent just before the first record that
+    // refers to them, rather than when queueing the record, as the queued frame
+    // with them could be dropped
+    auto appendFrame = [&out](uint8_t type, uint32_t id, const char* str, int strLen) {
+        binlog::FrameHeader hdr = { type, 0, (uint16_t)(sizeof(id) + strLen) };
+        out.appendVal(hdr).appendVal(id).append(str, strLen);
+    };
+    const char* end = data + len;
+    while (end - data >= (int)sizeof(binlog::FrameHeader)) {
+        binlog::FrameHeader hdr;
+        memcpy(&hdr, data, sizeof(hdr));
+        int frameLen = sizeof(hdr) + hdr.len;
+        if (hdr.type == binlog::kFrameRecord) {
+            binlog::RecordHeader rec;
+            memcpy(&rec, data + sizeof(hdr), sizeof(rec));
+            if (conn.markSent(rec.fmtId)) {
+                auto fmt = (const char*)(uintptr_t)rec.fmtId; // in flash, so it's still there
+                appendFrame(binlog::kFrameFormat, rec.fmtId, fmt, strlen(fmt));
+            }
+            if (conn.markSent(rec.taskId)) {
+                auto it = std::lower_bound(mTaskNames.begin(), mTaskNames.end(), rec.taskId,
+                    [](const TaskName& item, uint32_t val) { return item.id < val; });
+                if (it != mTaskNames.end() && it->id == rec.taskId) {
+                    appendFrame(binlog::kFrameTask, rec.taskId, it->name, strnlen(it->name, sizeof(it->name)));
+                }
+            }
+        }
+        out.append(data, frameLen);
+        data += frameLen;
+    }
+}
+
+void NetLogger::queueForSend(LogConn& conn, const char* data, int len)
+{
+    if (conn.closed) {
+        return;
+    }
+    conn.queue.push(data, len);
+    mSenderEvents.setBits(kEvtHaveData);
+}
+
+void NetLogger::appendDropMarker(LogConn& conn, DynBuffer& buf, uint32_t numDropped)
+{
+    char text[64];
+    int len = snprintf(text, sizeof(text), "W (%u) netlog: %u lines dropped, client too slow\n",
+        (unsigned)esp_log_timestamp(), (unsigned)numDropped);
+    if (conn.flags & LogConn::kFlagBinary) {
+        binlog::FrameHeader hdr = { binlog::kFrameText, 0, (uint16_t)len };
+        buf.appendVal(hdr);
+    }
+    buf.append(text, len);
+}
+
+void NetLogger::senderTaskFunc()
+{
+    for (;;) {
+        mSenderEvents.waitForOneAndReset(kEvtHaveData, -1);
+        // Round-robin over the connections, sending what is queued for each one
+        // in a single chunk, until all queues are empty
+        for (bool sentAny = true; sentAny;) {
+            sentAny = false;
+            for (size_t i = 0;; i++) {
+                LogConn* conn;
+                {
+                    MutexLocker lock(mListMutex);
+                    if (i >= mConnections.size()) {
+                        break;
+                    }
+                    conn = mConnections[i];
+                    if (conn->closed || conn->queue.empty()) {
+                        continue;
+                    }
+                    mSendBuf.clear();
+                    auto numDropped = conn->queue.takeNumDropped();
+                    if (numDropped) {
+                        appendDropMarker(*conn, mSendBuf, numDropped);
+                    }
+                    if (conn->flags & LogConn::kFlagBinary) {
+                        mPopBuf.clear();
+                        conn->queue.popInto(mPopBuf, kMaxSendChunkSize);
+                        appendBinDefinitions(*conn, mPopBuf.buf(), mPopBuf.dataSize(), mSendBuf);
+                    } else {
+                        conn->queue.popInto(mSendBuf, kMaxSendChunkSize);
+                    }
+                    conn->sending = true;
+                }
+                bool ok = httpSendChunk(conn->sockfd, mSendBuf.buf(), mSendBuf.dataSize());
+                sentAny = true;
+                MutexLocker lock(mListMutex);
+                conn->sending = false;
+                if (conn->closed) {
+                    if (!std::count(mConnections.begin(), mConnections.end(), conn)) {
+                        delete conn; // connCloseFunc() was called while we were sending
+                    }
+                } else if (!ok) {
+                    // this schedules an async call to connCloseFunc() on the httpd thread
+                    conn->closed = true;
+                    httpd_sess_trigger_close(mHttpServer, conn->sockfd);
+                }
+            }
+        }
     }
-    return num;
 }
 
 void NetLogger::connCloseFunc(void* ctx)
@@ -43,8 +314,15 @@ void NetLogger::connCloseFunc(void* ctx)
     for (auto it = conns.begin(); it != conns.end(); it++) {
         if (*it == conn) {
             conns.erase(it);
+            if (conn->flags & LogConn::kFlagBinary) {
+                self->mNumBinConns--;
+            }
             httpd_sess_set_ctx(conn->self->mHttpServer, conn->sockfd, nullptr, nullptr);
-            delete conn;
+            if (conn->sending) {
+                conn->closed = true; // the sender task will delete it
+            } else {
+                delete conn;
+            }
             return;
         }
     }
@@ -57,6 +335,14 @@ esp_err_t NetLogger::logRequestHandler(httpd_req_t* req)
         return ESP_OK;
     }
     Self* self = static_cast<Self*>(req->user_ctx);
+    uint8_t flags = 0;
+    {
+        UrlParams params(req);
+        auto format = params.strVal("format");
+        if (format.str && strcmp(format.str, "bin") == 0) {
+            flags |= LogConn::kFlagBinary;
+        }
+    }
     bool isBrowser = false;
     char buf[64];
     auto err = httpd_req_get_hdr_value_str(req, "User-Agent", buf, sizeof(buf));
@@ -67,7 +353,11 @@ esp_err_t NetLogger::logRequestHandler(httpd_req_t* req)
     }
 
     // force sending headers by sending a dummy chunk
-    if (isBrowser) {
+    if (flags & LogConn::kFlagBinary) {
+        httpd_resp_set_type(req, "application/octet-stream");
+        binlog::FrameHeader hdr = { binlog::kFrameText, 0, 0 };
+        err = httpd_resp_send_chunk(req, (const char*)&hdr, sizeof(hdr));
+    } else if (isBrowser) {
         err = httpd_resp_send_chunk(req, "<html><body><pre>", 17);
     } else {
         err = httpd_resp_send_chunk(req, "\r\n", 2);
@@ -76,12 +366,15 @@ esp_err_t NetLogger::logRequestHandler(httpd_req_t* req)
         return ESP_FAIL;
     }
     int sockfd = httpd_req_to_sockfd(req);
-    auto conn = new LogConn(sockfd, self);
+    auto conn = new LogConn(sockfd, flags, self);
     // detect when socket is closed
     httpd_sess_set_ctx(req->handle, sockfd, conn, &Self::connCloseFunc);
 
     MutexLocker lock(self->mListMutex);
     self->mConnections.push_back(conn);
+    if (flags & LogConn::kFlagBinary) {
+        self->mNumBinConns++;
+    }
     return ESP_OK;
 }
 
@@ -100,14 +393,14 @@ void NetLogger::logSink(const char* data, int len, void* userp)
 {
     auto& self = *static_cast<Self*>(userp);
     MutexLocker lock(self.mListMutex);
-    for (auto it = self.mConnections.begin(); it != self.mConnections.end(); it++) {
-        int sockfd = (*it)->sockfd;
-        if (!self.httpSendChunk(sockfd, data, len)) {
-            // this schedules an async call to connCloseFunc()
-            // on the httpd thread, so it won't happen now.
-            // Also, the mListenMutex is non-recursive, so it
-            // would deadlock if it was executed synchronously
-            httpd_sess_trigger_close(self.mHttpServer, sockfd);
+    for (auto conn: self.mConnections) {
+        if (conn->flags & LogConn::kFlagBinary) {
+            binlog::FrameHeader hdr = { binlog::kFrameText, 0, (uint16_t)len };
+            self.mFrameBuf.clear();
+            self.mFrameBuf.appendVal(hdr).append(data, len);
+            self.queueForSend(*conn, self.mFrameBuf.buf(), self.mFrameBuf.dataSize());
+        } else {
+            self.queueForSend(*conn, data, len);
         }
     }
 }
@@ -148,6 +441,12 @@ void NetLogger::registerWithHttpServer(httpd_handle_t server, const char* path)
         .user_ctx  = this
     };
     httpd_register_uri_handler(server, &cfg);
+    mHttpServer = server;
+    if (!mSenderTask.handle()) {
+        // Low priority, as a lagging sender only makes clients lose old lines
+        mSenderTask.createTask("netlog", false, kSenderTaskStackSize, tskNO_AFFINITY, 1,
+            this, &NetLogger::senderTaskFunc);
+    }
     setSinkFunc(logSink, this);
 }
 void NetLogger::unregisterWithHttpServer(const char* path)
@@ -3,12 +3,30 @@
 
 #include <esp_http_server.h>
 #include <vector>
+#include <atomic>
 #include "utils.hpp"
+#include "task.hpp"
+#include "streamRingQueue.hpp"
+#include "buffer.hpp"
+#include "eventGroup.hpp"
+#include "logSendQueue.hpp"
 
+/** Redirects the ESP-IDF log output, to send it to http clients in addition to stdout.
+ * In binary mode (see enableBinaryMode()), the logging task only captures the format
+ * string pointer, the timestamp, the task and the raw arguments of a message into a
+ * ring, and the message is formatted later by a low-priority task. Log connections
+ * requested with \c format=bin receive the captured records instead of text, to be
+ * formatted on the client by the binLogDecode tool.
+ * Messages are not sent to the clients on the logging task. They are queued per
+ * connection, and a sender task sends all that is queued for a connection in one
+ * chunked-encoding write. A client that can't keep up loses the oldest messages in its
+ * queue, and gets a "lines dropped" message instead.
+ */
 class NetLogger
 {
 protected:
-    enum: uint16_t { kInitialBufSize = 128 };
+    enum: uint16_t { kInitialBufSize = 128, kMaxBinArgsSize = 256, kFormatTaskStackSize = 3072,
+                     kConnQueueSize = 8192, kMaxSendChunkSize = 4096, kSenderTaskStackSize = 3072 };
     typedef NetLogger Self;
     typedef void(*SinkFunc)(const char* data, int len, void* userp);
 
@@ -21,17 +39,69 @@ protected:
     // log server stuff
     struct LogConn
     {
-        enum: uint8_t { kFlagHtml = 1 };
+        enum: uint8_t { kFlagHtml = 1, kFlagBinary = 2 };
         int sockfd;
+        uint8_t flags;
+        // format strings and task names already sent to a binary connection, sorted
+        std::vector<uint32_t> sentIds;
+        LogSendQueue queue;
+        // The sender task is sending without holding the list mutex, so the connection
+        // can't be deleted when closed, but is deleted by the sender when done
+        bool sending = false;
+        bool closed = false;
         // need this only to access self from session ctx free func, which takes
         // just a single pointer
         Self* self = nullptr;
-        LogConn(int aSockFd, Self* aSelf): sockfd(aSockFd), self(aSelf) {}
+        LogConn(int aSockFd, uint8_t aFlags, Self* aSelf)
+        : sockfd(aSockFd), flags(aFlags), queue(kConnQueueSize), self(aSelf) {}
+        /** @returns true if the id was not sent before */
+        bool markSent(uint32_t id);
+        void forgetSent(uint32_t id);
     };
+    // Binary mode. The queue has a single producer, so logging tasks serialize on
+    // mBinMutex, which is held only while capturing the arguments
+    struct BinRecord
+    {
+        const char* fmt;
+        TaskHandle_t task;
+        char taskName[configMAX_TASK_NAME_LEN];
+    };
+    // Queue item types. Text items are messages that were formatted on the logging task
+    enum: uint8_t { kItemRecord = StreamItem::kUserType, kItemText };
+    StreamRingQueue* mBinQueue = nullptr;
+    Mutex mBinMutex;
+    Task mFormatTask;
+    std::atomic<uint32_t> mBinDropped = {0};
+    uint32_t mBinDroppedReported = 0; // accessed only by the formatting task
+    int mNumBinConns = 0;
+    DynBuffer mFrameBuf;
+    // Names of the tasks that logged binary records, sorted by task id
+    struct TaskName
+    {
+        uint32_t id;
+        char name[configMAX_TASK_NAME_LEN];
+    };
+    std::vector<TaskName> mTaskNames;
+    void updateTaskName(uint32_t id, const char* name);
+    void appendBinDefinitions(LogConn& conn, const char* data, int len, DynBuffer& out);
+    int binVprintf(const char* format, va_list args);
+    bool queueText(const char* text, int len);
+    void formatTaskFunc();
+    void sendBinRecord(const BinRecord& rec, uint32_t timestamp, const char* args, int argsLen);
+    void outputText(const char* data, int len);
 
     std::vector<LogConn*> mConnections;
+    // protects mConnections, and the queues and mFrameBuf
     Mutex mListMutex;
     httpd_handle_t mHttpServer = nullptr;
+    Task mSenderTask;
+    EventGroup mSenderEvents;
+    enum: EventBits_t { kEvtHaveData = 1 };
+    DynBuffer mSendBuf; // used only by the sender task
+    DynBuffer mPopBuf; // used only by the sender task
+    void queueForSend(LogConn& conn, const char* data, int len);
+    void appendDropMarker(LogConn& conn, DynBuffer& buf, uint32_t numDropped);
+    void senderTaskFunc();
     static void connCloseFunc(void* ctx);
     // called by the http connection task
     static esp_err_t logRequestHandler(httpd_req_t* req);
@@ -41,6 +111,17 @@ public:
     NetLogger(bool disableDefault);
     bool hasRemoteSink() const { return !mConnections.empty(); }
     void setSinkFunc(SinkFunc sinkFunc, void* userp);
+    /** Switches to deferred formatting of log messages whose format string is in flash,
+     * which are all the ESP_LOGx() ones. Other messages, and the ones that can't be
+     * captured, are still formatted synchronously, but are queued as text behind the
+     * deferred ones, so the order of the messages is preserved. Only a message that
+     * would take more than a quarter of the queue is output directly. If the queue is
+     * full, messages are dropped and counted.
+     * @param queueSize Size of the queue of captured messages
+     * @param prio Priority of the formatting task
+     */
+    bool enableBinaryMode(int queueSize=8192, UBaseType_t prio=1, BaseType_t cpuCore=tskNO_AFFINITY);
+    uint32_t droppedMessages() const { return mBinDropped.load(std::memory_order_relaxed); }
     static int vprintf(const char * format, va_list args);
     static int printf(const char* fmt, ...);
     void registerWithHttpServer(httpd_handle_t server, const char* path);
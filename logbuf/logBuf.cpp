@@ -1,69 +1,183 @@
 #include "logBuf.hpp"
 #include "logBufLog.hpp"
+#include <algorithm>
 
-void LogBuffer::addLine(const char* data, Line::Size size, uint8_t type)
+LogBuffer::LogBuffer(size_t maxDataSize, size_t maxLines, size_t ingestSize)
+:mMaxDataSize(maxDataSize), mMaxLineCount(maxLines)
 {
-    size_t newSize;
-    while ((newSize = mDataSize + size) > mMaxDataSize) {
-        LOGBUF_LOG_DEBUG("addLine: Total size %zu is more than %zu, deleting first line", newSize, mMaxDataSize);
-        deleteFirstLine();
+    assert(maxLines);
+    if (mMaxDataSize > kMaxLineSize) {
+        mMaxDataSize = kMaxLineSize;
+    }
+    // Room for the headers and alignment of all lines, plus the space that may be skipped
+    // at the end of the arena when wrapping, which is less than a maximum-size record
+    mArenaSize = recordSize(mMaxDataSize) + mMaxDataSize + mMaxLineCount * (kHeaderSize + kAlign - 1);
+    mArenaSize &= ~(size_t)(kAlign - 1);
+    mArena = (char*)malloc(mArenaSize);
+    assert(mArena);
+    if (ingestSize) {
+        // power of 2, so that the free-running positions can wrap around 2^32
+        mIngestSize = 64;
+        while (mIngestSize < ingestSize) {
+            mIngestSize <<= 1;
+        }
+        mIngest = (char*)malloc(mIngestSize);
+        assert(mIngest);
+        // no sequence number can be all ones, as positions are aligned
+        memset(mIngest, 0xff, mIngestSize);
+        mMaxIngestLine = std::min<size_t>(mIngestSize / 2 - sizeof(IngestHeader), mMaxDataSize);
+    }
+}
+
+bool LogBuffer::append(const char* data, Line::Size size, uint8_t type)
+{
+    if (!mIngest) {
+        MutexLocker locker(mutex);
+        addLine(data, size, type);
+        return true;
     }
-    if (mStart == 0 && mEnd == 0 && mLines.size() < mMaxLineCount) { // starting at zero and ending at vector end
-        LOGBUF_LOG_DEBUG("addLine: fits vector: pushing new vector element");
-        // data starts at start of mLines vector and ends at its end - we can
-        // easily expand the vector.
-        mLines.emplace_back(data, size, type);
-        mDataSize = newSize;
+    if (!data) {
+        size = 0;
+    } else if (size > mMaxIngestLine) {
+        size = mMaxIngestLine;
+    }
+    uint32_t recSize = ingestRecordSize(size);
+    uint32_t pos = mIngestHead.load(std::memory_order_relaxed);
+    uint32_t padSize;
+    for (;;) {
+        // a line doesn't wrap - if it doesn't fit before the end of the ring, the rest
+        // of the ring is reserved as padding, and the line is written at the start
+        uint32_t spaceToEnd = mIngestSize - (pos & (mIngestSize - 1));
+        padSize = (spaceToEnd < recSize) ? spaceToEnd : 0;
+        if (pos + padSize + recSize - mIngestTail.load(std::memory_order_acquire) > mIngestSize) {
+            // pos may be a stale snapshot of the head, which the drain has already passed,
+            // so that the subtraction underflowed. The head is loaded after the tail, so it
+            // is never behind it
+            uint32_t head = mIngestHead.load(std::memory_order_relaxed);
+            if (head != pos) {
+                pos = head;
+                continue;
+            }
+            mDroppedLines.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (mIngestHead.compare_exchange_weak(pos, pos + padSize + recSize, std::memory_order_relaxed)) {
+            break;
+        }
+    }
+    if (padSize) {
+        auto& pad = ingestHeaderAt(pos);
+        pad.sizeType = kWrapMarker;
+        pad.seq.store(pos, std::memory_order_release);
+        pos += padSize;
+    }
+    auto& hdr = ingestHeaderAt(pos);
+    memcpy((char*)(&hdr + 1), data, size);
+    hdr.sizeType = size | ((uint32_t)type << 24);
+    hdr.seq.store(pos, std::memory_order_release);
+    return true;
+}
+
+void LogBuffer::drain()
+{
+    if (!mIngest) {
         return;
     }
-    if (mStart < 0) { // empty, bootstrap mStart
-        mStart = 0;
-        if (mLines.empty()) {
-            LOGBUF_LOG_DEBUG("addLine: vector is empty: pushing new element");
-            mLines.emplace_back(data, size, type);
+    uint32_t pos = mIngestTail.load(std::memory_order_relaxed);
+    uint32_t head = mIngestHead.load(std::memory_order_acquire);
+    uint32_t start = pos;
+    while (pos != head) {
+        auto& hdr = ingestHeaderAt(pos);
+        if (hdr.seq.load(std::memory_order_acquire) != pos) {
+            break; // still being written
+        }
+        uint32_t recSize;
+        if (hdr.sizeType == kWrapMarker) {
+            recSize = mIngestSize - (pos & (mIngestSize - 1));
         } else {
-            LOGBUF_LOG_DEBUG("addLine: log is empty, but vector not: using first element");
-            mLines[0].assign(data, size, type);
+            uint32_t size = hdr.sizeType & kSizeMask;
+            addLineLocked((const char*)(&hdr + 1), size, hdr.sizeType >> 24);
+            recSize = ingestRecordSize(size);
         }
-        mDataSize = newSize;
-        return;
+        // Reset the consumed space, so that a header that is reserved but not yet written
+        // there can't be mistaken for a complete one
+        memset((char*)&hdr, 0xff, recSize);
+        pos += recSize;
     }
-    if (mEnd == mStart) { // full, and can't grow the vector, must free an element
-        LOGBUF_LOG_DEBUG("addLine: Full, deleting first line");
-        assert(mStart > -1 && !mLines.empty());
-        deleteFirstLine();
-        assert(mEnd != mStart);
+    if (pos != start) {
+        mIngestTail.store(pos, std::memory_order_release);
     }
-    // mLines is not empty and mStart is not at start of vector
-    if (mEnd > mStart) { // no wrapping
-        assert(mEnd < mLines.size()); // if mEnd was at the end of the vector, it must have wrapped to zero
-        mLines[mEnd++].assign(data, size, type);
-        if (mEnd >= mLines.size()) {
-            mEnd = 0; // wrap
+}
+
+size_t LogBuffer::allocRecord(size_t recSize)
+{
+    assert(recSize <= mArenaSize);
+    for (;;) {
+        if (!mLineCount) {
+            mHead = mTail = 0;
+            return 0;
+        }
+        if (mHead < mTail) { // not wrapped
+            if (mArenaSize - mTail >= recSize) {
+                return mTail;
+            }
+            if (mHead >= recSize) {
+                LOGBUF_LOG_DEBUG("allocRecord: wrapping at %zu", mTail);
+                if (mArenaSize - mTail >= kHeaderSize) {
+                    uint32_t marker = kWrapMarker;
+                    memcpy(mArena + mTail, &marker, kHeaderSize);
+                }
+                return 0;
+            }
+        } else if (mHead - mTail >= recSize) { // wrapped
+            return mTail;
         }
-    } else { // mEnd < mStart: buffer is wrapped
-        LOGBUF_LOG_DEBUG("addLine: wrapped, mEnd < mStart, using next element");
-        assert(mEnd < mStart);
-        mLines[mEnd++].assign(data, size, type);
+        LOGBUF_LOG_DEBUG("allocRecord: No room for %zu bytes, deleting first line", recSize);
+        deleteFirstLine();
+    }
+}
+
+void LogBuffer::addLine(const char* data, Line::Size size, uint8_t type)
+{
+    drain(); // keep the order with lines that were appended before
+    addLineLocked(data, size, type);
+}
+
+void LogBuffer::addLineLocked(const char* data, Line::Size size, uint8_t type)
+{
+    if (!data) {
+        size = 0;
+    } else if (size > mMaxDataSize) {
+        size = mMaxDataSize;
     }
+    while (mDataSize + size > mMaxDataSize || mLineCount >= mMaxLineCount) {
+        LOGBUF_LOG_DEBUG("addLine: Total size %zu or line count %zu over limit, deleting first line",
+            mDataSize + size, mLineCount);
+        deleteFirstLine();
+    }
+    size_t recSize = recordSize(size);
+    size_t ofs = allocRecord(recSize);
+    uint32_t hdr = size | ((uint32_t)type << 24);
+    memcpy(mArena + ofs, &hdr, kHeaderSize);
+    if (size) {
+        memcpy(mArena + ofs + kHeaderSize, data, size);
+    }
+    mTail = ofs + recSize;
+    mLineCount++;
     mDataSize += size;
 }
 
 bool LogBuffer::deleteFirstLine()
 {
-    if (mStart < 0) {
+    if (!mLineCount) {
         return false;
     }
-    assert(!mLines.empty());
-    auto& delLine = mLines[mStart++];
-    mDataSize -= delLine.size;
-    delLine.clear();
-    if (mStart >= mLines.size()) {
-        mStart = 0;
-    }
-    if (mStart == mEnd) { // empty
-        mStart = -1;
-        mEnd = 0;
+    uint32_t size = headerAt(mHead) & kSizeMask;
+    mDataSize -= size;
+    if (--mLineCount == 0) {
+        mHead = mTail = 0;
+        return true;
     }
+    mHead = skipWrap(mHead + recordSize(size));
     return true;
 }
@@ -2,98 +2,136 @@
 #define _LOGBUF_H_INCLUDED
 
 #include <stddef.h>
-#include <vector>
+#include <stdint.h>
 #include <malloc.h>
 #include <string.h>
 #include <assert.h>
+#include <atomic>
 #include "mutex.hpp"
 
+/** Keeps the most recent log lines in a single circular byte arena that is allocated
+ * once at construction. Each line is stored contiguously, after a 4-byte header with
+ * its size and type, so adding a line is just a copy at the tail and evicting the oldest
+ * one is an advance of the head - there is no per-line heap allocation.
+ * When a line doesn't fit between the tail and the end of the arena, the rest of the
+ * arena is skipped (marked with a wrap marker if there is room for a header) and the line
+ * is written at the start.
+ * Lines can be added either with addLine(), with \c mutex locked, or without any locking
+ * with append(), if the buffer was created with an ingestion ring. append() is lock-free:
+ * producers reserve space in the ring with an atomic compare-and-swap, copy the line in
+ * parallel, and publish it by storing its position as a sequence number in its header.
+ * Whoever holds the mutex moves the published lines into the arena, in order, before
+ * adding or iterating lines. A line that is still being written, and the ones after it,
+ * are left for the next time. If the ring is full, append() drops the line rather than
+ * wait.
+ */
 class LogBuffer {
 public:
+    /** A view of a line in the arena, valid until the line is evicted */
     struct Line {
         typedef uint32_t Size;
-        char* data;
+        const char* data;
         Size size;
-        uint8_t type = 0;
-        Line(const char* aData, Size aSize, uint8_t aType)
-        {
-            assign(aData, aSize, aType);
-        }
-        void assign(const char* aData, Size aSize, uint8_t aType)
-        {
-            if (aData) {
-                assert(aSize);
-                this->data = (char*)malloc(aSize);
-                assert(this->data);
-                memcpy(this->data, aData, aSize);
-            }
-            else {
-                this->data = nullptr;
-            }
-            size = aSize;
-            type = aType;
-        }
-        void clear() {
-            if (!data) {
-                return;
-            }
-            free(data);
-            data = nullptr;
-            size = 0;
-        }
-        // No destructor to free the buffer because the vector may copy&delete items when expanding,
-        // which will result in 2 items pointing to the same buffer temporarily. When the old one is destroyed
-        // it will free the buffer, making the copy point to an invalid buffer
+        uint8_t type;
     };
 protected:
-    std::vector<Line> mLines;
+    enum: uint32_t {
+        kHeaderSize = sizeof(uint32_t), kAlign = 4,
+        kSizeMask = 0xffffff, kWrapMarker = kSizeMask, // lower 24 bits are size, upper 8 bits are type
+        kMaxLineSize = kSizeMask - 1
+    };
+    char* mArena;
+    size_t mArenaSize;
     size_t mMaxDataSize;
     size_t mMaxLineCount;
     size_t mDataSize = 0;
-    /** Index of first line, -1 if empty */
-    int mStart = -1;
-    /** One past the index of the last line, 0 if empty */
-    int mEnd = 0;
-    /* mStart == mEnd -> wrapped, list is full
-     * mStart < mEnd -> not wrapped, may be empty if mStart < 0
-     * mStart > mEnd -> wrapped, not full
+    size_t mLineCount = 0;
+    /** Offset of the first line */
+    size_t mHead = 0;
+    /** Offset past the end of the last line
+     * mHead < mTail -> not wrapped, free space is after mTail and before mHead
+     * mHead >= mTail and not empty -> wrapped, free space is between mTail and mHead
      */
+    size_t mTail = 0;
+    static size_t recordSize(size_t dataSize) { return (kHeaderSize + dataSize + kAlign - 1) & ~(size_t)(kAlign - 1); }
+    uint32_t headerAt(size_t ofs) const
+    {
+        uint32_t hdr;
+        memcpy(&hdr, mArena + ofs, kHeaderSize);
+        return hdr;
+    }
+    /** If there is no line at ofs because the arena wrapped there, returns zero */
+    size_t skipWrap(size_t ofs) const
+    {
+        return (mArenaSize - ofs < kHeaderSize || (headerAt(ofs) & kSizeMask) == kWrapMarker) ? 0 : ofs;
+    }
+    // Lock-free ingestion ring. Positions are free-running, masked to get the offset.
+    // Each line is an IngestHeader followed by the data, 8-byte aligned
+    struct IngestHeader
+    {
+        std::atomic<uint32_t> seq; // the line's position once it's complete
+        uint32_t sizeType; // as the arena header
+    };
+    enum: uint32_t { kIngestAlign = sizeof(IngestHeader) };
+    char* mIngest = nullptr;
+    uint32_t mIngestSize = 0;
+    uint32_t mMaxIngestLine = 0;
+    std::atomic<uint32_t> mIngestHead = {0}; // advanced by producers when reserving
+    std::atomic<uint32_t> mIngestTail = {0}; // advanced by drain(), under the mutex
+    std::atomic<uint32_t> mDroppedLines = {0};
+    static uint32_t ingestRecordSize(uint32_t dataSize)
+    {
+        return (sizeof(IngestHeader) + dataSize + kIngestAlign - 1) & ~(kIngestAlign - 1);
+    }
+    IngestHeader& ingestHeaderAt(uint32_t pos) { return *(IngestHeader*)(mIngest + (pos & (mIngestSize - 1))); }
+    void addLineLocked(const char* data, Line::Size size, uint8_t type);
     bool deleteFirstLine();
+    /** Evicts lines until there is room for a record of the given size, and returns its offset */
+    size_t allocRecord(size_t recSize);
 public:
     Mutex mutex;
-    const std::vector<Line>& lines() const { return mLines; }
-    LogBuffer(size_t maxDataSize, size_t maxLines, size_t numReserveLines)
-    :mMaxDataSize(maxDataSize), mMaxLineCount(maxLines)
-    {
-        mLines.reserve(numReserveLines);
-    }
+    /** @param maxDataSize Maximum total size of the lines' data
+     *  @param maxLines Maximum number of lines
+     *  The arena is sized so that normally these limits are reached before it gets full
+     */
+    LogBuffer(size_t maxDataSize, size_t maxLines, size_t ingestSize=0);
+    ~LogBuffer() { free(mArena); free(mIngest); }
+    LogBuffer(const LogBuffer&) = delete;
+    /** Lines longer than the maximum data size are truncated. Must be called with
+     * \c mutex locked */
     void addLine(const char* data, Line::Size size, uint8_t type);
+    /** Adds a line without locking the mutex and without blocking. Can be called
+     * concurrently from any number of tasks. If there is no ingestion ring, it falls
+     * back to addLine() with the mutex locked.
+     * Lines longer than half the ingestion ring are truncated.
+     * @returns false if the ingestion ring was full and the line was dropped
+     */
+    bool append(const char* data, Line::Size size, uint8_t type);
+    /** Moves the lines added with append() into the arena. Done by addLine() and iterate(),
+     * must be called with \c mutex locked */
+    void drain();
+    /** The number of lines that append() dropped because the ingestion ring was full */
+    uint32_t droppedLines() const { return mDroppedLines.load(std::memory_order_relaxed); }
+    size_t lineCount() const { return mLineCount; }
+    size_t dataSize() const { return mDataSize; }
+    size_t arenaSize() const { return mArenaSize; }
+    /** Calls \c cb for each line, oldest first. Must be called with \c mutex locked */
     template<class Cb>
-    void iterate(Cb&& cb) const
+    void iterate(Cb&& cb)
     {
-        if (mStart < 0) {
-            return;
-        }
-        if (mStart < mEnd) {
-            for (int i = mStart; i<mEnd; i++) {
-                cb(mLines[i]);
-            }
-        } else {
-            for (int i = mStart; i < mLines.size(); i++) {
-                cb(mLines[i]);
-            }
-            for (int i = 0; i < mEnd; i++) {
-                cb(mLines[i]);
-            }
+        drain();
+        size_t ofs = mHead;
+        for (size_t n = mLineCount; n; n--) {
+            ofs = skipWrap(ofs);
+            uint32_t hdr = headerAt(ofs);
+            Line line = { mArena + ofs + kHeaderSize, hdr & kSizeMask, (uint8_t)(hdr >> 24) };
+            cb(line);
+            ofs += recordSize(line.size);
         }
     }
     void clear() {
-        for (auto& line: mLines) {
-            line.clear();
-        }
-        mLines.clear();
-        mStart = -1;
-        mEnd = 0;
+        mHead = mTail = 0;
+        mLineCount = mDataSize = 0;
     }
 };
 #endif
@@ -1,21 +1,306 @@
+// Host test and throughput benchmark of LogBuffer, against the previous implementation
+// that allocated each line separately on the heap, and of concurrent lock-free appends.
+// Build: g++ -O2 -std=gnu++17 -I../mySystem -I../hostStubs logBufTest.cpp logBuf.cpp -o logBufTest -lpthread
 #include "logBuf.hpp"
 #include <string>
 #include <string.h>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <stdio.h>
 
-std::string genLine() {
+static long gAllocCount = 0;
+static long gLiveBlocks = 0;
+static long gPeakBlocks = 0;
+
+#ifdef __GLIBC__
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void __libc_free(void* ptr);
+extern "C" void* malloc(size_t size)
+{
+    gAllocCount++;
+    if (++gLiveBlocks > gPeakBlocks) {
+        gPeakBlocks = gLiveBlocks;
+    }
+    return __libc_malloc(size);
+}
+extern "C" void free(void* ptr)
+{
+    if (ptr) {
+        gLiveBlocks--;
+    }
+    __libc_free(ptr);
+}
+#endif
+
+// The previous implementation, with a vector of separately allocated lines
+class LegacyLogBuffer {
+public:
+    struct Line {
+        char* data;
+        uint32_t size;
+        uint8_t type = 0;
+        Line(const char* aData, uint32_t aSize, uint8_t aType) { assign(aData, aSize, aType); }
+        void assign(const char* aData, uint32_t aSize, uint8_t aType)
+        {
+            data = (char*)malloc(aSize);
+            memcpy(data, aData, aSize);
+            size = aSize;
+            type = aType;
+        }
+        void clear() { free(data); data = nullptr; size = 0; }
+    };
+    std::vector<Line> mLines;
+    size_t mMaxDataSize;
+    size_t mMaxLineCount;
+    size_t mDataSize = 0;
+    int mStart = -1;
+    int mEnd = 0;
+    LegacyLogBuffer(size_t maxDataSize, size_t maxLines): mMaxDataSize(maxDataSize), mMaxLineCount(maxLines) {}
+    ~LegacyLogBuffer()
+    {
+        for (auto& line: mLines) {
+            line.clear();
+        }
+    }
+    bool deleteFirstLine()
+    {
+        if (mStart < 0) {
+            return false;
+        }
+        auto& delLine = mLines[mStart++];
+        mDataSize -= delLine.size;
+        delLine.clear();
+        if (mStart >= (int)mLines.size()) {
+            mStart = 0;
+        }
+        if (mStart == mEnd) {
+            mStart = -1;
+            mEnd = 0;
+        }
+        return true;
+    }
+    void addLine(const char* data, uint32_t size, uint8_t type)
+    {
+        size_t newSize;
+        while ((newSize = mDataSize + size) > mMaxDataSize) {
+            deleteFirstLine();
+        }
+        if (mStart == 0 && mEnd == 0 && mLines.size() < mMaxLineCount) {
+            mLines.emplace_back(data, size, type);
+            mDataSize = newSize;
+            return;
+        }
+        if (mStart < 0) {
+            mStart = 0;
+            if (mLines.empty()) {
+                mLines.emplace_back(data, size, type);
+            } else {
+                mLines[0].assign(data, size, type);
+            }
+            mDataSize = newSize;
+            return;
+        }
+        if (mEnd == mStart) {
+            deleteFirstLine();
+        }
+        if (mEnd > mStart) {
+            mLines[mEnd++].assign(data, size, type);
+            if (mEnd >= (int)mLines.size()) {
+                mEnd = 0;
+            }
+        } else {
+            mLines[mEnd++].assign(data, size, type);
+        }
+        mDataSize += size;
+    }
+};
+
+static uint32_t gRandState = 12345;
+uint32_t rnd()
+{
+    gRandState = gRandState * 1103515245 + 12345;
+    return gRandState >> 8;
+}
+
+std::string genLine(uint32_t maxLen)
+{
     static uint32_t ctr = 0;
-    return std::to_string(ctr++) + ": log line";
+    std::string line = "I (" + std::to_string(ctr++) + ") task: log line";
+    line.resize(1 + rnd() % maxLen, 'x');
+    return line;
 }
 
-int main()
+// Checks the buffer against a model that applies the same data size and line count limits
+void testAgainstModel(size_t maxDataSize, size_t maxLines, uint32_t maxLineLen)
 {
-    LogBuffer buf(10000, 50, 1);
-    for (auto i = 0; i<100; i++) {
-        auto str = genLine();
-        buf.addLine(strdup(str.c_str()), str.size());
-        printf("start: %d, end: %d\n", buf.mStart, buf.mEnd);
-        for (auto& line: buf.mLines) {
-            printf("%s\n", line.data ? line.data : "null");
+    LogBuffer buf(maxDataSize, maxLines);
+    std::deque<std::pair<std::string, uint8_t>> model;
+    size_t modelSize = 0;
+    for (int i = 0; i < 100000; i++) {
+        auto str = genLine(maxLineLen);
+        if (str.size() > maxDataSize) {
+            str.resize(maxDataSize);
+        }
+        uint8_t type = rnd();
+        buf.addLine(str.c_str(), str.size(), type);
+        while (!model.empty() && (modelSize + str.size() > maxDataSize || model.size() >= maxLines)) {
+            modelSize -= model.front().first.size();
+            model.pop_front();
         }
+        model.emplace_back(str, type);
+        modelSize += str.size();
+
+        assert(buf.lineCount() == model.size());
+        assert(buf.dataSize() == modelSize);
+        if (i % 7 == 0) {
+            size_t idx = 0;
+            buf.iterate([&](const LogBuffer::Line& line) {
+                auto& expected = model[idx++];
+                assert(line.size == expected.first.size());
+                assert(memcmp(line.data, expected.first.data(), line.size) == 0);
+                assert(line.type == expected.second);
+            });
+            assert(idx == model.size());
+        }
+        if (rnd() % 20000 == 0) {
+            buf.clear();
+            model.clear();
+            modelSize = 0;
+        }
+    }
+}
+
+template <class B>
+void bench(const char* name, const std::vector<std::string>& lines)
+{
+    enum { kRounds = 20 };
+    long allocsBefore = gAllocCount;
+    gPeakBlocks = gLiveBlocks;
+    long blocksBefore = gLiveBlocks;
+    auto start = std::chrono::steady_clock::now();
+    {
+        B buf(32768, 500);
+        for (int round = 0; round < kRounds; round++) {
+            for (auto& line: lines) {
+                buf.addLine(line.c_str(), line.size(), 0);
+            }
+        }
+    }
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    long numLines = (long)lines.size() * kRounds;
+    printf("%-8s: %6.2f M lines/s, %8ld mallocs, peak %4ld heap blocks\n", name,
+        numLines / elapsed / 1e6, gAllocCount - allocsBefore, gPeakBlocks - blocksBefore);
+}
+
+// Producer threads append numbered lines lock-free, while a reader drains and iterates.
+// Each producer's lines must appear intact and in order, with possible gaps for dropped lines
+void testConcurrentAppend(int numThreads, size_t ingestSize)
+{
+    enum { kLinesPerThread = 50000 };
+    LogBuffer buf(8192, 200, ingestSize);
+    std::atomic<int> running(numThreads);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < numThreads; t++) {
+        threads.emplace_back([&buf, &running, t]() {
+            char line[64];
+            for (int i = 0; i < kLinesPerThread; i++) {
+                int len = snprintf(line, sizeof(line), "%d:%d:", t, i);
+                len += (i * 7) % 30; // variable length padding, derived from the number
+                memset(line + strlen(line), 'a' + t, len - strlen(line));
+                buf.append(line, len, t);
+                if (i % 16 == 0) {
+                    std::this_thread::yield(); // give the reader a chance on a single core
+                }
+            }
+            running--;
+        });
+    }
+    std::vector<int> lastSeen(numThreads, -1);
+    long numSeen = 0;
+    auto check = [&]() {
+        MutexLocker locker(buf.mutex);
+        std::vector<int> lastInBuf(numThreads, -1);
+        buf.iterate([&](const LogBuffer::Line& line) {
+            int t, i, prefixLen;
+            std::string str(line.data, line.size);
+            assert(sscanf(str.c_str(), "%d:%d:%n", &t, &i, &prefixLen) == 2);
+            assert(t == line.type && t < numThreads);
+            assert((int)line.size == prefixLen + (i * 7) % 30);
+            for (size_t j = prefixLen; j < line.size; j++) {
+                assert(line.data[j] == 'a' + t);
+            }
+            assert(i > lastInBuf[t]); // in order
+            lastInBuf[t] = i;
+            if (i > lastSeen[t]) {
+                lastSeen[t] = i;
+                numSeen++;
+            }
+        });
+    };
+    while (running) {
+        check();
+    }
+    for (auto& thread: threads) {
+        thread.join();
     }
+    check();
+    for (int t = 0; t < numThreads; t++) {
+        assert(lastSeen[t] == kLinesPerThread - 1 || buf.droppedLines());
+    }
+    printf("%d producers, ingest ring %zu: %ld lines seen, %u dropped\n", numThreads, ingestSize,
+        numSeen, buf.droppedLines());
+}
+
+// Cost of adding a line on the logging task: mutex + addLine() vs append(). Lines are added
+// in bursts that fit the ingestion ring, and drained in between, outside of the timing
+void benchAppend(const std::vector<std::string>& lines)
+{
+    enum { kBurst = 64, kNumBursts = 30000 };
+    for (bool lockFree: {false, true}) {
+        LogBuffer buf(32768, 500, lockFree ? 16384 : 0);
+        std::chrono::steady_clock::duration elapsed(0);
+        size_t idx = 0;
+        for (int burst = 0; burst < kNumBursts; burst++) {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < kBurst; i++) {
+                auto& line = lines[idx++ % lines.size()];
+                if (lockFree) {
+                    buf.append(line.c_str(), line.size(), 0);
+                } else {
+                    MutexLocker locker(buf.mutex);
+                    buf.addLine(line.c_str(), line.size(), 0);
+                }
+            }
+            elapsed += std::chrono::steady_clock::now() - start;
+            MutexLocker locker(buf.mutex);
+            buf.drain();
+        }
+        double ns = std::chrono::duration<double, std::nano>(elapsed).count() / ((double)kBurst * kNumBursts);
+        printf("%-9s: %5.1f ns per line on the logging task, %u dropped\n",
+            lockFree ? "lock-free" : "mutex", ns, buf.droppedLines());
+    }
+}
+
+int main()
+{
+    testAgainstModel(10000, 50, 300);
+    testAgainstModel(4096, 1000, 200);
+    testAgainstModel(1000, 1000, 2000); // lines longer than the whole buffer
+    testAgainstModel(100, 3, 40);
+
+    std::vector<std::string> lines;
+    for (int i = 0; i < 100000; i++) {
+        lines.push_back(genLine(120));
+    }
+    bench<LegacyLogBuffer>("legacy", lines);
+    bench<LogBuffer>("arena", lines);
+
+    testConcurrentAppend(4, 4096);
+    testConcurrentAppend(3, 256); // mostly full, drops lines
+    testConcurrentAppend(1, 65536);
+    benchAppend(lines);
+    return 0;
 }
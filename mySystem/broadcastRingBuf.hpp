@@ -0,0 +1,367 @@
+#ifndef BROADCAST_RINGBUF_HPP
+#define BROADCAST_RINGBUF_HPP
+
+#include <string.h>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "utils.hpp"
+#include "waitable.hpp"
+
+#ifndef rbassert
+#define rbassert myassert
+#endif
+
+/** Ring buffer with one writer and multiple readers, each of which sees the whole
+ * stream via its own read cursor. This allows fanning out a stream to several
+ * consumers without copying it into a separate buffer for each of them.
+ * The free space is determined by the slowest reader. How a reader that lags too
+ * much behind is handled is determined by the lag policy:
+ * - kLagBlockWriter - the writer waits for it, as with a normal ring buffer
+ * - kLagDropReader - the reader is detached, and its subsequent reads return kErrDropped
+ * - kLagSkipReader - the reader's backlog is discarded and it continues with the newest
+ *   data. The amount of discarded data can be obtained with skippedBytes()
+ * The policy is applied only to readers whose backlog is at least the lag threshold,
+ * and only when the writer would otherwise block. A reader that is in the middle of
+ * a contigRead() is never dropped or skipped.
+ * Cursors are free-running 32-bit byte counters. The buffer size must be a power of
+ * two, so that it divides 2^32 and the buffer offset of a cursor, as well as the
+ * difference between two cursors, remain valid across counter wrap-around.
+ */
+class BroadcastRingBuf: public Waitable
+{
+public:
+    enum: int { kMaxReaders = 8 };
+    enum LagPolicy: uint8_t { kLagBlockWriter, kLagDropReader, kLagSkipReader };
+    enum: int8_t { kErrDropped = -2 };
+protected:
+    // each reader waits on its own event bit, after the ones used by Waitable
+    enum: EventBits_t { kFlagFirstReader = kFlagLast << 1 };
+    struct Reader
+    {
+        uint32_t readCnt = 0;
+        uint32_t skipped = 0;
+        bool active = false;
+        bool dropped = false;
+        bool waiting = false;
+        bool inRead = false;
+    };
+    char* mBuf;
+    int mSize;
+    uint32_t mWriteCnt = 0;
+    Mutex mMutex;
+    Reader mReaders[kMaxReaders];
+    int mLagThreshold;
+    LagPolicy mLagPolicy;
+    bool mWriterWaiting = false;
+    static EventBits_t readerFlag(int id) { return kFlagFirstReader << id; }
+    char* ptrAt(uint32_t cnt) const { return mBuf + (cnt & (mSize - 1)); }
+    int contigFrom(uint32_t cnt) const { return mSize - (cnt & (mSize - 1)); }
+    int backlog(const Reader& reader) const { return mWriteCnt - reader.readCnt; }
+    int freeSpace_locked() const
+    {
+        int maxBacklog = 0;
+        for (auto& reader: mReaders) {
+            if (reader.active) {
+                maxBacklog = std::max(maxBacklog, backlog(reader));
+            }
+        }
+        return mSize - maxBacklog;
+    }
+    void applyLagPolicy_locked(int needed)
+    {
+        if (mLagPolicy == kLagBlockWriter) {
+            return;
+        }
+        EventBits_t bitsToSet = 0;
+        for (int id = 0; id < kMaxReaders; id++) {
+            auto& reader = mReaders[id];
+            if (!reader.active || reader.inRead) {
+                continue;
+            }
+            int lag = backlog(reader);
+            if (lag < mLagThreshold || mSize - lag >= needed) {
+                continue;
+            }
+            if (mLagPolicy == kLagDropReader) {
+                ESP_LOGW("BCASTRB", "Dropping reader %d lagging by %d bytes", id, lag);
+                reader.active = false;
+                reader.dropped = true;
+                if (reader.waiting) {
+                    bitsToSet |= readerFlag(id);
+                }
+            } else {
+                reader.skipped += lag;
+                reader.readCnt = mWriteCnt;
+            }
+        }
+        if (bitsToSet) {
+            mEvents.setBits(bitsToSet);
+        }
+    }
+    /* Called and returns with the mutex locked
+     * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled
+     */
+    int8_t waitForSpace_locked(int needed, int msTimeout)
+    {
+        for (;;) {
+            if (freeSpace_locked() >= needed) {
+                return 1;
+            }
+            applyLagPolicy_locked(needed);
+            if (freeSpace_locked() >= needed) {
+                return 1;
+            }
+            if (!msTimeout) {
+                return 0;
+            }
+            mWriterWaiting = true;
+            int64_t tsStart = esp_timer_get_time();
+            int8_t ret;
+            {
+                MutexUnlocker unlocker(mMutex);
+                ret = waitAndReset(kFlagReadOp, msTimeout);
+            }
+            mWriterWaiting = false;
+            if (ret <= 0) {
+                return ret;
+            }
+            if (msTimeout > 0) {
+                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
+                if (msTimeout <= 0) {
+                    msTimeout = 0; // check once more and bail out
+                }
+            }
+        }
+    }
+    /* Called and returns with the mutex locked
+     * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled,
+     * kErrDropped if the reader was dropped or is not registered
+     */
+    int8_t waitForData_locked(int id, int needed, int msTimeout)
+    {
+        auto& reader = mReaders[id];
+        for (;;) {
+            if (!reader.active) {
+                return kErrDropped;
+            }
+            if (backlog(reader) >= needed) {
+                return 1;
+            }
+            if (!msTimeout) {
+                return 0;
+            }
+            reader.waiting = true;
+            int64_t tsStart = esp_timer_get_time();
+            int8_t ret;
+            {
+                MutexUnlocker unlocker(mMutex);
+                ret = waitAndReset(readerFlag(id), msTimeout);
+            }
+            reader.waiting = false;
+            if (ret < 0) {
+                return ret;
+            }
+            if (msTimeout > 0) {
+                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
+                if (msTimeout <= 0) {
+                    msTimeout = 0;
+                }
+            }
+        }
+    }
+    void publishWrite_locked(int size)
+    {
+        mWriteCnt += size;
+        EventBits_t bitsToSet = 0;
+        for (int id = 0; id < kMaxReaders; id++) {
+            auto& reader = mReaders[id];
+            if (reader.active && reader.waiting) {
+                bitsToSet |= readerFlag(id);
+            }
+        }
+        if (bitsToSet) {
+            mEvents.setBits(bitsToSet);
+        }
+    }
+    void commitRead_locked(Reader& reader, int size)
+    {
+        rbassert(size <= backlog(reader));
+        reader.readCnt += size;
+        if (mWriterWaiting) {
+            mEvents.setBits(kFlagReadOp);
+        }
+    }
+public:
+    /** @param bufSize Must be a power of two */
+    BroadcastRingBuf(size_t bufSize, LagPolicy lagPolicy=kLagBlockWriter, int lagThreshold=0, bool useSpiRam=false)
+    : mBuf((char*)heap_caps_malloc(bufSize, useSpiRam ? MALLOC_CAP_8BIT|MALLOC_CAP_SPIRAM : MALLOC_CAP_8BIT)),
+      mSize(mBuf ? bufSize : 0), mLagThreshold(lagThreshold), mLagPolicy(lagPolicy)
+    {
+        rbassert(bufSize && (bufSize & (bufSize - 1)) == 0);
+        if (!mBuf) {
+            ESP_LOGE("BCASTRB", "Out of memory allocation %zu bytes", bufSize);
+        }
+    }
+    ~BroadcastRingBuf()
+    {
+        if (mBuf) {
+            free(mBuf);
+        }
+    }
+    int size() const { return mSize; }
+    Mutex& mutex() { return mMutex; }
+    void setLagPolicy(LagPolicy policy, int threshold)
+    {
+        MutexLocker locker(mMutex);
+        mLagPolicy = policy;
+        mLagThreshold = threshold;
+    }
+    /** Registers a reader, which will receive data written after this call.
+     * @returns the reader id, or -1 if there are no free reader slots
+     */
+    int addReader()
+    {
+        MutexLocker locker(mMutex);
+        for (int id = 0; id < kMaxReaders; id++) {
+            auto& reader = mReaders[id];
+            if (reader.active || reader.dropped) {
+                continue;
+            }
+            reader = Reader();
+            reader.readCnt = mWriteCnt;
+            reader.active = true;
+            mEvents.clearBits(readerFlag(id));
+            return id;
+        }
+        return -1;
+    }
+    /** Unregisters a reader, also one that was dropped. Must not be called while
+     * the reader is blocked in, or in the middle of, a read operation */
+    void removeReader(int id)
+    {
+        MutexLocker locker(mMutex);
+        auto& reader = mReaders[id];
+        bool wasActive = reader.active;
+        reader.active = reader.dropped = false;
+        if (wasActive && mWriterWaiting) {
+            mEvents.setBits(kFlagReadOp);
+        }
+    }
+    bool isDropped(int id) const { return mReaders[id].dropped; }
+    /** Returns the amount of data discarded for the reader by the kLagSkipReader policy
+     * since the last call */
+    uint32_t skippedBytes(int id)
+    {
+        MutexLocker locker(mMutex);
+        auto ret = mReaders[id].skipped;
+        mReaders[id].skipped = 0;
+        return ret;
+    }
+    int dataSize(int id)
+    {
+        MutexLocker locker(mMutex);
+        return mReaders[id].active ? backlog(mReaders[id]) : 0;
+    }
+    int totalEmptySpace()
+    {
+        MutexLocker locker(mMutex);
+        return freeSpace_locked();
+    }
+    // Writer API
+    /** Writes the data, blocking until there is enough space for all registered readers,
+     * subject to the lag policy.
+     * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled
+     */
+    int8_t write(const char* buf, int size, int msTimeout=-1)
+    {
+        rbassert(size <= mSize);
+        MutexLocker locker(mMutex);
+        auto ret = waitForSpace_locked(size, msTimeout);
+        if (ret <= 0) {
+            return ret;
+        }
+        int contig = contigFrom(mWriteCnt);
+        if (contig >= size) {
+            memcpy(ptrAt(mWriteCnt), buf, size);
+        } else {
+            memcpy(ptrAt(mWriteCnt), buf, contig);
+            memcpy(mBuf, buf + contig, size - contig);
+        }
+        publishWrite_locked(size);
+        return 1;
+    }
+    /* Returns a contiguous buffer for writing of at least reqSize bytes, which is
+     * clipped to the space till the end of the buffer.
+     * @returns the size of the returned buffer, 0 for timeout or -1 if stop was signalled
+     */
+    int getWriteBuf(char*& buf, int reqSize, int msTimeout)
+    {
+        MutexLocker locker(mMutex);
+        int maxPossible = contigFrom(mWriteCnt);
+        auto ret = waitForSpace_locked(std::min(reqSize, maxPossible), msTimeout);
+        if (ret <= 0) {
+            buf = nullptr;
+            return ret;
+        }
+        buf = ptrAt(mWriteCnt);
+        return std::min(freeSpace_locked(), maxPossible);
+    }
+    void commitWrite(int size)
+    {
+        MutexLocker locker(mMutex);
+        rbassert(size <= std::min(freeSpace_locked(), contigFrom(mWriteCnt)));
+        publishWrite_locked(size);
+    }
+    // Reader API
+    /* Reads exactly \c size bytes for the specified reader, blocking if needed.
+     * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled,
+     * kErrDropped if the reader was dropped
+     */
+    int8_t read(int id, char* buf, int size, int msTimeout)
+    {
+        rbassert(size <= mSize);
+        MutexLocker locker(mMutex);
+        auto ret = waitForData_locked(id, size, msTimeout);
+        if (ret <= 0) {
+            return ret;
+        }
+        auto& reader = mReaders[id];
+        int contig = contigFrom(reader.readCnt);
+        if (contig >= size) {
+            memcpy(buf, ptrAt(reader.readCnt), size);
+        } else {
+            memcpy(buf, ptrAt(reader.readCnt), contig);
+            memcpy(buf + contig, mBuf, size - contig);
+        }
+        commitRead_locked(reader, size);
+        return 1;
+    }
+    /* Returns a contiguous buffer with data for the specified reader, blocking until
+     * data becomes available. The data must be released with commitContigRead()
+     * @returns the amount of data in the returned buffer, 0 for timeout, -1 if stop
+     * was signalled, kErrDropped if the reader was dropped
+     */
+    int contigRead(int id, char*& buf, int maxSize, int msTimeout)
+    {
+        MutexLocker locker(mMutex);
+        auto ret = waitForData_locked(id, 1, msTimeout);
+        if (ret <= 0) {
+            buf = nullptr;
+            return ret;
+        }
+        auto& reader = mReaders[id];
+        reader.inRead = true;
+        buf = ptrAt(reader.readCnt);
+        return std::min(std::min(backlog(reader), contigFrom(reader.readCnt)), maxSize);
+    }
+    void commitContigRead(int id, int size)
+    {
+        MutexLocker locker(mMutex);
+        auto& reader = mReaders[id];
+        reader.inRead = false;
+        commitRead_locked(reader, size);
+    }
+};
+
+#endif
@@ -0,0 +1,110 @@
+// Host tests of BroadcastRingBuf: two readers, one using read() and one contigRead(),
+// receive a stream written with write() and getWriteBuf(), with the cursors starting
+// just below UINT32_MAX so that they wrap around during the test
+// Build: g++ -O2 -std=gnu++17 -I../hostStubs broadcastRingBufTest.cpp -o broadcastRingBufTest -lpthread
+#include "broadcastRingBuf.hpp"
+#include <thread>
+#include <vector>
+#include <assert.h>
+
+struct TestRingBuf: public BroadcastRingBuf
+{
+    using BroadcastRingBuf::BroadcastRingBuf;
+    // must be called before any readers are added
+    void setWriteCnt(uint32_t cnt) { mWriteCnt = cnt; }
+    uint32_t writeCnt() const { return mWriteCnt; }
+};
+static char streamByte(uint32_t offset) { return (char)(offset * 7 + (offset >> 8)); }
+
+void testCursorWrap()
+{
+    enum { kTotal = 1 << 20 };
+    TestRingBuf rb(1024);
+    const uint32_t start = UINT32_MAX - 5000;
+    rb.setWriteCnt(start);
+    int reader1 = rb.addReader();
+    int reader2 = rb.addReader();
+    assert(reader1 >= 0 && reader2 >= 0);
+    // chunk sizes are such that a blocked read() and write() together always fit
+    // in the buffer, otherwise they would wait for each other forever
+    std::thread writer([&]() {
+        uint32_t offset = 0;
+        int chunk = 1;
+        while (offset < kTotal) {
+            chunk = chunk % 450 + 37;
+            int len = std::min<int>(chunk, kTotal - offset);
+            if (chunk & 1) {
+                char buf[1024];
+                for (int i = 0; i < len; i++) {
+                    buf[i] = streamByte(offset + i);
+                }
+                assert(rb.write(buf, len) == 1);
+                offset += len;
+            } else {
+                char* buf;
+                int avail = std::min(rb.getWriteBuf(buf, len, -1), len);
+                assert(avail > 0);
+                for (int i = 0; i < avail; i++) {
+                    buf[i] = streamByte(offset + i);
+                }
+                rb.commitWrite(avail);
+                offset += avail;
+            }
+        }
+    });
+    std::thread contigReader([&]() {
+        uint32_t offset = 0;
+        while (offset < kTotal) {
+            char* buf;
+            int len = rb.contigRead(reader2, buf, 333, -1);
+            assert(len > 0);
+            for (int i = 0; i < len; i++) {
+                assert(buf[i] == streamByte(offset + i));
+            }
+            rb.commitContigRead(reader2, len);
+            offset += len;
+        }
+    });
+    uint32_t offset = 0;
+    int chunk = 1;
+    while (offset < kTotal) {
+        chunk = chunk % 500 + 13;
+        int len = std::min<int>(chunk, kTotal - offset);
+        char buf[1024];
+        assert(rb.read(reader1, buf, len, -1) == 1);
+        for (int i = 0; i < len; i++) {
+            assert(buf[i] == streamByte(offset + i));
+        }
+        offset += len;
+    }
+    writer.join();
+    contigReader.join();
+    assert(rb.writeCnt() == start + kTotal && rb.writeCnt() < start);
+    assert(rb.dataSize(reader1) == 0 && rb.dataSize(reader2) == 0);
+    assert(rb.totalEmptySpace() == rb.size());
+}
+void testSkipAcrossWrap()
+{
+    TestRingBuf rb(256, BroadcastRingBuf::kLagSkipReader, 100);
+    rb.setWriteCnt(UINT32_MAX - 100);
+    int reader = rb.addReader();
+    char buf[256];
+    memset(buf, 'a', sizeof(buf));
+    assert(rb.write(buf, 200, 0) == 1);
+    assert(rb.dataSize(reader) == 200);
+    // doesn't fit, so the reader's backlog is skipped instead of blocking
+    memset(buf, 'b', sizeof(buf));
+    assert(rb.write(buf, 150, 0) == 1);
+    assert(rb.skippedBytes(reader) == 200);
+    assert(rb.dataSize(reader) == 150);
+    char out[150];
+    assert(rb.read(reader, out, 150, 0) == 1);
+    assert(memcmp(out, buf, 150) == 0);
+}
+int main()
+{
+    testCursorWrap();
+    testSkipAcrossWrap();
+    printf("OK\n");
+    return 0;
+}
@@ -7,14 +7,80 @@
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
+#include <algorithm>
 
-class DynBuffer
+template <int N>
+struct DynBufferInlineStorage
+{
+    char mInlineBuf[N];
+    char* inlineBuf() { return mInlineBuf; }
+};
+template <>
+struct DynBufferInlineStorage<0>
+{
+    char* inlineBuf() { return nullptr; }
+};
+
+/** Default DynBuffer allocator. An allocator may have state, in which case it is
+ * passed to the buffer's constructor and stored in the buffer.
+ */
+struct DynBufferMallocAllocator
+{
+    void* allocate(size_t size) { return ::malloc(size); }
+    void* reallocate(void* ptr, size_t size) { return ::realloc(ptr, size); }
+    void deallocate(void* ptr) { ::free(ptr); }
+};
+
+/** Growable byte buffer. If N is non-zero, the first N bytes are stored inside the
+ * object itself, and the heap is used only if the data outgrows them. This avoids
+ * heap allocations for short-lived small buffers, like JSON fragments and headers.
+ * Use the DynBuffer typedef for a buffer without inline storage.
+ * Appending grows the buffer geometrically, so building data piece by piece
+ * does O(log n) reallocations.
+ */
+template <int N, class Alloc=DynBufferMallocAllocator>
+class BasicDynBuffer: protected DynBufferInlineStorage<N>, protected Alloc
 {
 protected:
     char* mBuf;
     int mBufSize;
     int mDataSize;
+    using DynBufferInlineStorage<N>::inlineBuf;
+    bool isInline() const
+    {
+        if constexpr (N > 0) {
+            return mBuf == this->mInlineBuf;
+        } else {
+            return false;
+        }
+    }
+    void setEmptyBuf()
+    {
+        mBuf = inlineBuf();
+        mBufSize = N;
+    }
+    void freeHeapBuf()
+    {
+        if (mBuf && !isInline()) {
+            Alloc::deallocate(mBuf);
+        }
+    }
+    // Takes over the other buffer's heap memory, or copies its inline data
+    void takeFrom(BasicDynBuffer& other)
+    {
+        mDataSize = other.mDataSize;
+        if (other.isInline()) {
+            setEmptyBuf();
+            memcpy(mBuf, other.mBuf, mDataSize);
+        } else {
+            mBuf = other.mBuf;
+            mBufSize = other.mBufSize;
+        }
+        other.setEmptyBuf();
+        other.mDataSize = 0;
+    }
 public:
+    enum: int { kInlineSize = N, kMinGrowStep = 32 };
     char* buf() { return mBuf; }
     const char* buf() const { return mBuf; }
     char* data() { return mBuf; }
@@ -23,49 +89,47 @@ public:
     int dataSize() const { return mDataSize; }
     bool isEmpty() const { return mDataSize <= 0; }
     int freeSpace() const { return mBufSize - mDataSize; }
-    DynBuffer(size_t allocSize = 0)
-    :mDataSize(0)
+    /** Whether the data is currently in the heap, rather than in the inline storage */
+    bool isOnHeap() const { return mBuf && !isInline(); }
+    BasicDynBuffer(size_t allocSize = 0, const Alloc& alloc = Alloc())
+    :Alloc(alloc), mDataSize(0)
     {
-        if (!allocSize) {
-            mBuf = nullptr;
-            mBufSize = 0;
+        setEmptyBuf();
+        if (allocSize <= (size_t)N) {
             return;
         }
-        mBuf = (char*)malloc(allocSize);
-        if (!mBuf) {
-            mBufSize = 0;
+        auto buf = (char*)Alloc::allocate(allocSize);
+        if (!buf) {
             return;
         }
+        mBuf = buf;
         mBufSize = allocSize;
     }
-    DynBuffer(char* data, size_t size) {
+    BasicDynBuffer(char* data, size_t size, const Alloc& alloc = Alloc())
+    : Alloc(alloc)
+    {
+        setEmptyBuf();
+        mDataSize = 0;
         if (!data || !size) {
-            mBuf = nullptr;
-            mBufSize = mDataSize = 0;
             return;
         }
-        mBuf = (char*)malloc(size);
-        assert(mBuf);
+        reserve(size);
         memcpy(mBuf, data, size);
-        mBufSize = mDataSize = size;
+        mDataSize = size;
     }
-    DynBuffer(const DynBuffer& other) = delete;
-    DynBuffer(DynBuffer&& other)
-    : mBuf(other.mBuf), mBufSize(other.mBufSize), mDataSize(other.mDataSize)
+    BasicDynBuffer(const BasicDynBuffer& other) = delete;
+    BasicDynBuffer(BasicDynBuffer&& other)
+    : Alloc(other)
     {
-        other.mBuf = nullptr;
-        other.mBufSize = other.mDataSize = 0;
+        takeFrom(other);
     }
-    ~DynBuffer() { if (mBuf) ::free(mBuf); }
+    ~BasicDynBuffer() { freeHeapBuf(); }
     void clear() { mDataSize = 0; }
     void freeBuf()
     {
-        if (!mBuf) {
-            return;
-        }
-        ::free(mBuf);
-        mBuf = nullptr;
-        mBufSize = mDataSize = 0;
+        freeHeapBuf();
+        setEmptyBuf();
+        mDataSize = 0;
     }
     char& operator[](int idx)
     {
@@ -89,7 +153,18 @@ public:
         if (newSize <= mBufSize) {
             return;
         }
-        auto newBuf = mBuf ? (char*)realloc(mBuf, newSize) : (char*)malloc(newSize);
+        char* newBuf;
+        if (isOnHeap()) {
+            newBuf = (char*)Alloc::reallocate(mBuf, newSize);
+        } else {
+            newBuf = (char*)Alloc::allocate(newSize);
+            // without inline storage, a buffer that is not on the heap has no data
+            if constexpr (N > 0) {
+                if (newBuf && mDataSize) {
+                    memcpy(newBuf, mBuf, mDataSize); // spill the inline data
+                }
+            }
+        }
         if (!newBuf) {
             printf("DynBuffer::reserve: Out of memory allocating %d bytes for buffer", newSize);
             abort();
@@ -105,11 +180,16 @@ public:
         }
         mDataSize = newDataSize;
     }
+    /** Makes sure there is space for appending \c amount bytes. Grows the buffer by
+     * at least 1.5x (and at least kMinGrowStep), so that repeated appends are cheap.
+     * Use reserve() for exact allocation
+     */
     void ensureFreeSpace(int amount)
     {
         auto needed = mDataSize + amount;
         if (needed > mBufSize) {
-            reserve(needed);
+            int grown = mBufSize + std::max(mBufSize / 2, (int)kMinGrowStep);
+            reserve(std::max(needed, grown));
         }
     }
     char* getAppendPtr(int writeLen)
@@ -133,21 +213,30 @@ public:
         memcpy(mBuf, data, size);
         mDataSize = size;
     }
-    void moveFrom(DynBuffer& other) {
-        if (mBuf) {
-            ::free(mBuf);
-        }
-        mBufSize = other.mBufSize;
-        mDataSize = other.mDataSize;
-        mBuf = other.release();
+    void moveFrom(BasicDynBuffer& other) {
+        freeHeapBuf();
+        Alloc::operator=(other); // the memory is now owned by the other's allocator
+        takeFrom(other);
     }
+    /** Detaches and returns the data buffer, which must be freed by the caller via
+     * the allocator - with free() for the default one.
+     * If the data is in the inline storage, it is first copied to the heap.
+     */
     char* release() {
-        auto result = mBuf;
-        mBuf = nullptr;
-        mBufSize = mDataSize = 0;
+        char* result;
+        if (isInline()) {
+            result = mDataSize ? (char*)Alloc::allocate(mDataSize) : nullptr;
+            if (result) {
+                memcpy(result, mBuf, mDataSize);
+            }
+        } else {
+            result = mBuf;
+        }
+        setEmptyBuf();
+        mDataSize = 0;
         return result;
     }
-    DynBuffer& append(const char* data, int dataSize)
+    BasicDynBuffer& append(const char* data, int dataSize)
     {
         ensureFreeSpace(dataSize);
         memcpy(mBuf + mDataSize, data, dataSize);
@@ -155,14 +244,14 @@ public:
         return *this;
     }
     template<class T>
-    DynBuffer& appendVal(T val) { return append((const char*)&val, sizeof(val)); }
-    DynBuffer& appendChar(char ch)
+    BasicDynBuffer& appendVal(T val) { return append((const char*)&val, sizeof(val)); }
+    BasicDynBuffer& appendChar(char ch)
     {
         ensureFreeSpace(1);
         mBuf[mDataSize++] = ch;
         return *this;
     }
-    DynBuffer& appendStr(const char* str, int len, bool nullTerminate=false)
+    BasicDynBuffer& appendStr(const char* str, int len, bool nullTerminate=false)
     {
         if (len) {
             if ((mDataSize > 0) && (mBuf[mDataSize-1] == 0)) {
@@ -174,7 +263,7 @@ public:
         }
         return *this;
     }
-    DynBuffer& appendStr(const char *str, bool nullTerminate=false)
+    BasicDynBuffer& appendStr(const char *str, bool nullTerminate=false)
     {
         return appendStr(str, strlen(str), nullTerminate);
     }
@@ -196,7 +285,10 @@ public:
         }
         int writeSize = freeSpace();
         for (;;) {
-            int num = ::vsnprintf(getAppendPtr(writeSize), writeSize, fmt, args);
+            va_list argsCopy; // args can't be reused after being consumed by vsnprintf
+            va_copy(argsCopy, args);
+            int num = ::vsnprintf(getAppendPtr(writeSize), writeSize, fmt, argsCopy);
+            va_end(argsCopy);
             if (num < 0) {
                 return num;
             } else if (num < writeSize) { // completely written
@@ -220,7 +312,7 @@ public:
         if (!dataSize()) {
             return nullptr;
         }
-        DynBuffer result(dataSize());
+        BasicDynBuffer<0> result(dataSize());
         auto end = mBuf + dataSize();
         for (char* ptr = mBuf; ptr < end; ptr++) {
             char ch = *ptr;
@@ -238,4 +330,9 @@ public:
     }
 };
 
+typedef BasicDynBuffer<0> DynBuffer;
+/** DynBuffer with N bytes of inline storage */
+template <int N, class Alloc=DynBufferMallocAllocator>
+using SmallDynBuffer = BasicDynBuffer<N, Alloc>;
+
 #endif
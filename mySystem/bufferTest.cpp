@@ -0,0 +1,111 @@
+// Host benchmark of DynBuffer vs SmallDynBuffer for typical JSON building.
+// Build: g++ -O2 -std=gnu++17 bufferTest.cpp -o bufferTest
+#include "buffer.hpp"
+#include <chrono>
+#include <math.h>
+
+static long gAllocCount = 0;
+
+#ifdef __GLIBC__
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_realloc(void* ptr, size_t size);
+extern "C" void* malloc(size_t size)
+{
+    gAllocCount++;
+    return __libc_malloc(size);
+}
+extern "C" void* realloc(void* ptr, size_t size)
+{
+    gAllocCount++;
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+const char* kKeys[] = { "name", "ssid", "volume", "eqGains", "sampleRate" };
+
+template <class B>
+void buildJsonFragment(B& buf, int idx)
+{
+    buf.appendChar('{');
+    for (int i = 0; i < 3; i++) {
+        if (i) {
+            buf.appendChar(',');
+        }
+        buf.printf("\"%s\":%d", kKeys[(idx + i) % 5], idx * 10 + i);
+    }
+    buf.appendChar('}');
+}
+
+template <class B>
+void bench(const char* name, int numIter)
+{
+    long checksum = 0;
+    long allocsBefore = gAllocCount;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numIter; i++) {
+        B buf;
+        buildJsonFragment(buf, i);
+        checksum += buf.dataSize();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    printf("%-20s: %8ld allocs, %5.1f allocs/fragment, %6.1f ns/fragment (checksum %ld)\n", name,
+        gAllocCount - allocsBefore, (double)(gAllocCount - allocsBefore) / numIter,
+        elapsed * 1000.0 / numIter, checksum);
+}
+
+// Stateful allocator, counts the calls into a counter owned by the caller
+struct CountingAllocator: public DynBufferMallocAllocator
+{
+    long* mCounter;
+    CountingAllocator(long* counter): mCounter(counter) {}
+    void* allocate(size_t size) { (*mCounter)++; return ::malloc(size); }
+    void* reallocate(void* ptr, size_t size) { (*mCounter)++; return ::realloc(ptr, size); }
+};
+
+template <int N>
+void testGrowth()
+{
+    for (int n: {100, 1000, 10000, 100000, 1000000}) {
+        long allocs = 0;
+        BasicDynBuffer<N, CountingAllocator> buf(0, CountingAllocator(&allocs));
+        for (int i = 0; i < n; i++) {
+            buf.appendChar('a' + i % 26);
+        }
+        assert(buf.dataSize() == n);
+        // 1.5x growth from a 32 byte step: log1.5(n/32) + a few
+        long limit = (long)(log(n / 32.0) / log(1.5)) + 3;
+        printf("%d appends (inline %d): %ld allocations, limit %ld\n", n, N, allocs, limit);
+        assert(allocs <= limit);
+        long appendAllocs = allocs;
+        for (int i = 0; i < n / 10; i++) {
+            buf.printf("%d,", i);
+        }
+        assert(allocs - appendAllocs <= limit);
+    }
+}
+
+int main()
+{
+    testGrowth<0>();
+    testGrowth<64>();
+
+    // correctness: spill to heap, release() and move of inline data
+    SmallDynBuffer<16> sbuf;
+    sbuf.appendStr("0123456789");
+    assert(!sbuf.isOnHeap());
+    SmallDynBuffer<16> moved(std::move(sbuf));
+    assert(moved.dataSize() == 10 && !memcmp(moved.buf(), "0123456789", 10) && !moved.isOnHeap());
+    moved.appendStr("abcdefghij", true);
+    assert(moved.isOnHeap() && !strcmp(moved.buf(), "0123456789abcdefghij"));
+    SmallDynBuffer<16> small;
+    small.appendStr("xyz", true);
+    char* released = small.release();
+    assert(released && !strcmp(released, "xyz") && small.dataSize() == 0);
+    free(released);
+
+    enum { kIter = 1000000 };
+    bench<DynBuffer>("DynBuffer", kIter);
+    bench<SmallDynBuffer<64>>("SmallDynBuffer<64>", kIter);
+    bench<SmallDynBuffer<128>>("SmallDynBuffer<128>", kIter);
+    return 0;
+}
@@ -0,0 +1,308 @@
+#ifndef JSON_WRITER_HPP
+#define JSON_WRITER_HPP
+
+#include <string.h>
+#include <math.h>
+#include <type_traits>
+#include <string>
+#include <esp_http_server.h>
+#include <lwip/sockets.h>
+#include "buffer.hpp"
+#include "tostring.hpp"
+
+/** Streaming JSON generator. Output is formatted and escaped directly into a fixed
+ * chunk buffer, which is passed to the sink whenever it gets full, so a response
+ * of any size is sent in full-size chunks without any heap allocation.
+ * A sink is any class with the methods:
+ *   bool write(const char* data, int len); // false on error
+ *   bool finish(); // called once by JsonWriter::finish(), after the last write
+ * Commas between elements are inserted automatically. Errors are sticky - once the
+ * sink fails, further output is discarded and finish() returns false.
+ * The chunk buffer is a member, so mind the stack usage when creating the writer
+ * on the stack.
+ */
+template <class Sink, int kChunkSize=1024>
+class JsonWriter
+{
+protected:
+    enum: int { kMaxDepth = 32, kNumBufSize = 32 };
+    Sink mSink;
+    int mDataSize = 0;
+    int8_t mDepth = 0;
+    bool mError = false;
+    bool mAfterKey = false;
+    uint32_t mHasItems = 0; // bit per nesting level: whether the container already has an element
+    char mBuf[kChunkSize];
+    bool flushBuf()
+    {
+        if (mDataSize && !mError) {
+            mError = !mSink.write(mBuf, mDataSize);
+        }
+        mDataSize = 0;
+        return !mError;
+    }
+    char* reserve(int len)
+    {
+        if (kChunkSize - mDataSize < len) {
+            flushBuf();
+        }
+        return mBuf + mDataSize;
+    }
+    void putChar(char ch)
+    {
+        if (mDataSize >= kChunkSize) {
+            flushBuf();
+        }
+        mBuf[mDataSize++] = ch;
+    }
+    void putRaw(const char* str, int len)
+    {
+        for (;;) {
+            int n = std::min(len, kChunkSize - mDataSize);
+            memcpy(mBuf + mDataSize, str, n);
+            mDataSize += n;
+            len -= n;
+            if (!len) {
+                return;
+            }
+            str += n;
+            flushBuf();
+        }
+    }
+    // escapes directly into the chunk buffer, copying runs of plain characters in one go
+    void putEscapedInner(const char* str, int len)
+    {
+        static const char kHexDigits[] = "0123456789abcdef";
+        const char* end = str + len;
+        while (str < end) {
+            const char* run = str;
+            while (str < end && (uint8_t)*str >= 0x20 && *str != '"' && *str != '\\') {
+                str++;
+            }
+            if (str > run) {
+                putRaw(run, str - run);
+                if (str >= end) {
+                    break;
+                }
+            }
+            char ch = *(str++);
+            char* wptr = reserve(6);
+            *(wptr++) = '\\';
+            switch (ch) {
+                case '"': *(wptr++) = '"'; break;
+                case '\\': *(wptr++) = '\\'; break;
+                case '\b': *(wptr++) = 'b'; break;
+                case '\f': *(wptr++) = 'f'; break;
+                case '\n': *(wptr++) = 'n'; break;
+                case '\r': *(wptr++) = 'r'; break;
+                case '\t': *(wptr++) = 't'; break;
+                default:
+                    *(wptr++) = 'u';
+                    *(wptr++) = '0';
+                    *(wptr++) = '0';
+                    *(wptr++) = kHexDigits[(uint8_t)ch >> 4];
+                    *(wptr++) = kHexDigits[ch & 0x0f];
+                    break;
+            }
+            mDataSize = wptr - mBuf;
+        }
+    }
+    void putEscaped(const char* str, int len)
+    {
+        putChar('"');
+        putEscapedInner(str, len);
+        putChar('"');
+    }
+    template <typename T>
+    void putNumber(T val)
+    {
+        char* wptr = reserve(kNumBufSize);
+        char* end;
+        if constexpr (std::is_floating_point<T>::value) {
+            // same precision as the default, but without the trailing zeroes
+            end = toString<kDontNullTerminate|kShortest|6>(wptr, kNumBufSize, val);
+        } else {
+            end = toString<kDontNullTerminate>(wptr, kNumBufSize, val);
+        }
+        assert(end);
+        mDataSize = end - mBuf;
+    }
+    void putPart(const char* str) { putEscapedInner(str, strlen(str)); }
+    void putPart(const std::string& str) { putEscapedInner(str.c_str(), str.size()); }
+    void putPart(char ch) { putEscapedInner(&ch, 1); }
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, char>::value>::type
+    putPart(T val) { putNumber(val); }
+    // emits a comma if needed, before any array element or object key
+    void beginElement()
+    {
+        if (mAfterKey) {
+            mAfterKey = false;
+            return;
+        }
+        uint32_t bit = 1u << mDepth;
+        if (mHasItems & bit) {
+            putChar(',');
+        } else {
+            mHasItems |= bit;
+        }
+    }
+    void openContainer(char ch)
+    {
+        beginElement();
+        putChar(ch);
+        mDepth++;
+        assert(mDepth < kMaxDepth);
+        mHasItems &= ~(1u << mDepth);
+    }
+    void closeContainer(char ch)
+    {
+        assert(mDepth > 0 && !mAfterKey);
+        mDepth--;
+        putChar(ch);
+    }
+public:
+    template <typename... Args>
+    JsonWriter(Args&&... args): mSink(std::forward<Args>(args)...) {}
+    Sink& sink() { return mSink; }
+    bool hasError() const { return mError; }
+    /** Output that is buffered and not yet passed to the sink */
+    const char* pendingData() const { return mBuf; }
+    int pendingSize() const { return mDataSize; }
+    JsonWriter& beginObject() { openContainer('{'); return *this; }
+    JsonWriter& endObject() { closeContainer('}'); return *this; }
+    JsonWriter& beginArray() { openContainer('['); return *this; }
+    JsonWriter& endArray() { closeContainer(']'); return *this; }
+    JsonWriter& key(const char* name, int len)
+    {
+        beginElement();
+        putEscaped(name, len);
+        putChar(':');
+        mAfterKey = true;
+        return *this;
+    }
+    JsonWriter& key(const char* name) { return key(name, strlen(name)); }
+    JsonWriter& value(const char* str, int len)
+    {
+        beginElement();
+        putEscaped(str, len);
+        return *this;
+    }
+    JsonWriter& value(const char* str)
+    {
+        if (!str) {
+            return null();
+        }
+        return value(str, strlen(str));
+    }
+    JsonWriter& value(bool val)
+    {
+        beginElement();
+        if (val) {
+            putRaw("true", 4);
+        } else {
+            putRaw("false", 5);
+        }
+        return *this;
+    }
+    template <typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value
+        && !std::is_same<T, char>::value, JsonWriter&>::type
+    value(T val)
+    {
+        if constexpr (std::is_floating_point<T>::value) {
+            if (!isfinite(val)) { // not representable in JSON
+                return null();
+            }
+        }
+        beginElement();
+        putNumber(val);
+        return *this;
+    }
+    JsonWriter& null()
+    {
+        beginElement();
+        putRaw("null", 4);
+        return *this;
+    }
+    /** Inserts already formatted JSON as a value */
+    JsonWriter& rawValue(const char* json, int len)
+    {
+        beginElement();
+        putRaw(json, len);
+        return *this;
+    }
+    /** Writes a string value that is concatenated from several parts - strings,
+     * chars or numbers, similar to appendAny()
+     */
+    template <typename... Args>
+    JsonWriter& valueConcat(Args&&... parts)
+    {
+        beginElement();
+        putChar('"');
+        (putPart(std::forward<Args>(parts)), ...);
+        putChar('"');
+        return *this;
+    }
+    template <typename T>
+    JsonWriter& kv(const char* name, T&& val)
+    {
+        key(name);
+        return value(std::forward<T>(val));
+    }
+    /** Sends any buffered output to the sink */
+    bool flush() { return flushBuf(); }
+    /** Flushes and finalizes the output. All containers must be closed */
+    bool finish()
+    {
+        assert(mDepth == 0);
+        if (!flushBuf()) {
+            return false;
+        }
+        mError = !mSink.finish();
+        return !mError;
+    }
+};
+
+/** Sends the output as HTTP chunks. finish() sends the terminating chunk */
+struct JsonHttpChunkSink
+{
+    httpd_req_t* mReq;
+    JsonHttpChunkSink(httpd_req_t* req): mReq(req) {}
+    bool write(const char* data, int len) { return httpd_resp_send_chunk(mReq, data, len) == ESP_OK; }
+    bool finish() { return httpd_resp_send_chunk(mReq, nullptr, 0) == ESP_OK; }
+};
+
+/** Sends the output to a socket */
+struct JsonSocketSink
+{
+    int mFd;
+    JsonSocketSink(int fd): mFd(fd) {}
+    bool write(const char* data, int len)
+    {
+        while (len > 0) {
+            int ret = ::send(mFd, data, len, 0);
+            if (ret <= 0) {
+                return false;
+            }
+            data += ret;
+            len -= ret;
+        }
+        return true;
+    }
+    bool finish() { return true; }
+};
+
+/** Appends the output to a DynBuffer (or any BasicDynBuffer) */
+template <class B=DynBuffer>
+struct JsonDynBufferSink
+{
+    B& mBuf;
+    JsonDynBufferSink(B& buf): mBuf(buf) {}
+    bool write(const char* data, int len) { mBuf.append(data, len); return true; }
+    bool finish() { return true; }
+};
+
+typedef JsonWriter<JsonHttpChunkSink> HttpJsonWriter;
+
+#endif
@@ -0,0 +1,134 @@
+// Host tests of JsonWriter, with its output collected in a DynBuffer: escaping, commas
+// in nested containers, kv() and valueConcat(), non-finite floats, and escapes and
+// values that straddle a chunk flush
+// Build: g++ -O2 -std=gnu++17 -I../hostStubs jsonWriterTest.cpp -o jsonWriterTest
+#include "jsonWriter.hpp"
+
+template <int kChunkSize>
+using TestWriter = JsonWriter<JsonDynBufferSink<DynBuffer>, kChunkSize>;
+
+static std::string str(DynBuffer& buf) { return std::string(buf.buf(), buf.dataSize()); }
+static int gErrors = 0;
+static void check(const std::string& actual, const std::string& expected, const char* what)
+{
+    if (actual != expected) {
+        printf("%s:\n  expected: %s\n  actual:   %s\n", what, expected.c_str(), actual.c_str());
+        gErrors++;
+    }
+}
+// writes the same output with all chunk sizes, so that escapes are split at every offset
+template <int kChunkSize, class F>
+void checkChunked(F&& gen, const std::string& expected, const char* what)
+{
+    DynBuffer buf;
+    TestWriter<kChunkSize> json(buf);
+    gen(json);
+    if (!json.finish()) {
+        printf("%s: finish() failed\n", what);
+        gErrors++;
+    }
+    check(str(buf), expected, what);
+    if constexpr (kChunkSize > 32) { // a number is reserved as a whole
+        checkChunked<kChunkSize - 1>(gen, expected, what);
+    }
+}
+void testEscaping()
+{
+    auto gen = [](auto& json) {
+        json.beginArray()
+            .value("quote\" backslash\\ slash/")
+            .value("\b\f\n\r\t")
+            .value("\x01\x1f ctrl", 7)
+            .value(std::string("nul\0in", 6).c_str(), 6)
+            .value("utf8 \xc3\xa9")
+            .endArray();
+    };
+    checkChunked<48>(gen, "[\"quote\\\" backslash\\\\ slash/\",\"\\b\\f\\n\\r\\t\","
+        "\"\\u0001\\u001f ctrl\",\"nul\\u0000in\",\"utf8 \xc3\xa9\"]", "escaping");
+    // keys are escaped too
+    DynBuffer buf;
+    TestWriter<64> json(buf);
+    json.beginObject().kv("a\"b", 1).endObject();
+    json.finish();
+    check(str(buf), "{\"a\\\"b\":1}", "escaped key");
+}
+void testNesting()
+{
+    auto gen = [](auto& json) {
+        json.beginObject()
+            .kv("a", 1)
+            .key("arr").beginArray()
+                .value(1).value(2)
+                .beginObject().endObject()
+                .beginArray().endArray()
+                .beginArray().value("x").beginObject().kv("k", "v").kv("n", nullptr).endObject().endArray()
+                .null()
+            .endArray()
+            .key("empty").beginObject().endObject()
+            .key("obj").beginObject().kv("t", true).kv("f", false).endObject()
+            .kv("last", -5)
+            .endObject();
+    };
+    checkChunked<40>(gen, "{\"a\":1,\"arr\":[1,2,{},[],[\"x\",{\"k\":\"v\",\"n\":null}],null],"
+        "\"empty\":{},\"obj\":{\"t\":true,\"f\":false},\"last\":-5}", "nesting");
+    // consecutive top-level values, as in a stream of records
+    DynBuffer buf;
+    TestWriter<64> json(buf);
+    json.beginObject().endObject();
+    json.rawValue("[1]", 3);
+    json.finish();
+    check(str(buf), "{},[1]", "top level");
+}
+void testKvAndConcat()
+{
+    auto gen = [](auto& json) {
+        json.beginObject()
+            .kv("int", 42).kv("neg", (int64_t)-1234567890123).kv("u8", (uint8_t)200)
+            .kv("float", 1.5f).kv("double", 0.1).kv("str", "s").kv("bool", true)
+            .key("concat").valueConcat("err ", 12, ": ", std::string("a\"b"), '\n', 2.5)
+            .key("empty").valueConcat()
+            .endObject();
+    };
+    checkChunked<48>(gen, "{\"int\":42,\"neg\":-1234567890123,\"u8\":200,\"float\":1.5,\"double\":0.1,"
+        "\"str\":\"s\",\"bool\":true,\"concat\":\"err 12: a\\\"b\\n2.5\",\"empty\":\"\"}", "kv/valueConcat");
+}
+void testNonFinite()
+{
+    auto gen = [](auto& json) {
+        json.beginArray().value(NAN).value(INFINITY).value(-(double)INFINITY).value(1.0f).endArray();
+    };
+    checkChunked<40>(gen, "[null,null,null,1]", "non-finite");
+}
+// a sink that fails after a number of writes
+struct FailingSink
+{
+    int mWritesLeft;
+    int mFinished = 0;
+    FailingSink(int writes): mWritesLeft(writes) {}
+    bool write(const char*, int) { return mWritesLeft-- > 0; }
+    bool finish() { mFinished++; return true; }
+};
+void testSinkError()
+{
+    JsonWriter<FailingSink, 16> json(1);
+    json.beginArray();
+    for (int i = 0; i < 20; i++) {
+        json.value("0123456789");
+    }
+    json.endArray();
+    bool ok = json.finish();
+    if (!json.hasError() || ok || json.sink().mFinished) {
+        printf("sink error: not reported, or the sink was finished\n");
+        gErrors++;
+    }
+}
+int main()
+{
+    testEscaping();
+    testNesting();
+    testKvAndConcat();
+    testNonFinite();
+    testSinkError();
+    printf("%s\n", gErrors ? "FAILED" : "OK");
+    return gErrors ? 1 : 0;
+}
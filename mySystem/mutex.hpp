@@ -14,6 +14,7 @@ public:
         mMutex = xSemaphoreCreateRecursiveMutexStatic(&mMutexMem);
     }
     void lock() { xSemaphoreTakeRecursive(mMutex, portMAX_DELAY); }
+    bool try_lock() { return xSemaphoreTakeRecursive(mMutex, 0) == pdTRUE; }
     void unlock() { xSemaphoreGiveRecursive(mMutex); }
 };
 
@@ -95,7 +95,8 @@ esp_err_t NvsSimple::httpDumpToJson(httpd_req_t* req)
         assert(!it);
         return err;
     }
-    std::string json = "{";
+    HttpJsonWriter json(req);
+    json.beginObject();
     for(;;) {
         err = nvs_entry_next(&it);
         if (err) {
@@ -109,23 +110,13 @@ esp_err_t NvsSimple::httpDumpToJson(httpd_req_t* req)
         nvs_entry_info(it, &info);
         if (info.type == NVS_TYPE_STR) {
             unique_ptr_mfree<char> val(self.getString(info.key));
-            json += '\"';
-            json.append(info.key).append("\":\"").append(val.get()) += '\"';
+            json.kv(info.key, val.get());
         } else if (info.type == NVS_TYPE_I32) {
-            json += '\"';
-            json.append(info.key).append("\":");
-            appendAny(json, self.getInt32(info.key, 0));
+            json.kv(info.key, self.getInt32(info.key, 0));
         }
-        httpd_resp_send_chunk(req, json.c_str(), json.size());
-        json = ",";
     }
-    if (json == "{") {
-        httpd_resp_sendstr_chunk(req, "{}");
-    } else {
-        httpd_resp_sendstr_chunk(req, "}");
-    }
-    httpd_resp_sendstr_chunk(req, nullptr);
-    return ESP_OK;
+    json.endObject();
+    return json.finish() ? ESP_OK : ESP_FAIL;
 }
 esp_err_t NvsSimple::httpSetParam(httpd_req_t* req)
 {
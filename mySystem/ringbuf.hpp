@@ -10,7 +10,51 @@
 #include "utils.hpp"
 #include "waitable.hpp"
 
+#if !defined(ESP_PLATFORM) && defined(__linux__)
+    #define RINGBUF_HAVE_MIRROR 1
+    #include <sys/mman.h>
+#endif
+
+#ifndef rbassert
 #define rbassert myassert
+#endif
+
+// RINGBUF_STATS adds members to RingBuf, so it must be defined for every translation
+// unit that includes this header, or the class layouts won't match. Enable it for the
+// whole build with idf.py -DRINGBUF_STATS=1, which the mySystem component propagates
+// to all components that use it - not with a #define in a source file
+#ifdef RINGBUF_STATS
+#include "buffer.hpp"
+/** Snapshot of the statistics of a RingBuf, see RingBuf::getStats().
+ * Fill levels are sampled after every read and write operation
+ */
+struct RingBufStats
+{
+    enum: int { kHistBuckets = 10 };
+    int bufSize = 0;
+    int minFill = 0;
+    int maxFill = 0;
+    int avgFill = 0;
+    // number of operations after which the fill level was in the i-th tenth of the buffer
+    uint32_t fillHist[kHistBuckets] = {};
+    uint32_t underruns = 0; // number of times a reader had to wait for data
+    uint64_t underrunUs = 0; // total time readers spent waiting
+    uint32_t overruns = 0; // number of times a writer had to wait for space
+    uint64_t overrunUs = 0;
+    uint32_t contendedLocks = 0; // lock acquisitions that had to wait for another task
+    void toJson(DynBuffer& buf) const
+    {
+        buf.printf("{\"size\":%d,\"fill\":{\"min\":%d,\"max\":%d,\"avg\":%d,\"hist\":[",
+            bufSize, minFill, maxFill, avgFill);
+        for (int i = 0; i < kHistBuckets; i++) {
+            buf.printf(i ? ",%u" : "%u", (unsigned)fillHist[i]);
+        }
+        buf.printf("]},\"underruns\":{\"count\":%u,\"ms\":%u},\"overruns\":{\"count\":%u,\"ms\":%u},"
+            "\"contendedLocks\":%u}", (unsigned)underruns, (unsigned)(underrunUs / 1000),
+            (unsigned)overruns, (unsigned)(overrunUs / 1000), (unsigned)contendedLocks);
+    }
+};
+#endif
 
 class RingBuf;
 struct ReadBuf
@@ -21,6 +65,22 @@ struct ReadBuf
     inline ~ReadBuf();
 };
 
+/** Up to two memory segments of a ring buffer, in ring order, similar to a pair of iovecs.
+ * The second segment is non-empty only if the region wraps around the end of the buffer
+ */
+struct RingSegments
+{
+    struct Segment
+    {
+        char* buf;
+        int size;
+    };
+    Segment seg[2];
+    int size() const { return seg[0].size + seg[1].size; }
+    int count() const { return seg[1].size ? 2 : (seg[0].size ? 1 : 0); }
+    void clear() { seg[0] = seg[1] = {nullptr, 0}; }
+};
+
 class RingBuf: public Waitable
 {
 protected:
@@ -32,24 +92,136 @@ protected:
     // Prevents clearing the ringbuffer while someone is using the
     // buffer returned by contigRead()
     int mDataSize;
+    // Minimum data/free space that readers/writers wait for, see setWatermarks()
+    int mReadWatermark = 1;
+    int mWriteWatermark = 1;
+    // Data level at which a blocked reader is signalled, and free space at which a
+    // blocked writer is signalled. A blocked reader/writer raises it to the amount
+    // it actually needs, so that it is not woken up by every small operation
+    // on the other side. Assumes one reader and one writer at a time.
+    int mReadWakeLevel = 1;
+    int mWriteWakeLevel = 1;
+#ifdef RINGBUF_HAVE_MIRROR
+    // The buffer pages are mapped a second time right after mBufEnd, so any
+    // region of up to bufSize() bytes is contiguous in memory
+    bool mMirrored = false;
+    static char* mirrorAlloc(size_t& size)
+    {
+        long pageSize = sysconf(_SC_PAGESIZE);
+        size = (size + pageSize - 1) / pageSize * pageSize;
+        int fd = memfd_create("ringbuf", MFD_CLOEXEC);
+        if (fd < 0) {
+            return nullptr;
+        }
+        char* base = nullptr;
+        if (ftruncate(fd, size) == 0) {
+            // reserve address space for both views, then map the same pages over each half
+            base = (char*)mmap(nullptr, 2 * size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (base == MAP_FAILED) {
+                base = nullptr;
+            } else if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+                mmap(base + size, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                munmap(base, 2 * size);
+                base = nullptr;
+            }
+        }
+        close(fd);
+        return base;
+    }
+#else
+    static constexpr bool mMirrored = false;
+#endif
+#ifdef RINGBUF_STATS
+    RingBufStats mStats;
+    uint64_t mFillSum = 0;
+    uint32_t mFillSamples = 0;
+    struct Locker
+    {
+        Mutex& mMutex;
+        Locker(RingBuf& rb): mMutex(rb.mMutex)
+        {
+            if (!mMutex.try_lock()) {
+                mMutex.lock();
+                rb.mStats.contendedLocks++;
+            }
+        }
+        ~Locker() { mMutex.unlock(); }
+    };
+    // Accounts a blocking wait of a reader or writer, from start() until destruction
+    struct WaitRecorder
+    {
+        uint32_t& mCount;
+        uint64_t& mTotalUs;
+        int64_t mTsStart = 0;
+        WaitRecorder(RingBuf& rb, bool isReader)
+        : mCount(isReader ? rb.mStats.underruns : rb.mStats.overruns),
+          mTotalUs(isReader ? rb.mStats.underrunUs : rb.mStats.overrunUs) {}
+        void start()
+        {
+            if (!mTsStart) {
+                mTsStart = esp_timer_get_time();
+                mCount++;
+            }
+        }
+        ~WaitRecorder()
+        {
+            if (mTsStart) {
+                mTotalUs += esp_timer_get_time() - mTsStart;
+            }
+        }
+    };
+    void statsRecordFill()
+    {
+        if (mDataSize < mStats.minFill) {
+            mStats.minFill = mDataSize;
+        }
+        if (mDataSize > mStats.maxFill) {
+            mStats.maxFill = mDataSize;
+        }
+        mFillSum += mDataSize;
+        mFillSamples++;
+        int bucket = (int64_t)mDataSize * RingBufStats::kHistBuckets / bufSize();
+        mStats.fillHist[std::min(bucket, RingBufStats::kHistBuckets - 1)]++;
+    }
+    void doResetStats()
+    {
+        mStats = RingBufStats();
+        mStats.bufSize = bufSize();
+        mStats.minFill = mStats.maxFill = mDataSize;
+        mFillSum = mFillSamples = 0;
+    }
+#else
+    struct Locker: public MutexLocker
+    {
+        Locker(RingBuf& rb): MutexLocker(rb.mMutex) {}
+    };
+    struct WaitRecorder
+    {
+        WaitRecorder(RingBuf&, bool) {}
+        void start() {}
+    };
+    void statsRecordFill() {}
+    void doResetStats() {}
+#endif
     int bufSize() const { return mBufEnd - mBuf; }
     int availableForContigRead()
     {
-        if (mWritePtr > mReadPtr) { // none wrapped
+        if (mMirrored) {
+            return mDataSize;
+        } else if (mWritePtr > mReadPtr) { // none wrapped
             return mWritePtr - mReadPtr;
         } else if (mReadPtr > mWritePtr) { // write wrapped, read didn't
             return mBufEnd - mReadPtr;
-        } else if (mEvents.get() & kFlagHasSpace) { // empty
-            return 0;
-        } else { // full
-            myassert(mEvents.get() & kFlagHasItems);
-            return mBufEnd - mReadPtr;
+        } else { // empty or full
+            return (mDataSize == 0) ? 0 : mBufEnd - mReadPtr;
         }
     }
-    int maxPossibleContigReadSize() { return mBufEnd - mReadPtr; }
+    int maxPossibleContigReadSize() { return mMirrored ? bufSize() : mBufEnd - mReadPtr; }
     int availableForContigWrite()
     {
-        if (mWritePtr > mReadPtr) {
+        if (mMirrored) {
+            return bufSize() - mDataSize;
+        } else if (mWritePtr > mReadPtr) {
             return mBufEnd - mWritePtr;
         } else if (mWritePtr < mReadPtr){
             return mReadPtr - mWritePtr; // Removed: artificially leave 1 byte to distinguish between empty and full
@@ -60,41 +232,93 @@ protected:
     void doCommitContigRead(int size)
     {
         rbassert(size <= availableForContigRead());
+        if (!size) {
+            return;
+        }
         mReadPtr += size;
-        if (mReadPtr == mBufEnd) {
-            mReadPtr = mBuf;
-        } else {
-            assert(mReadPtr < mBufEnd);
+        if (mReadPtr >= mBufEnd) {
+            rbassert(mMirrored || mReadPtr == mBufEnd);
+            mReadPtr -= bufSize();
         }
+        bool wasFull = (mDataSize == bufSize());
         mDataSize -= size;
-        if (mWritePtr == mReadPtr) {
+        statsRecordFill();
+        if (mDataSize == 0) {
             mEvents.clearBits(kFlagHasItems);
-            mEvents.setBits(kFlagIsEmpty);
         }
-        mEvents.setBits(kFlagReadOp|kFlagHasSpace);
+        EventBits_t bitsToSet = wasFull ? kFlagHasSpace : 0;
+        if (mDataSize == 0) {
+            bitsToSet |= kFlagIsEmpty;
+        }
+        if (totalEmptySpace_nolock() >= mWriteWakeLevel) {
+            bitsToSet |= kFlagReadOp;
+        }
+        if (bitsToSet) {
+            mEvents.setBits(bitsToSet);
+        }
     }
     void commitContigWrite(int size)
     {
         rbassert(size <= availableForContigWrite());
+        if (!size) {
+            return;
+        }
         mWritePtr += size;
         if (mWritePtr >= mBufEnd) {
-            myassert(mWritePtr == mBufEnd);
-            mWritePtr = mBuf;
-        } else {
-            rbassert(mWritePtr < mBufEnd);
+            myassert(mMirrored || mWritePtr == mBufEnd);
+            mWritePtr -= bufSize();
         }
+        bool wasEmpty = (mDataSize == 0);
         mDataSize += size;
-        EventBits_t bitsToClear = kFlagIsEmpty;
-        if (mWritePtr == mReadPtr) {
+        statsRecordFill();
+        EventBits_t bitsToClear = wasEmpty ? kFlagIsEmpty : 0;
+        if (mDataSize == bufSize()) {
             bitsToClear |= kFlagHasSpace;
         }
-        mEvents.clearBits(bitsToClear);
-        mEvents.setBits(kFlagWriteOp | kFlagHasItems);
+        if (bitsToClear) {
+            mEvents.clearBits(bitsToClear);
+        }
+        EventBits_t bitsToSet = wasEmpty ? kFlagHasItems : 0;
+        if (mDataSize >= mReadWakeLevel) {
+            bitsToSet |= kFlagWriteOp;
+        }
+        if (bitsToSet) {
+            mEvents.setBits(bitsToSet);
+        }
+    }
+    void doCommitRead(int size)
+    {
+        rbassert(size <= mDataSize);
+        int contig = availableForContigRead();
+        if (size > contig) {
+            doCommitContigRead(contig);
+            size -= contig;
+        }
+        if (size) {
+            doCommitContigRead(size);
+        }
+    }
+    void doCommitWrite(int size)
+    {
+        rbassert(size <= totalEmptySpace_nolock());
+        int contig = availableForContigWrite();
+        if (size > contig) {
+            commitContigWrite(contig);
+            size -= contig;
+        }
+        if (size) {
+            commitContigWrite(size);
+        }
+    }
+    void fillSegments(RingSegments& segs, char* start, int contig, int total)
+    {
+        segs.seg[0] = {start, contig};
+        segs.seg[1] = {(total > contig) ? mBuf : nullptr, total - contig};
     }
     int contigWrite(char* buf, int size)
     {
         int wlen = std::min(size, availableForContigWrite());
-        myassert(mWritePtr+wlen <= mBufEnd);
+        myassert(mMirrored || mWritePtr+wlen <= mBufEnd);
         memcpy(mWritePtr, buf, wlen);
         commitContigWrite(wlen);
         return wlen;
@@ -103,6 +327,67 @@ protected:
     {
         return size() - mDataSize;
     }
+    /* Called and returns with the mutex locked. Blocks until at least \c amount bytes
+     * of data are available, without being woken up by writes that don't reach that level.
+     * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled
+     */
+    int8_t waitForData_locked(int amount, int msTimeout)
+    {
+        WaitRecorder recorder(*this, true);
+        while (mDataSize < amount) {
+            if (!msTimeout) {
+                return 0;
+            }
+            recorder.start();
+            mReadWakeLevel = amount;
+            int64_t tsStart = esp_timer_get_time();
+            int8_t ret;
+            {
+                MutexUnlocker unlocker(mMutex);
+                ret = waitForWriteOp(msTimeout);
+            }
+            mReadWakeLevel = 1;
+            if (ret <= 0) {
+                return ret;
+            }
+            if (msTimeout > 0) {
+                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
+                if (msTimeout <= 0) {
+                    msTimeout = 0; // check once more and bail out
+                }
+            }
+        }
+        return 1;
+    }
+    /* Same as waitForData_locked(), but for free space */
+    int8_t waitForSpace_locked(int amount, int msTimeout)
+    {
+        WaitRecorder recorder(*this, false);
+        while (totalEmptySpace_nolock() < amount) {
+            if (!msTimeout) {
+                return 0;
+            }
+            recorder.start();
+            mWriteWakeLevel = amount;
+            int64_t tsStart = esp_timer_get_time();
+            int8_t ret;
+            {
+                MutexUnlocker unlocker(mMutex);
+                ret = waitForReadOp(msTimeout);
+            }
+            mWriteWakeLevel = 1;
+            if (ret <= 0) {
+                return ret;
+            }
+            if (msTimeout > 0) {
+                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
+                if (msTimeout <= 0) {
+                    msTimeout = 0;
+                }
+            }
+        }
+        return 1;
+    }
     void doClear()
     {
         mDataSize = 0;
@@ -115,26 +400,53 @@ public:
     // If user wants to keep some external state in sync with the ringbuffer,
     // they can use the ringbuf's mutex to protect that state
     Mutex& mutex() { return mMutex; }
-    RingBuf(size_t bufSize, bool useSpiRam=false)
-        : mBuf((char*)heap_caps_malloc(bufSize, useSpiRam ? MALLOC_CAP_8BIT|MALLOC_CAP_SPIRAM : MALLOC_CAP_8BIT))
+    /** @param mirrored Only on host builds - back the buffer with memory that is
+     * mapped twice back-to-back, so that contigRead(), getWriteBuf() and peek() never
+     * have to deal with wrap-around. The size is rounded up to a multiple of the page size.
+     * Falls back to a normal buffer if the mapping fails. Ignored on ESP32.
+     */
+    RingBuf(size_t bufSize, bool useSpiRam=false, bool mirrored=false)
+        : mBuf(nullptr)
     {
+#ifdef RINGBUF_HAVE_MIRROR
+        if (mirrored) {
+            mBuf = mirrorAlloc(bufSize);
+            if (mBuf) {
+                mMirrored = true;
+            } else {
+                ESP_LOGW("RINGBUF", "Could not create mirrored mapping, falling back to normal buffer");
+            }
+        }
+#endif
+        if (!mBuf) {
+            mBuf = (char*)heap_caps_malloc(bufSize, useSpiRam ? MALLOC_CAP_8BIT|MALLOC_CAP_SPIRAM : MALLOC_CAP_8BIT);
+        }
         if (!mBuf) {
             ESP_LOGE("RINGBUF", "Out of memory allocation %zu bytes", bufSize);
             return;
         }
         mBufEnd = mBuf + bufSize;
         doClear();
+        doResetStats();
     }
     ~RingBuf()
     {
-        if (mBuf) {
-            free(mBuf);
+        if (!mBuf) {
+            return;
         }
+#ifdef RINGBUF_HAVE_MIRROR
+        if (mMirrored) {
+            munmap(mBuf, 2 * bufSize());
+            return;
+        }
+#endif
+        free(mBuf);
     }
+    bool isMirrored() const { return mMirrored; }
     int size() const { return mBufEnd - mBuf; }
     void clear()
     {
-        MutexLocker locker(mMutex);
+        Locker locker(*this);
         for (;;) {
             if (!mOpInProgress) {
                 doClear();
@@ -153,81 +465,76 @@ public:
     }
     int totalEmptySpace()
     {
-        MutexLocker locker(mMutex);
+        Locker locker(*this);
         return totalEmptySpace_nolock();
     }
+    /** Sets the minimum amount of data that contigRead() waits for, and the minimum
+     * free space that getWriteBuf() waits for. Producers and consumers are then
+     * woken up only when these levels are reached, rather than on every operation,
+     * which allows batch consumers to process data in large chunks. The levels are
+     * clipped to the buffer size. Default is 1 for both.
+     */
+    void setWatermarks(int readLow, int writeLow)
+    {
+        Locker locker(*this);
+        mReadWatermark = std::max(1, std::min(readLow, size()));
+        mWriteWatermark = std::max(1, std::min(writeLow, size()));
+    }
+    int readWatermark() const { return mReadWatermark; }
+    int writeWatermark() const { return mWriteWatermark; }
+#ifdef RINGBUF_STATS
+    /** Only available if RINGBUF_STATS is defined at compile time */
+    void getStats(RingBufStats& stats)
+    {
+        Locker locker(*this);
+        stats = mStats;
+        stats.avgFill = mFillSamples ? mFillSum / mFillSamples : mDataSize;
+    }
+    void resetStats()
+    {
+        Locker locker(*this);
+        doResetStats();
+    }
+#endif
     /* Read requested amount and block if needed.
      * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled
      */
     int8_t read(char* buf, int size, int msTimeout)
     {
-        for (;;) {
-            int64_t tsStart = esp_timer_get_time();
-            mMutex.lock();
-            if (dataSize() >= size) {
-                break;
-            }
-            mMutex.unlock();
-            auto ret = waitAndReset(kFlagWriteOp, msTimeout);
-            if (ret <= 0) {
-                return ret;
-            }
-            if (msTimeout > 0) {
-                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
-                if (msTimeout < 0) {
-                    return 0;
-                }
-            }
+        Locker locker(*this);
+        auto ret = waitForData_locked(size, msTimeout);
+        if (ret <= 0) {
+            return ret;
         }
-        // mutex is locked here
         auto rlen = std::min(size, availableForContigRead());
         memcpy(buf, mReadPtr, rlen);
         doCommitContigRead(rlen);
         if (rlen >= size) {
             rbassert(rlen == size);
-            mMutex.unlock();
             return 1;
         }
         buf += rlen;
         size -= rlen;
         memcpy(buf, mReadPtr, size);
         doCommitContigRead(size);
-        mMutex.unlock();
         return 1;
     }
     /* Returns a contiguous buffer with data for reading, which may be shorter
-     * than sizeWanted. If no data is available for reading, blocks until data becomes
-     * available or timeout elapses
+     * than sizeWanted. If less than the read watermark (or maxSize, if smaller) is
+     * available for reading, blocks until that much data becomes available or
+     * timeout elapses. Note that the returned buffer may still be shorter than the
+     * watermark if the data wraps around the end of the buffer.
      * @returns the amount of data in the returned buffer, 0 for timeout or -1 if stop
      * was signalled
      */
     int contigRead(char*& buf, int maxSize, int msTimeout)
     {
-        MutexLocker locker(mMutex);
-        int avail;
-        if (msTimeout < 0) {
-            while ((avail = availableForContigRead()) < 1) {
-                MutexUnlocker unlocker(mMutex);
-                //ESP_LOGI("RB", "underflow");
-                if (waitForWriteOp(-1) <= 0) {
-                    return -1;
-                }
-            }
-        } else {
-            while ((avail = availableForContigRead()) < 1) {
-                int64_t tsStart = esp_timer_get_time();
-                MutexUnlocker unlocker(mMutex);
-                //ESP_LOGI("RB", "underflow");
-                int ret = waitForWriteOp(msTimeout);
-                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
-                if (ret < 0) {
-                    return ret;
-                }
-                if (msTimeout < 0) {
-                    return 0;
-                }
-            }
+        Locker locker(*this);
+        auto ret = waitForData_locked(std::max(1, std::min(mReadWatermark, maxSize)), msTimeout);
+        if (ret <= 0) {
+            return ret;
         }
+        int avail = availableForContigRead();
         mOpInProgress |= kReadInProgress;
         buf = mReadPtr;
         return avail > maxSize ? maxSize : avail;
@@ -243,17 +550,12 @@ public:
     }
     const char* peek(size_t len, char* buf, int msTimeout=-1)
     {
-        while (mDataSize < len) {
-            if (!msTimeout) {
-                return nullptr;
-            }
-            if (waitForWriteOp(msTimeout) <= 0) {
-                return nullptr;
-            }
+        Locker locker(*this);
+        if (waitForData_locked(len, msTimeout) <= 0) {
+            return nullptr;
         }
-        MutexLocker locker(mMutex);
         auto contig = availableForContigRead();
-        if (contig >= len) {
+        if (contig >= (int)len) {
             return mReadPtr;
         }
         if (contig) {
@@ -265,18 +567,10 @@ public:
     }
     bool write(char* buf, int size)
     {
-        for (;;) {
-            mMutex.lock();
-            if (totalEmptySpace_nolock() >= size) {
-                break;
-            }
-
-            mMutex.unlock();
-            if (waitAndReset(kFlagReadOp, -1) < 0) {
-                return false;
-            }
+        Locker locker(*this);
+        if (waitForSpace_locked(size, -1) < 0) {
+            return false;
         }
-        // mutex is locked here
         auto written = contigWrite(buf, size);
 
         if (written < size) {
@@ -286,53 +580,100 @@ public:
 
             rbassert(written == size);
         }
-        mMutex.unlock();
         return true;
     }
+    /* Returns a contiguous buffer for writing. Blocks until at least reqSize bytes,
+     * or the write watermark if larger, are free. The requested size is clipped
+     * to the space till the end of the buffer.
+     * @returns the size of the returned buffer, 0 for timeout or -1 if stop was signalled
+     */
     int getWriteBuf(char*& buf, int reqSize, int timeoutMs)
     {
-        MutexLocker locker(mMutex);
-        int maxPossible = mBufEnd - mWritePtr;
-        if (reqSize > maxPossible) {
-            reqSize = maxPossible;
-        }
-        for (;;) {
-            auto contig = availableForContigWrite();
-            if (contig >= reqSize) {
-                buf = mWritePtr;
-                mOpInProgress |= kWriteInProgress;
-                return contig;
-            }
-            {
-                MutexUnlocker unlocker(mMutex);
-                auto ret = waitForReadOp(timeoutMs);
-                if (ret <= 0) {
-                    buf = nullptr;
-                    return ret;
-                }
-            }
+        Locker locker(*this);
+        int maxPossible = mMirrored ? size() : mBufEnd - mWritePtr;
+        reqSize = std::min(std::max(reqSize, mWriteWatermark), maxPossible);
+        // Space starting at mWritePtr is contiguous up to maxPossible, so having
+        // reqSize bytes free means having them contiguous
+        auto ret = waitForSpace_locked(reqSize, timeoutMs);
+        if (ret <= 0) {
+            buf = nullptr;
+            return ret;
         }
+        buf = mWritePtr;
+        mOpInProgress |= kWriteInProgress;
+        return availableForContigWrite();
     }
     void commitWrite(int size) {
-        MutexLocker locker(mMutex);
+        Locker locker(*this);
         commitContigWrite(size);
         mOpInProgress &= ~kWriteInProgress;
     }
     void abortWrite() {
-        MutexLocker locker(mMutex);
+        Locker locker(*this);
         mOpInProgress &= ~kWriteInProgress;
     }
     void commitContigRead(int size)
     {
         {
-            MutexLocker locker(mMutex);
+            Locker locker(*this);
             doCommitContigRead(size);
             mOpInProgress &= ~kReadInProgress;
         }
     }
+    /* Returns the readable data as up to two segments, without copying wrapped data.
+     * Blocks until at least minSize bytes are available or timeout elapses.
+     * The data must be released with commitReadSegments(), which may consume
+     * any amount up to the returned size, including zero.
+     * @returns the total size of the segments, capped at maxSize, 0 for timeout
+     * or -1 if stop was signalled
+     */
+    int getReadSegments(RingSegments& segs, int maxSize, int msTimeout, int minSize=1)
+    {
+        segs.clear();
+        Locker locker(*this);
+        auto ret = waitForData_locked(minSize, msTimeout);
+        if (ret <= 0) {
+            return ret;
+        }
+        int total = std::min(mDataSize, maxSize);
+        fillSegments(segs, mReadPtr, std::min(availableForContigRead(), total), total);
+        mOpInProgress |= kReadInProgress;
+        return total;
+    }
+    void commitReadSegments(int size)
+    {
+        Locker locker(*this);
+        doCommitRead(size);
+        mOpInProgress &= ~kReadInProgress;
+    }
+    /* Returns the free space as up to two segments, so that a producer can fill
+     * wrapped space in one go. Blocks until at least minSize bytes are free or
+     * timeout elapses. The written amount is published with commitWriteSegments(),
+     * or the operation is cancelled with abortWrite()
+     * @returns the total size of the segments, 0 for timeout or -1 if stop was signalled
+     */
+    int getWriteSegments(RingSegments& segs, int minSize, int msTimeout)
+    {
+        segs.clear();
+        Locker locker(*this);
+        auto ret = waitForSpace_locked(minSize, msTimeout);
+        if (ret <= 0) {
+            return ret;
+        }
+        int total = totalEmptySpace_nolock();
+        fillSegments(segs, mWritePtr, availableForContigWrite(), total);
+        mOpInProgress |= kWriteInProgress;
+        return total;
+    }
+    void commitWriteSegments(int size)
+    {
+        Locker locker(*this);
+        doCommitWrite(size);
+        mOpInProgress &= ~kWriteInProgress;
+    }
     bool hasData() const
     {
-        return ((mEvents.get() & kFlagHasItems) != 0);
+        return mDataSize > 0;
     }
 };
 
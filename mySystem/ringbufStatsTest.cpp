@@ -0,0 +1,134 @@
+// Host tests of the RingBuf statistics: fill levels and histogram, reader and writer
+// waits, contended locks, reset and the JSON output.
+// RINGBUF_STATS changes the layout of RingBuf, so it must be defined for the whole
+// program, here on the command line
+// Build: g++ -O2 -std=gnu++17 -DRINGBUF_STATS -I../hostStubs ringbufStatsTest.cpp -o ringbufStatsTest -lpthread
+#ifndef RINGBUF_STATS
+#error "Build with -DRINGBUF_STATS"
+#endif
+#include "ringbuf.hpp"
+#include <thread>
+#include <assert.h>
+
+bool utils::sHaveSpiRam = false;
+
+static RingBufStats getStats(RingBuf& rb)
+{
+    RingBufStats stats;
+    rb.getStats(stats);
+    return stats;
+}
+static void write(RingBuf& rb, int len)
+{
+    char buf[100] = {};
+    bool ok = rb.write(buf, len);
+    assert(ok);
+}
+static void read(RingBuf& rb, int len)
+{
+    char buf[100];
+    int ret = rb.read(buf, len, 0);
+    assert(ret == 1);
+}
+static void sleepMs(int ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+void testFill()
+{
+    RingBuf rb(100);
+    auto stats = getStats(rb);
+    assert(stats.bufSize == 100 && stats.minFill == 0 && stats.maxFill == 0 && stats.avgFill == 0);
+    write(rb, 30);
+    write(rb, 50);
+    read(rb, 60);
+    write(rb, 5);
+    stats = getStats(rb);
+    // sampled at 30, 80, 20 and 25
+    assert(stats.minFill == 0 && stats.maxFill == 80 && stats.avgFill == (30 + 80 + 20 + 25) / 4);
+    uint32_t hist[RingBufStats::kHistBuckets] = {0, 0, 2, 1, 0, 0, 0, 0, 1, 0};
+    assert(memcmp(stats.fillHist, hist, sizeof(hist)) == 0);
+    assert(stats.underruns == 0 && stats.overruns == 0);
+    // a full buffer is in the last bucket, and a write or read that wraps around
+    // the end of the buffer is sampled after each part: 40, 100, 60, 0
+    write(rb, 75);
+    read(rb, 100);
+    stats = getStats(rb);
+    assert(stats.maxFill == 100 && stats.fillHist[9] == 1 && stats.fillHist[4] == 1);
+    assert(stats.fillHist[6] == 1 && stats.fillHist[0] == 1);
+
+    // the minimum and maximum restart at the current level
+    write(rb, 40);
+    rb.resetStats();
+    stats = getStats(rb);
+    assert(stats.minFill == 40 && stats.maxFill == 40 && stats.avgFill == 40);
+    assert(stats.fillHist[4] == 0 && stats.fillHist[9] == 0);
+    read(rb, 10);
+    write(rb, 35);
+    stats = getStats(rb);
+    assert(stats.minFill == 30 && stats.maxFill == 65 && stats.avgFill == (30 + 65) / 2);
+    DynBuffer json;
+    stats.toJson(json);
+    json.nullTerminate();
+    assert(strcmp(json.buf(), "{\"size\":100,\"fill\":{\"min\":30,\"max\":65,\"avg\":47,"
+        "\"hist\":[0,0,0,1,0,0,1,0,0,0]},\"underruns\":{\"count\":0,\"ms\":0},"
+        "\"overruns\":{\"count\":0,\"ms\":0},\"contendedLocks\":0}") == 0);
+}
+void testWaits()
+{
+    RingBuf rb(100);
+    // a reader that times out waiting for data
+    char buf[10];
+    int ret = rb.read(buf, 10, 30);
+    assert(ret == 0);
+    auto stats = getStats(rb);
+    assert(stats.underruns == 1 && stats.underrunUs >= 25000 && stats.overruns == 0);
+    // a reader that is woken up by a writer. Waits that don't have to block aren't counted
+    std::thread writer([&]() {
+        sleepMs(30);
+        write(rb, 10);
+    });
+    ret = rb.read(buf, 10, -1);
+    assert(ret == 1);
+    writer.join();
+    stats = getStats(rb);
+    assert(stats.underruns == 2 && stats.underrunUs >= 50000);
+    write(rb, 10);
+    read(rb, 10);
+    assert(getStats(rb).underruns == 2);
+    // a writer that waits for space
+    write(rb, 95);
+    std::thread reader([&]() {
+        sleepMs(30);
+        read(rb, 50);
+    });
+    write(rb, 20);
+    reader.join();
+    stats = getStats(rb);
+    assert(stats.overruns == 1 && stats.overrunUs >= 25000 && stats.underruns == 2);
+    DynBuffer json;
+    stats.toJson(json);
+    json.nullTerminate();
+    char expected[128];
+    snprintf(expected, sizeof(expected), "\"underruns\":{\"count\":2,\"ms\":%u},\"overruns\":{\"count\":1,\"ms\":%u}",
+        (unsigned)(stats.underrunUs / 1000), (unsigned)(stats.overrunUs / 1000));
+    assert(strstr(json.buf(), expected));
+}
+void testContendedLocks()
+{
+    RingBuf rb(100);
+    rb.totalEmptySpace();
+    assert(getStats(rb).contendedLocks == 0);
+    rb.mutex().lock();
+    std::thread other([&]() { rb.totalEmptySpace(); });
+    sleepMs(30);
+    rb.mutex().unlock();
+    other.join();
+    assert(getStats(rb).contendedLocks == 1);
+}
+int main()
+{
+    testFill();
+    testWaits();
+    testContendedLocks();
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,294 @@
+// Host tests of RingBuf: the number of blocking waits, i.e. task switches, with and
+// without watermarks, peek(), and the two-segment read and write views, with a normal
+// and a mirrored buffer
+// Build: g++ -O2 -std=gnu++17 -I../hostStubs ringbufTest.cpp -o ringbufTest -lpthread
+#include "ringbuf.hpp"
+#include <thread>
+#include <string>
+#include <assert.h>
+
+bool utils::sHaveSpiRam = false;
+
+enum { kRingSize = 32768, kTotal = 16 << 20 };
+static char streamByte(int offset) { return (char)(offset * 7 + (offset >> 9)); }
+
+// A producer that commits small chunks and a consumer that processes large batches
+// @returns the number of blocking waits
+long runSmallWritesLargeReads(int readWatermark)
+{
+    RingBuf rb(kRingSize);
+    rb.setWatermarks(readWatermark, 1);
+    long waits = gEventGroupWaits;
+    std::thread producer([&]() {
+        for (int offset = 0; offset < kTotal;) {
+            char* buf;
+            int len = std::min(rb.getWriteBuf(buf, 64, -1), 64);
+            assert(len > 0);
+            for (int i = 0; i < len; i++) {
+                buf[i] = streamByte(offset + i);
+            }
+            rb.commitWrite(len);
+            offset += len;
+        }
+    });
+    long bad = 0;
+    int reads = 0;
+    for (int offset = 0; offset < kTotal; reads++) {
+        char* buf;
+        // the ring size and the total are multiples of the read size, so a batch
+        // never wraps and the last one is complete
+        int len = rb.contigRead(buf, 4096, -1);
+        assert(len > 0);
+        for (int i = 0; i < len; i++) {
+            bad += (buf[i] != streamByte(offset + i));
+        }
+        rb.commitContigRead(len);
+        offset += len;
+    }
+    producer.join();
+    assert(bad == 0 && rb.dataSize() == 0);
+    waits = gEventGroupWaits - waits;
+    printf("small writes, read watermark %4d: %6ld waits, %6d reads\n", readWatermark, waits, reads);
+    return waits;
+}
+// A producer that fills the free space in batches and a consumer of small chunks
+long runLargeWritesSmallReads(int writeWatermark)
+{
+    RingBuf rb(kRingSize);
+    rb.setWatermarks(1, writeWatermark);
+    long waits = gEventGroupWaits;
+    int writes = 0;
+    std::thread producer([&]() {
+        for (int offset = 0; offset < kTotal; writes++) {
+            char* buf;
+            int len = std::min(rb.getWriteBuf(buf, 1, -1), kTotal - offset);
+            assert(len > 0);
+            for (int i = 0; i < len; i++) {
+                buf[i] = streamByte(offset + i);
+            }
+            rb.commitWrite(len);
+            offset += len;
+        }
+    });
+    long bad = 0;
+    for (int offset = 0; offset < kTotal;) {
+        char buf[64];
+        int ret = rb.read(buf, sizeof(buf), -1);
+        assert(ret == 1);
+        for (int i = 0; i < (int)sizeof(buf); i++) {
+            bad += (buf[i] != streamByte(offset + i));
+        }
+        offset += sizeof(buf);
+    }
+    producer.join();
+    assert(bad == 0 && rb.dataSize() == 0);
+    waits = gEventGroupWaits - waits;
+    printf("small reads, write watermark %4d: %6ld waits, %6d writes\n", writeWatermark, waits, writes);
+    return waits;
+}
+void testWatermarkWaits()
+{
+    long without = runSmallWritesLargeReads(1);
+    long with = runSmallWritesLargeReads(4096);
+    assert(with < without);
+    without = runLargeWritesSmallReads(1);
+    with = runLargeWritesSmallReads(4096);
+    assert(with < without);
+}
+static void write(RingBuf& rb, const char* data, int len)
+{
+    bool ok = rb.write((char*)data, len);
+    assert(ok);
+}
+static void read(RingBuf& rb, char* buf, int len)
+{
+    int ret = rb.read(buf, len, 0);
+    assert(ret == 1);
+}
+void testPeek()
+{
+    RingBuf rb(100);
+    char buf[100];
+    const char* data = rb.peek(10, buf, 0);
+    assert(!data);
+    data = rb.peek(10, buf, 20);
+    assert(!data);
+    // blocks until enough data has been written, not only some
+    std::thread writer([&]() {
+        for (int i = 0; i < 10; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            char ch = '0' + i;
+            write(rb, &ch, 1);
+        }
+    });
+    data = rb.peek(10, buf);
+    assert(data && memcmp(data, "0123456789", 10) == 0);
+    writer.join();
+    // peek doesn't consume
+    assert(rb.dataSize() == 10);
+    read(rb, buf, 10);
+    assert(memcmp(buf, "0123456789", 10) == 0);
+    // the data wraps around the end of the buffer, and is copied
+    char fill[85] = {};
+    write(rb, fill, sizeof(fill));
+    read(rb, fill, sizeof(fill));
+    write(rb, "abcdefghijklmnop", 16);
+    data = rb.peek(16, buf, 0);
+    assert(data == buf && memcmp(data, "abcdefghijklmnop", 16) == 0);
+    data = rb.peek(5, buf, 0);
+    assert(data && data != buf && memcmp(data, "abcde", 5) == 0);
+    // a stop signal interrupts the wait
+    rb.setStopSignal();
+    data = rb.peek(50, buf);
+    assert(!data);
+}
+// moves the read and write positions of an empty buffer forward by len
+static void skipEmpty(RingBuf& rb, int len)
+{
+    char buf[4096] = {};
+    assert(len <= (int)sizeof(buf) && rb.dataSize() == 0);
+    write(rb, buf, len);
+    read(rb, buf, len);
+}
+static std::string segsData(const RingSegments& segs)
+{
+    std::string ret;
+    for (auto& seg: segs.seg) {
+        ret.append(seg.buf ? seg.buf : "", seg.size);
+    }
+    return ret;
+}
+void testReadSegments()
+{
+    RingBuf rb(100);
+    RingSegments segs;
+    int ret = rb.getReadSegments(segs, 100, 0);
+    assert(ret == 0 && segs.count() == 0);
+    // not wrapped
+    write(rb, "0123456789abcdefghij", 20);
+    ret = rb.getReadSegments(segs, 100, 0);
+    assert(ret == 20 && segs.count() == 1 && segs.size() == 20 && segsData(segs) == "0123456789abcdefghij");
+    rb.commitReadSegments(0); // nothing consumed
+    assert(rb.dataSize() == 20);
+    ret = rb.getReadSegments(segs, 5, 0); // capped
+    assert(ret == 5 && segs.count() == 1 && segsData(segs) == "01234");
+    rb.commitReadSegments(3); // partially consumed
+    assert(rb.dataSize() == 17);
+    ret = rb.getReadSegments(segs, 100, 0, 18); // less than minSize
+    assert(ret == 0);
+    ret = rb.getReadSegments(segs, 100, 0, 17);
+    assert(ret == 17 && segsData(segs) == "3456789abcdefghij");
+    rb.commitReadSegments(17);
+    assert(rb.dataSize() == 0);
+    // wrapped, starting at 80
+    skipEmpty(rb, 60);
+    write(rb, "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123", 30);
+    ret = rb.getReadSegments(segs, 100, 0);
+    assert(ret == 30 && segs.count() == 2);
+    assert(segs.seg[0].size == 20 && segs.seg[1].size == 10 && segs.seg[1].buf == segs.seg[0].buf - 80);
+    assert(segsData(segs) == "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123");
+    rb.commitReadSegments(0);
+    ret = rb.getReadSegments(segs, 25, 0); // the second segment is capped
+    assert(ret == 25 && segs.count() == 2 && segs.seg[0].size == 20 && segs.seg[1].size == 5);
+    assert(segsData(segs) == "ABCDEFGHIJKLMNOPQRSTUVWXY");
+    rb.commitReadSegments(12); // within the first segment
+    ret = rb.getReadSegments(segs, 100, 0);
+    assert(ret == 18 && segs.seg[0].size == 8 && segs.seg[1].size == 10);
+    rb.commitReadSegments(11); // across the end of the buffer
+    ret = rb.getReadSegments(segs, 100, 0);
+    assert(ret == 7 && segs.count() == 1 && segsData(segs) == "XYZ0123");
+    rb.commitReadSegments(7);
+    assert(rb.dataSize() == 0);
+    // a blocked reader waits for minSize, not for the first write
+    std::thread writer([&]() {
+        for (int i = 0; i < 5; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            write(rb, "ab", 2);
+        }
+    });
+    ret = rb.getReadSegments(segs, 100, -1, 10);
+    assert(ret == 10 && segsData(segs) == "ababababab");
+    writer.join();
+    rb.commitReadSegments(10);
+}
+void testWriteSegments()
+{
+    RingBuf rb(100);
+    RingSegments segs;
+    // not wrapped
+    int ret = rb.getWriteSegments(segs, 1, 0);
+    assert(ret == 100 && segs.count() == 1);
+    memcpy(segs.seg[0].buf, "0123456789", 10);
+    rb.commitWriteSegments(10);
+    assert(rb.dataSize() == 10);
+    ret = rb.getWriteSegments(segs, 91, 0); // less than minSize free
+    assert(ret == 0);
+    ret = rb.getWriteSegments(segs, 90, 0);
+    assert(ret == 90 && segs.count() == 1);
+    rb.commitWriteSegments(0);
+    assert(rb.dataSize() == 10);
+    // the free space wraps
+    char buf[100];
+    read(rb, buf, 10);
+    assert(memcmp(buf, "0123456789", 10) == 0);
+    skipEmpty(rb, 70);
+    write(rb, "xyz", 3);
+    ret = rb.getWriteSegments(segs, 1, 0);
+    assert(ret == 97 && segs.count() == 2 && segs.seg[0].size == 17 && segs.seg[1].size == 80);
+    for (auto& seg: segs.seg) {
+        for (int i = 0; i < seg.size; i++) {
+            seg.buf[i] = 'a' + (seg.buf - segs.seg[0].buf + i + 200) % 26;
+        }
+    }
+    rb.commitWriteSegments(30); // partially, across the end of the buffer
+    assert(rb.dataSize() == 33);
+    read(rb, buf, 33);
+    std::string expected = "xyz";
+    for (int i = 0; i < 17; i++) {
+        expected += 'a' + (i + 200) % 26;
+    }
+    for (int i = 0; i < 13; i++) {
+        expected += 'a' + (i - 83 + 200) % 26;
+    }
+    assert(std::string(buf, 33) == expected);
+    // an aborted write leaves the buffer unchanged
+    ret = rb.getWriteSegments(segs, 1, 0);
+    assert(ret == 100);
+    rb.abortWrite();
+    assert(rb.dataSize() == 0);
+}
+void testMirroredSegments()
+{
+    RingBuf rb(4096, false, true);
+    int size = rb.size();
+    assert(rb.isMirrored() && size >= 4096);
+    skipEmpty(rb, size - 96);
+    RingSegments segs;
+    // the free space is contiguous, although it wraps around the end of the buffer
+    int ret = rb.getWriteSegments(segs, 1, 0);
+    assert(ret == size && segs.count() == 1 && segs.seg[0].size == size);
+    for (int i = 0; i < 200; i++) {
+        segs.seg[0].buf[i] = streamByte(i);
+    }
+    rb.commitWriteSegments(200);
+    ret = rb.getReadSegments(segs, size, 0);
+    assert(ret == 200 && segs.count() == 1);
+    for (int i = 0; i < 200; i++) {
+        assert(segs.seg[0].buf[i] == streamByte(i));
+    }
+    rb.commitReadSegments(150);
+    ret = rb.getReadSegments(segs, 30, 0);
+    assert(ret == 30 && segs.count() == 1 && segs.seg[0].buf[0] == streamByte(150));
+    rb.commitReadSegments(30);
+    assert(rb.dataSize() == 20);
+}
+int main()
+{
+    testWatermarkWaits();
+    testPeek();
+    testReadSegments();
+    testWriteSegments();
+    testMirroredSegments();
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,288 @@
+#ifndef SPSC_RINGBUF_HPP
+#define SPSC_RINGBUF_HPP
+
+#include <atomic>
+#include <algorithm>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "utils.hpp"
+#include "eventGroup.hpp"
+
+#ifndef rbassert
+#define rbassert myassert
+#endif
+
+/** Lock-free variant of RingBuf for exactly one producer task and one consumer task.
+ * The read and write positions run in the range [0, 2*size), so that a full buffer
+ * can be told apart from an empty one without a shared data counter. Each side owns its
+ * position and keeps a cached copy of the other side's one on its own cache line.
+ * A blocked side records the data level or free space that it waits for, and the event
+ * group is touched only when the opposite side reaches that level, so in steady state a
+ * chunk transfer involves no kernel calls. As with RingBuf, setWatermarks() makes batch
+ * consumers and producers wake once per batch.
+ */
+class SpscRingBuf
+{
+public:
+#ifdef ESP_PLATFORM
+    enum: int { kCacheLineSize = 32 };
+#else
+    enum: int { kCacheLineSize = 64 };
+#endif
+protected:
+    enum: uint8_t { kFlagWriteOp = 1, kFlagReadOp = 2, kFlagStop = 4 };
+    char* mBuf;
+    int mSize;
+    EventGroup mEvents;
+    // producer state
+    alignas(kCacheLineSize) std::atomic<int> mWritePos;
+    std::atomic<int> mWriterNeeds; // free space that the blocked producer waits for, 0 if not blocked
+    int mWriterReadPos; // producer's cached copy of mReadPos
+    int mWriteWatermark = 1;
+    // consumer state
+    alignas(kCacheLineSize) std::atomic<int> mReadPos;
+    std::atomic<int> mReaderNeeds; // data that the blocked consumer waits for, 0 if not blocked
+    int mReaderWritePos; // consumer's cached copy of mWritePos
+    int mReadWatermark = 1;
+    char* ptrAt(int pos) const { return mBuf + ((pos >= mSize) ? pos - mSize : pos); }
+    int advance(int pos, int by) const
+    {
+        pos += by;
+        return (pos >= 2 * mSize) ? pos - 2 * mSize : pos;
+    }
+    int distance(int from, int to) const
+    {
+        int dist = to - from;
+        return (dist < 0) ? dist + 2 * mSize : dist;
+    }
+    int contigFrom(int pos) const { return (pos >= mSize) ? 2 * mSize - pos : mSize - pos; }
+    // consumer side: data available, refreshing the cached write position only if needed
+    int readerAvail(int rpos, int needed)
+    {
+        int avail = distance(rpos, mReaderWritePos);
+        if (avail < needed) {
+            mReaderWritePos = mWritePos.load(std::memory_order_acquire);
+            avail = distance(rpos, mReaderWritePos);
+        }
+        return avail;
+    }
+    // producer side: free space, refreshing the cached read position only if needed
+    int writerAvail(int wpos, int needed)
+    {
+        int avail = mSize - distance(mWriterReadPos, wpos);
+        if (avail < needed) {
+            mWriterReadPos = mReadPos.load(std::memory_order_acquire);
+            avail = mSize - distance(mWriterReadPos, wpos);
+        }
+        return avail;
+    }
+    /** Blocks the calling side until \c avail(pos, needed) >= needed.
+     * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled
+     */
+    template <class F>
+    int8_t waitUntil(F&& avail, int pos, int needed, std::atomic<int>& waitingFor,
+                     EventBits_t flag, int msTimeout)
+    {
+        for (;;) {
+            if (avail(pos, needed) >= needed) {
+                return 1;
+            }
+            if (!msTimeout) {
+                return 0;
+            }
+            waitingFor.store(needed, std::memory_order_relaxed);
+            // pairs with the fence in publish(): either the other side sees our wait
+            // level, or we see its new position
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (avail(pos, needed) >= needed) {
+                waitingFor.store(0, std::memory_order_relaxed);
+                return 1;
+            }
+            int64_t tsStart = esp_timer_get_time();
+            auto bits = mEvents.waitForOneAndReset(flag | kFlagStop, msTimeout);
+            waitingFor.store(0, std::memory_order_relaxed);
+            if (bits & kFlagStop) {
+                return -1;
+            }
+            if (msTimeout > 0) {
+                msTimeout -= (esp_timer_get_time() - tsStart) / 1000;
+                if (msTimeout < 0) {
+                    msTimeout = 0; // check once more and bail out
+                }
+            }
+        }
+    }
+    /** Stores the new position of the calling side, and wakes up the opposite side
+     * if it is blocked and \c peerAvail() has reached the level that it waits for */
+    template <class F>
+    void publish(std::atomic<int>& position, int newPos, std::atomic<int>& peerWaitingFor,
+                 F&& peerAvail, EventBits_t flag)
+    {
+        position.store(newPos, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int needed = peerWaitingFor.load(std::memory_order_relaxed);
+        if (needed && peerAvail() >= needed && peerWaitingFor.exchange(0)) {
+            mEvents.setBits(flag);
+        }
+    }
+    void publishReadPos(int newPos)
+    {
+        publish(mReadPos, newPos, mWriterNeeds, [this, newPos]() {
+            return mSize - distance(newPos, mWritePos.load(std::memory_order_relaxed));
+        }, kFlagReadOp);
+    }
+    void publishWritePos(int newPos)
+    {
+        publish(mWritePos, newPos, mReaderNeeds, [this, newPos]() {
+            return distance(mReadPos.load(std::memory_order_relaxed), newPos);
+        }, kFlagWriteOp);
+    }
+    int8_t readerWait(int needed, int msTimeout)
+    {
+        return waitUntil([this](int pos, int n) { return readerAvail(pos, n); },
+            mReadPos.load(std::memory_order_relaxed), needed, mReaderNeeds, kFlagWriteOp, msTimeout);
+    }
+    int8_t writerWait(int needed, int msTimeout)
+    {
+        return waitUntil([this](int pos, int n) { return writerAvail(pos, n); },
+            mWritePos.load(std::memory_order_relaxed), needed, mWriterNeeds, kFlagReadOp, msTimeout);
+    }
+public:
+    SpscRingBuf(size_t bufSize, bool useSpiRam=false)
+    : mBuf((char*)heap_caps_malloc(bufSize, useSpiRam ? MALLOC_CAP_8BIT|MALLOC_CAP_SPIRAM : MALLOC_CAP_8BIT)),
+      mSize(mBuf ? bufSize : 0), mEvents(kFlagStop)
+    {
+        if (!mBuf) {
+            ESP_LOGE("RINGBUF", "Out of memory allocation %zu bytes", bufSize);
+        }
+        clear();
+    }
+    ~SpscRingBuf()
+    {
+        if (mBuf) {
+            free(mBuf);
+        }
+    }
+    int size() const { return mSize; }
+    /** Must not be called while either side is in the middle of an operation */
+    void clear()
+    {
+        mWritePos.store(0, std::memory_order_relaxed);
+        mReadPos.store(0, std::memory_order_relaxed);
+        mWriterNeeds.store(0, std::memory_order_relaxed);
+        mReaderNeeds.store(0, std::memory_order_relaxed);
+        mWriterReadPos = mReaderWritePos = 0;
+        mEvents.clearBits(kFlagWriteOp | kFlagReadOp);
+    }
+    /** Sets the minimum amount of data that contigRead() waits for, and the minimum
+     * free space that getWriteBuf() waits for, same as RingBuf::setWatermarks(). Must
+     * not be called while either side is in the middle of an operation */
+    void setWatermarks(int readLow, int writeLow)
+    {
+        mReadWatermark = std::max(1, std::min(readLow, mSize));
+        mWriteWatermark = std::max(1, std::min(writeLow, mSize));
+    }
+    int readWatermark() const { return mReadWatermark; }
+    int writeWatermark() const { return mWriteWatermark; }
+    void setStopSignal() { mEvents.setBits(kFlagStop); }
+    void clearStopSignal() { mEvents.clearBits(kFlagStop); }
+    /** A snapshot, may be outdated by the time it is returned */
+    int dataSize() const
+    {
+        return distance(mReadPos.load(std::memory_order_acquire), mWritePos.load(std::memory_order_acquire));
+    }
+    int totalEmptySpace() const { return mSize - dataSize(); }
+    bool hasData() const { return dataSize() > 0; }
+    // Consumer API
+    /* Read requested amount and block if needed.
+     * @returns 1 upon success, 0 upon timeout, -1 if stop was signalled
+     */
+    int8_t read(char* buf, int size, int msTimeout)
+    {
+        rbassert(size <= mSize);
+        auto ret = readerWait(size, msTimeout);
+        if (ret <= 0) {
+            return ret;
+        }
+        int rpos = mReadPos.load(std::memory_order_relaxed);
+        int contig = contigFrom(rpos);
+        if (contig >= size) {
+            memcpy(buf, ptrAt(rpos), size);
+        } else {
+            memcpy(buf, ptrAt(rpos), contig);
+            memcpy(buf + contig, mBuf, size - contig);
+        }
+        publishReadPos(advance(rpos, size));
+        return 1;
+    }
+    /* Returns a contiguous buffer with data for reading, which may be shorter
+     * than maxSize. If no data is available for reading, blocks until data becomes
+     * available or timeout elapses
+     * @returns the amount of data in the returned buffer, 0 for timeout or -1 if stop
+     * was signalled
+     */
+    int contigRead(char*& buf, int maxSize, int msTimeout)
+    {
+        int rpos = mReadPos.load(std::memory_order_relaxed);
+        // waiting for more than is contiguous would block forever when data wraps
+        auto ret = readerWait(std::max(1, std::min({mReadWatermark, maxSize, contigFrom(rpos)})), msTimeout);
+        if (ret <= 0) {
+            return ret;
+        }
+        int avail = std::min(distance(rpos, mReaderWritePos), contigFrom(rpos));
+        buf = ptrAt(rpos);
+        return avail > maxSize ? maxSize : avail;
+    }
+    void commitContigRead(int size)
+    {
+        int rpos = mReadPos.load(std::memory_order_relaxed);
+        rbassert(size <= std::min(distance(rpos, mReaderWritePos), contigFrom(rpos)));
+        publishReadPos(advance(rpos, size));
+    }
+    // Producer API
+    bool write(const char* buf, int size)
+    {
+        rbassert(size <= mSize);
+        if (writerWait(size, -1) < 0) {
+            return false;
+        }
+        int wpos = mWritePos.load(std::memory_order_relaxed);
+        int contig = contigFrom(wpos);
+        if (contig >= size) {
+            memcpy(ptrAt(wpos), buf, size);
+        } else {
+            memcpy(ptrAt(wpos), buf, contig);
+            memcpy(mBuf, buf + contig, size - contig);
+        }
+        publishWritePos(advance(wpos, size));
+        return true;
+    }
+    /* Returns a contiguous buffer for writing of at least reqSize bytes, blocking
+     * until that much space is available. reqSize is clipped to the space till the
+     * end of the buffer.
+     * @returns the size of the returned buffer, 0 for timeout or -1 if stop was signalled
+     */
+    int getWriteBuf(char*& buf, int reqSize, int timeoutMs)
+    {
+        int wpos = mWritePos.load(std::memory_order_relaxed);
+        int maxPossible = contigFrom(wpos);
+        reqSize = std::min(std::max(reqSize, mWriteWatermark), maxPossible);
+        auto ret = writerWait(reqSize, timeoutMs);
+        if (ret <= 0) {
+            buf = nullptr;
+            return ret;
+        }
+        buf = ptrAt(wpos);
+        return std::min(mSize - distance(mWriterReadPos, wpos), maxPossible);
+    }
+    void commitWrite(int size)
+    {
+        int wpos = mWritePos.load(std::memory_order_relaxed);
+        rbassert(size <= std::min(mSize - distance(mWriterReadPos, wpos), contigFrom(wpos)));
+        publishWritePos(advance(wpos, size));
+    }
+    void abortWrite() {}
+};
+
+#endif
@@ -0,0 +1,90 @@
+// Host benchmark of SpscRingBuf vs the mutex-based RingBuf: a producer thread streams
+// sequence-numbered chunks to the consumer, which checks their content. Also reports
+// the number of blocking event group waits, i.e. task switches, per run.
+// Build: g++ -O2 -std=gnu++17 -I../hostStubs spscRingBufTest.cpp -o spscRingBufTest -lpthread
+#include "ringbuf.hpp"
+#include "spscRingBuf.hpp"
+#include <thread>
+#include <vector>
+
+static long gErrors = 0;
+
+template<class RB, class WF, class RF>
+void run(const char* name, RB& rb, int chunk, int total, WF writeFunc, RF readFunc)
+{
+    std::vector<char> src(chunk), dst(chunk);
+    for (int i = 0; i < chunk; i++) {
+        src[i] = i * 7;
+    }
+    long waits = gEventGroupWaits;
+    auto tsStart = esp_timer_get_time();
+    std::thread producer([&]() {
+        std::vector<char> buf(src);
+        uint8_t seq = 0;
+        for (int n = 0; n < total; n += chunk) {
+            buf[0] = seq++;
+            writeFunc(rb, buf.data(), chunk);
+        }
+    });
+    uint8_t seq = 0;
+    long bad = 0;
+    for (int n = 0; n < total; n += chunk) {
+        readFunc(rb, dst.data(), chunk);
+        if ((uint8_t)dst[0] != seq++ || memcmp(dst.data() + 1, src.data() + 1, chunk - 1)) {
+            bad++;
+        }
+    }
+    producer.join();
+    auto us = esp_timer_get_time() - tsStart;
+    printf("%-8s chunk %5d: %8.1f MB/s, %6.3f us/op, %6ld waits%s\n", name, chunk,
+        total / (double)us, us / (double)(total / chunk), gEventGroupWaits - waits,
+        bad ? ", CORRUPTED" : "");
+    gErrors += bad;
+}
+void spscZeroCopyWrite(SpscRingBuf& rb, char* data, int size)
+{
+    while (size) {
+        char* wbuf;
+        int n = std::min(rb.getWriteBuf(wbuf, size, -1), size);
+        memcpy(wbuf, data, n);
+        rb.commitWrite(n);
+        data += n;
+        size -= n;
+    }
+}
+void spscZeroCopyRead(SpscRingBuf& rb, char* data, int size)
+{
+    while (size) {
+        char* rbuf = nullptr;
+        int n = rb.contigRead(rbuf, size, -1);
+        memcpy(data, rbuf, n);
+        rb.commitContigRead(n);
+        data += n;
+        size -= n;
+    }
+}
+int main()
+{
+    enum { kRingSize = 32768, kTotal = 64 << 20 };
+    for (int chunk: {64, 512, 4096}) {
+        {
+            RingBuf rb(kRingSize);
+            run("mutex", rb, chunk, kTotal,
+                [](RingBuf& rb, char* data, int size) { rb.write(data, size); },
+                [](RingBuf& rb, char* data, int size) { rb.read(data, size, -1); });
+        }
+        {
+            SpscRingBuf rb(kRingSize);
+            run("spsc", rb, chunk, kTotal,
+                [](SpscRingBuf& rb, char* data, int size) { rb.write(data, size); },
+                [](SpscRingBuf& rb, char* data, int size) { rb.read(data, size, -1); });
+        }
+        // size not a multiple of the chunk, so that chunks wrap around the end
+        {
+            SpscRingBuf rb(30000);
+            run("spsc-zc", rb, chunk, kTotal, spscZeroCopyWrite, spscZeroCopyRead);
+        }
+    }
+    printf("%s\n", gErrors ? "FAILED" : "OK");
+    return gErrors ? 1 : 0;
+}
@@ -0,0 +1,217 @@
+#ifndef STAGED_RINGBUF_HPP
+#define STAGED_RINGBUF_HPP
+
+#include <atomic>
+#include "ringbuf.hpp"
+
+/** A large RingBuf in SPI RAM, fronted by small internal RAM staging buffers on the
+ * write and on the read side. Small writes are collected in the write stage, and small
+ * reads are served from the read stage, so that the caller's memcpy-s hit fast memory,
+ * while the transfers to and from SPI RAM are done in stage-sized blocks. Writes and
+ * reads that are at least a stage in size bypass the staging buffers.
+ * When the ring is empty and the reader needs data, it takes over the producer's stage
+ * buffer directly, by swapping it with its own, so data never gets stuck in the write stage.
+ * Supports one producer and one consumer. If SPI RAM is not available, the ring is
+ * allocated in internal RAM.
+ */
+class StagedRingBuf
+{
+public:
+    struct TierStats
+    {
+        uint32_t writeToStage = 0;  // small writes absorbed by internal RAM
+        uint32_t writeToRing = 0;   // large writes going directly to the ring
+        uint32_t stageToRing = 0;   // write stage flushes
+        uint32_t ringToStage = 0;   // read stage refills
+        uint32_t ringToRead = 0;    // large reads served directly from the ring
+        uint32_t stageToRead = 0;   // reads served from the read stage
+        uint32_t stageHandover = 0; // write stage handed over to the reader
+    };
+protected:
+    RingBuf mRing;
+    Mutex mStageMutex; // protects the write stage and the stage buffer swap
+    char* mWriteStage;
+    char* mReadStage;
+    int mStageSize;
+    int mWriteStageLen = 0;
+    int mReadStageLen = 0;
+    int mReadStagePos = 0;
+    std::atomic<bool> mReaderWaiting;
+    TierStats mStats;
+    static char* allocStage(int size)
+    {
+        return (char*)heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    bool flushWriteStage()
+    {
+        int len;
+        {
+            MutexLocker locker(mStageMutex);
+            len = mWriteStageLen;
+        }
+        if (!len) {
+            return true;
+        }
+        // wait for space without holding the stage mutex, as the reader may need it
+        RingSegments segs;
+        if (mRing.getWriteSegments(segs, len, -1) < 0) {
+            return false;
+        }
+        MutexLocker locker(mStageMutex);
+        len = mWriteStageLen; // the reader may have taken over the stage meanwhile
+        int len1 = std::min(len, segs.seg[0].size);
+        memcpy(segs.seg[0].buf, mWriteStage, len1);
+        if (len > len1) {
+            memcpy(segs.seg[1].buf, mWriteStage + len1, len - len1);
+        }
+        mRing.commitWriteSegments(len);
+        mWriteStageLen = 0;
+        mStats.stageToRing += len;
+        return true;
+    }
+    int copyFromSegments(RingSegments& segs, char* buf, int len)
+    {
+        int len1 = std::min(len, segs.seg[0].size);
+        memcpy(buf, segs.seg[0].buf, len1);
+        if (len > len1) {
+            memcpy(buf + len1, segs.seg[1].buf, len - len1);
+        }
+        mRing.commitReadSegments(len);
+        return len;
+    }
+    // @returns 1 upon success, 0 upon timeout, -1 if stop was signalled
+    int8_t fillReadStage(int msTimeout)
+    {
+        mReadStagePos = mReadStageLen = 0;
+        RingSegments segs;
+        int len = mRing.getReadSegments(segs, mStageSize, 0);
+        if (len <= 0) {
+            {
+                MutexLocker locker(mStageMutex);
+                if (mWriteStageLen && !mRing.dataSize()) {
+                    std::swap(mReadStage, mWriteStage);
+                    mReadStageLen = mWriteStageLen;
+                    mWriteStageLen = 0;
+                    mStats.stageHandover += mReadStageLen;
+                    return 1;
+                }
+                // the producer flushes its stage on its next write, if it sees this flag
+                mReaderWaiting = true;
+            }
+            len = mRing.getReadSegments(segs, mStageSize, msTimeout);
+            mReaderWaiting = false;
+            if (len <= 0) {
+                return len;
+            }
+        }
+        mReadStageLen = copyFromSegments(segs, mReadStage, len);
+        mStats.ringToStage += len;
+        return 1;
+    }
+public:
+    enum: int { kStageAlign = 32 }; // SPI RAM cache line size
+    /** @param stageSize Size of each of the two internal RAM staging buffers. Must
+     * be much smaller than the ring size. Rounded up to a multiple of kStageAlign.
+     * Note that this doesn't align the block transfers in the ring - partial stage
+     * flushes and large writes leave the ring position at arbitrary offsets
+     */
+    StagedRingBuf(size_t ringSize, int stageSize=1024)
+    : mRing(ringSize, utils::haveSpiRam()),
+      mStageSize((stageSize + kStageAlign - 1) & ~(kStageAlign - 1)), mReaderWaiting(false)
+    {
+        mWriteStage = allocStage(mStageSize);
+        mReadStage = allocStage(mStageSize);
+        myassert(mWriteStage && mReadStage);
+        myassert(mStageSize * 4 <= (int)ringSize);
+    }
+    ~StagedRingBuf()
+    {
+        heap_caps_free(mWriteStage);
+        heap_caps_free(mReadStage);
+    }
+    int size() const { return mRing.size(); }
+    int stageSize() const { return mStageSize; }
+    /** Total amount of buffered data, including the staging buffers. A snapshot, not exact */
+    int dataSize() const { return mRing.dataSize() + mWriteStageLen + (mReadStageLen - mReadStagePos); }
+    void setStopSignal() { mRing.setStopSignal(); }
+    void clearStopSignal() { mRing.clearStopSignal(); }
+    const TierStats& stats() const { return mStats; }
+    void resetStats() { mStats = TierStats(); }
+    // Producer API
+    /** Writes the data, blocking until there is enough space.
+     * @returns false if stop was signalled
+     */
+    bool write(const char* buf, int size)
+    {
+        for (;;) {
+            if (size < mStageSize) {
+                MutexLocker locker(mStageMutex);
+                if (mWriteStageLen + size <= mStageSize) {
+                    memcpy(mWriteStage + mWriteStageLen, buf, size);
+                    mWriteStageLen += size;
+                    mStats.writeToStage += size;
+                    if (mWriteStageLen < mStageSize && !mReaderWaiting) {
+                        return true;
+                    }
+                    size = 0; // written, but must flush the stage
+                }
+            }
+            if (!flushWriteStage()) {
+                return false;
+            }
+            if (!size) {
+                return true;
+            }
+            if (size < mStageSize) {
+                continue; // the stage is empty now
+            }
+            // large write, bypass the stage
+            int maxChunk = mRing.size() / 2;
+            while (size > 0) {
+                int chunk = std::min(size, maxChunk);
+                if (!mRing.write((char*)buf, chunk)) {
+                    return false;
+                }
+                mStats.writeToRing += chunk;
+                buf += chunk;
+                size -= chunk;
+            }
+            return true;
+        }
+    }
+    /** Makes all data written so far available to the reader via the ring.
+     * Not necessary for the reader to see the data, but useful at end of stream,
+     * so that it can be read in large chunks
+     * @returns false if stop was signalled
+     */
+    bool flush() { return flushWriteStage(); }
+    // Consumer API
+    /** Reads up to maxSize bytes, blocking until at least some data is available.
+     * @returns the number of bytes read, 0 upon timeout or -1 if stop was signalled
+     */
+    int read(char* buf, int maxSize, int msTimeout)
+    {
+        if (mReadStagePos >= mReadStageLen) {
+            if (maxSize >= mStageSize) {
+                // large read, bypass the read stage if the ring has data
+                RingSegments segs;
+                int len = mRing.getReadSegments(segs, maxSize, 0);
+                if (len > 0) {
+                    mStats.ringToRead += len;
+                    return copyFromSegments(segs, buf, len);
+                }
+            }
+            auto ret = fillReadStage(msTimeout);
+            if (ret <= 0) {
+                return ret;
+            }
+        }
+        int len = std::min(maxSize, mReadStageLen - mReadStagePos);
+        memcpy(buf, mReadStage + mReadStagePos, len);
+        mReadStagePos += len;
+        mStats.stageToRead += len;
+        return len;
+    }
+};
+
+#endif
@@ -0,0 +1,107 @@
+// Host tests of StagedRingBuf: handover of the write stage to the reader, the producer
+// flushing its stage for a waiting reader, and a producer/consumer run with mixed small
+// and large transfers that checks the byte order and the per-tier counters
+// Build: g++ -O2 -std=gnu++17 -I../hostStubs stagedRingBufTest.cpp -o stagedRingBufTest -lpthread
+#include "stagedRingBuf.hpp"
+#include <thread>
+#include <assert.h>
+
+bool utils::sHaveSpiRam = false;
+
+void testStageHandover()
+{
+    StagedRingBuf rb(8192, 1024);
+    char buf[4096];
+    // a small write stays in the write stage, and the reader takes the stage over
+    assert(rb.write("0123456789", 10));
+    assert(rb.stats().stageToRing == 0);
+    assert(rb.read(buf, sizeof(buf), 0) == 10);
+    assert(memcmp(buf, "0123456789", 10) == 0);
+    assert(rb.stats().stageHandover == 10);
+    // again, with the swapped buffers
+    assert(rb.write("abcdefghij", 10));
+    assert(rb.write("klmno", 5));
+    assert(rb.read(buf, 3, 0) == 3);
+    assert(rb.read(buf + 3, sizeof(buf) - 3, 0) == 12);
+    assert(memcmp(buf, "abcdefghijklmno", 15) == 0);
+    assert(rb.stats().stageHandover == 25);
+    assert(rb.read(buf, sizeof(buf), 0) == 0);
+    // data in the ring is read before the newer data in the stage
+    char large[2000];
+    for (int i = 0; i < (int)sizeof(large); i++) {
+        large[i] = i;
+    }
+    assert(rb.write(large, sizeof(large)));
+    assert(rb.write("xyz", 3));
+    assert(rb.stats().writeToRing == sizeof(large));
+    assert(rb.read(buf, sizeof(buf), 0) == sizeof(large));
+    assert(memcmp(buf, large, sizeof(large)) == 0);
+    assert(rb.read(buf, sizeof(buf), 0) == 3);
+    assert(memcmp(buf, "xyz", 3) == 0);
+    assert(rb.stats().stageHandover == 28);
+    assert(rb.dataSize() == 0);
+}
+void testFlushForWaitingReader()
+{
+    StagedRingBuf rb(8192, 1024);
+    char buf[100];
+    int len = 0;
+    std::thread reader([&]() { len = rb.read(buf, sizeof(buf), -1); });
+    // let the reader block. If the write comes first, the data is handed over instead
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    assert(rb.write("abc", 3));
+    reader.join();
+    assert(len == 3 && memcmp(buf, "abc", 3) == 0);
+    assert(rb.stats().stageToRing + rb.stats().stageHandover == 3);
+}
+void testProducerConsumer()
+{
+    StagedRingBuf rb(32768, 1024);
+    const long total = 20000000;
+    std::thread producer([&]() {
+        char buf[5000];
+        uint8_t val = 0;
+        long written = 0;
+        for (int i = 0; written < total; i++) {
+            int len = (i % 50 == 0) ? 3000 + i % 2000 : 1 + (i * 7) % 200;
+            len = std::min<long>(len, total - written);
+            for (int j = 0; j < len; j++) {
+                buf[j] = val++;
+            }
+            assert(rb.write(buf, len));
+            written += len;
+        }
+        assert(rb.flush());
+    });
+    char buf[5000];
+    uint8_t val = 0;
+    long nRead = 0, bad = 0;
+    for (int i = 0; nRead < total; i++) {
+        int want = (i % 30 == 0) ? 4096 : 1 + (i * 13) % 300;
+        int len = rb.read(buf, want, 1000);
+        assert(len > 0);
+        for (int j = 0; j < len; j++) {
+            if ((uint8_t)buf[j] != val++) {
+                bad++;
+            }
+        }
+        nRead += len;
+    }
+    producer.join();
+    assert(bad == 0);
+    auto& stats = rb.stats();
+    printf("writeToStage %u, writeToRing %u, stageToRing %u, ringToStage %u, ringToRead %u, "
+           "stageToRead %u, stageHandover %u\n", stats.writeToStage, stats.writeToRing,
+           stats.stageToRing, stats.ringToStage, stats.ringToRead, stats.stageToRead, stats.stageHandover);
+    assert(stats.writeToStage + stats.writeToRing == total);
+    assert(stats.writeToStage == stats.stageToRing + stats.stageHandover);
+    assert(stats.ringToRead + stats.stageToRead == total);
+}
+int main()
+{
+    testStageHandover();
+    testFlushForWaitingReader();
+    testProducerConsumer();
+    printf("OK\n");
+    return 0;
+}
@@ -1,18 +1,135 @@
 #ifndef STREAMRINGQUEUE_HPP
 #define STREAMRINGQUEUE_HPP
 
-#include "ringQueue.hpp"
-#include "waitable.hpp"
+#include "ringbuf.hpp"
 
-class StreamItem {
-    enum Type {
+/** Header of a variable-length record in a StreamRingQueue. The payload
+ * immediately follows the header, and the whole record is padded to a multiple
+ * of kAlign bytes, so that the next header is aligned as well
+ */
+struct StreamItem
+{
+    enum Type: uint8_t {
+        kPadding = 0, // fills the space till the end of the buffer, skipped by readers
         kStreamStart = 1,
-        kStreamData
+        kStreamData,
+        kStreamEnd,
+        kMetadata,
+        kUserType = 16 // first value available for application-defined types
     };
+    enum: int { kAlign = 8, kMaxDataLen = 0xffff };
+    uint8_t type;
+    uint8_t flags; // application-defined
+    uint16_t dataLen;
+    uint32_t timestamp;
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+    const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+    static int sizeFor(int dataLen) { return (sizeof(StreamItem) + dataLen + kAlign - 1) & ~(kAlign - 1); }
+    int totalSize() const { return sizeFor(dataLen); }
 };
-template<int N>
-class StreamRingQueue: public RingQueue, public Waitable {
-public:
+static_assert(sizeof(StreamItem) == StreamItem::kAlign, "StreamItem header must be exactly kAlign bytes");
 
+/** Framed ring buffer that stores records of different type in place, in the memory
+ * of a RingBuf. A record is never split at the end of the buffer - if it doesn't fit
+ * there, the remaining space is filled with a padding record and the record is
+ * placed at the start. This allows both the producer and the consumer to access
+ * whole records without copying, and without any per-item allocation.
+ * Supports one producer and one consumer at a time.
+ */
+class StreamRingQueue: protected RingBuf
+{
+public:
+    StreamRingQueue(size_t bufSize, bool useSpiRam=false)
+    : RingBuf((bufSize + StreamItem::kAlign - 1) & ~(StreamItem::kAlign - 1), useSpiRam) {}
+    using RingBuf::size;
+    using RingBuf::dataSize;
+    using RingBuf::hasData;
+    using RingBuf::clear;
+    using RingBuf::setStopSignal;
+    using RingBuf::clearStopSignal;
+    using RingBuf::mutex;
+    /** Reserves a record with space for up to \c maxLen bytes of payload, blocking until
+     * there is enough space. The payload is written directly via the data() pointer of
+     * the returned item, and the record is published with commit().
+     * @returns the record, or nullptr upon timeout, stop signal or if the record
+     * can never fit in the buffer
+     */
+    StreamItem* reserve(uint8_t type, int maxLen, uint32_t timestamp, int msTimeout=-1)
+    {
+        int total = StreamItem::sizeFor(maxLen);
+        if (maxLen > StreamItem::kMaxDataLen || total > size()) {
+            ESP_LOGE("STRMQ", "Record of size %d can't fit in buffer of size %d", maxLen, size());
+            return nullptr;
+        }
+        char* buf;
+        for (;;) {
+            int avail = getWriteBuf(buf, total, msTimeout);
+            if (avail <= 0) {
+                return nullptr;
+            }
+            if (avail >= total) {
+                break;
+            }
+            // Not enough space till the end of the buffer, and all of it is free.
+            // Fill it with a padding record and continue from the start
+            auto pad = reinterpret_cast<StreamItem*>(buf);
+            pad->type = StreamItem::kPadding;
+            pad->dataLen = avail - sizeof(StreamItem);
+            commitWrite(avail);
+        }
+        auto item = reinterpret_cast<StreamItem*>(buf);
+        item->type = type;
+        item->flags = 0;
+        item->dataLen = maxLen;
+        item->timestamp = timestamp;
+        return item;
+    }
+    /** Publishes a record obtained by reserve().
+     * @param dataLen The actual payload size, if smaller than the reserved one
+     */
+    void commit(StreamItem* item, int dataLen=-1)
+    {
+        if (dataLen >= 0) {
+            rbassert(dataLen <= item->dataLen);
+            item->dataLen = dataLen;
+        }
+        commitWrite(item->totalSize());
+    }
+    void abort() { abortWrite(); }
+    bool push(uint8_t type, const void* data, int len, uint32_t timestamp, int msTimeout=-1)
+    {
+        auto item = reserve(type, len, timestamp, msTimeout);
+        if (!item) {
+            return false;
+        }
+        memcpy(item->data(), data, len);
+        commit(item);
+        return true;
+    }
+    /** Returns the oldest record in place, blocking until one is available.
+     * The record must be released with pop() when the consumer is done with it.
+     * @returns the record or nullptr upon timeout or stop signal
+     */
+    StreamItem* peek(int msTimeout=-1)
+    {
+        for (;;) {
+            char* buf;
+            int avail = contigRead(buf, size(), msTimeout);
+            if (avail <= 0) {
+                return nullptr;
+            }
+            // records are committed as a whole, so if its header is there, the whole record is too
+            auto item = reinterpret_cast<StreamItem*>(buf);
+            rbassert(avail >= item->totalSize());
+            if (item->type != StreamItem::kPadding) {
+                return item;
+            }
+            commitContigRead(item->totalSize());
+        }
+    }
+    void pop(StreamItem* item)
+    {
+        commitContigRead(item->totalSize());
+    }
 };
 #endif // STREAMRINGQUEUE_HPP
@@ -0,0 +1,121 @@
+// Host tests of StreamRingQueue: padding at the end of the buffer, reserve/commit/abort,
+// peek/pop, and a producer/consumer run with records of varying size
+// Build: g++ -O2 -std=gnu++17 -I../hostStubs streamRingQueueTest.cpp -o streamRingQueueTest -lpthread
+#include "streamRingQueue.hpp"
+#include <thread>
+#include <assert.h>
+
+void testWrapPadding()
+{
+    StreamRingQueue q(64);
+    assert(q.size() == 64);
+    bool ok = q.push(StreamItem::kStreamStart, "0123456789abcdefghij", 20, 1); // 32 bytes
+    assert(ok);
+    ok = q.push(StreamItem::kStreamData, "0123456789abcdef", 16, 2); // 24 bytes
+    assert(ok);
+    assert(q.dataSize() == 56);
+    auto first = q.peek(0);
+    assert(first && first->type == StreamItem::kStreamStart && first->timestamp == 1);
+    assert(first->dataLen == 20 && memcmp(first->data(), "0123456789abcdefghij", 20) == 0);
+    auto bufStart = reinterpret_cast<char*>(first);
+    q.pop(first);
+    auto second = q.peek(0);
+    assert(second && second->type == StreamItem::kStreamData && second->timestamp == 2);
+    q.pop(second);
+    assert(q.dataSize() == 0);
+    // Only 8 bytes till the end of the buffer: they must be padded and the record
+    // placed at the start
+    auto item = q.reserve(StreamItem::kMetadata, 16, 3, 0);
+    assert(item && reinterpret_cast<char*>(item) == bufStart);
+    memcpy(item->data(), "fedcba9876543210", 16);
+    q.commit(item);
+    assert(q.dataSize() == 8 + 24);
+    // the padding record is skipped by peek()
+    item = q.peek(0);
+    assert(item && item->type == StreamItem::kMetadata && item->timestamp == 3);
+    assert(memcmp(item->data(), "fedcba9876543210", 16) == 0);
+    q.pop(item);
+    assert(q.dataSize() == 0 && !q.hasData());
+    item = q.peek(0);
+    assert(!item);
+}
+void testReserveCommitAbort()
+{
+    StreamRingQueue q(256);
+    // committing less than reserved releases the rest
+    auto item = q.reserve(StreamItem::kStreamData, 100, 1, 0);
+    assert(item && item->dataLen == 100 && item->flags == 0);
+    memcpy(item->data(), "abc", 3);
+    q.commit(item, 3);
+    assert(q.dataSize() == StreamItem::sizeFor(3));
+    // an aborted record is not visible, and its space is reused by the next one
+    auto aborted = q.reserve(StreamItem::kStreamData, 50, 2, 0);
+    assert(aborted);
+    q.abort();
+    assert(q.dataSize() == StreamItem::sizeFor(3));
+    auto next = q.reserve(StreamItem::kStreamEnd, 0, 3, 0);
+    assert(next == aborted);
+    q.commit(next);
+    item = q.peek(0);
+    assert(item && item->dataLen == 3 && memcmp(item->data(), "abc", 3) == 0);
+    q.pop(item);
+    item = q.peek(0);
+    assert(item && item->type == StreamItem::kStreamEnd && item->dataLen == 0 && item->timestamp == 3);
+    q.pop(item);
+    assert(!q.hasData());
+    // a record that can never fit is rejected instead of blocking forever
+    auto tooLarge = q.reserve(StreamItem::kStreamData, q.size(), 4);
+    assert(!tooLarge);
+    // full queue times out
+    while (q.push(StreamItem::kStreamData, "x", 1, 5, 0));
+    assert(q.size() - q.dataSize() < StreamItem::sizeFor(1));
+    auto timedOut = q.reserve(StreamItem::kStreamData, 1, 6, 10);
+    assert(!timedOut);
+}
+void testProducerConsumer()
+{
+    // not a multiple of kAlign, and records of varying size, so that padding
+    // is inserted at different offsets
+    StreamRingQueue q(1001);
+    assert(q.size() == 1008);
+    enum { kCount = 200000 };
+    auto lenOf = [](int i) { return (i * 37) % 300; };
+    std::thread producer([&]() {
+        for (int i = 0; i < kCount; i++) {
+            int len = lenOf(i);
+            auto item = q.reserve((i % 7) ? StreamItem::kStreamData : StreamItem::kStreamStart, len + 10, i);
+            assert(item);
+            for (int j = 0; j < len; j++) {
+                item->data()[j] = (char)(i + j);
+            }
+            q.commit(item, len);
+        }
+    });
+    long bad = 0;
+    for (int i = 0; i < kCount; i++) {
+        auto item = q.peek();
+        int len = lenOf(i);
+        if (item->timestamp != (uint32_t)i || item->dataLen != len ||
+            item->type != ((i % 7) ? StreamItem::kStreamData : StreamItem::kStreamStart)) {
+            bad++;
+        }
+        for (int j = 0; j < len; j++) {
+            if (item->data()[j] != (char)(i + j)) {
+                bad++;
+                break;
+            }
+        }
+        q.pop(item);
+    }
+    producer.join();
+    assert(bad == 0);
+    assert(!q.hasData());
+}
+int main()
+{
+    testWrapPadding();
+    testReserveCommitAbort();
+    testProducerConsumer();
+    printf("OK\n");
+    return 0;
+}
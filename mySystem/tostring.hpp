@@ -10,6 +10,7 @@
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <math.h> //for padding calculation we need log10
 
 static_assert(sizeof(size_t) == sizeof(void*), "size_t is not same size as void*");
@@ -25,6 +26,7 @@ enum: uint16_t {
     kFlagsPrecMask = 0xff,
     kLowerCase = 0x0, kUpperCase = 0x1000,
     kDontNullTerminate = 0x0200, kNumPrefix = 0x0400,
+    kShortest = 0x0800, // floating point: the precision is a maximum, use the fewest digits that round-trip
     kFlagsMaskGlobal = kDontNullTerminate
 };
 
@@ -43,6 +45,12 @@ constexpr uint8_t precFromFlags(Flags flags)
     return prec ? prec : 6;
 }
 
+/** "00" to "99", for converting two decimal digits at a time */
+inline constexpr char kDecimalDigitPairs[] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
 template <size_t base, Flags flags=0>
 struct DigitConverter;
 
@@ -103,16 +111,43 @@ toString(char* buf, size_t bufsize, Val val, uint8_t minDigits=0, uint16_t minLe
     }
     enum: uint8_t { base = baseFromFlags(flags) };
     DigitConverter<base, flags> digitConv;
+    // digits are generated backwards, from the end of the staging buffer
     char stagingBuf[digitConv.digitsPerByte * sizeof(Val)];
-    char* writePtr = stagingBuf;
-    do
+    char* const stagingEnd = stagingBuf + sizeof(stagingBuf);
+    char* digits = stagingEnd;
+    if constexpr (base == 10)
     {
-        Val digit = val % base;
-        *(writePtr++) = digitConv.toDigit(digit);
-        val /= base;
-    } while(val);
-
-    size_t numDigits = writePtr - stagingBuf;
+        // two digits per division
+        while (val >= 100)
+        {
+            const char* pair = kDecimalDigitPairs + (val % 100) * 2;
+            val /= 100;
+            digits -= 2;
+            digits[0] = pair[0];
+            digits[1] = pair[1];
+        }
+        if (val >= 10)
+        {
+            const char* pair = kDecimalDigitPairs + val * 2;
+            digits -= 2;
+            digits[0] = pair[0];
+            digits[1] = pair[1];
+        }
+        else
+        {
+            *(--digits) = '0' + val;
+        }
+    }
+    else
+    {
+        do
+        {
+            Val digit = val % base;
+            *(--digits) = digitConv.toDigit(digit);
+            val /= base;
+        } while(val);
+    }
+    size_t numDigits = stagingEnd - digits;
     size_t padLen;
     if (minDigits && (numDigits < minDigits))
     {
@@ -123,7 +158,7 @@ toString(char* buf, size_t bufsize, Val val, uint8_t minDigits=0, uint16_t minLe
         padLen = 0;
     }
     size_t totalLen;
-    if ((flags & kNumPrefix) && (digitConv.prefixLen != 0))
+    if constexpr ((flags & kNumPrefix) && (digitConv.prefixLen != 0))
     {
         totalLen = digitConv.prefixLen+padLen+numDigits;
         if (bufsize < totalLen)
@@ -153,13 +188,10 @@ toString(char* buf, size_t bufsize, Val val, uint8_t minDigits=0, uint16_t minLe
     {
         *(buf++) = '0';
     }
-    // numDigits is at least one
-    do
+    while (digits < stagingEnd)
     {
-        *(buf++) = *(--writePtr);
-        numDigits--;
-
-    } while(numDigits);
+        *(buf++) = *(digits++);
+    }
 
 
     if ((flags & kDontNullTerminate) == 0) {
@@ -364,6 +396,100 @@ template <size_t base>
 struct Pow<base, 1>
 { enum: size_t { value = base }; };
 
+/** Exact powers of 10, for the shortest floating point formatting */
+inline constexpr double kFpPow10[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+/** Finds the fewest fractional digits, up to \c maxPrec, for which the decimal
+ * number parses back to exactly \c val. A candidate is accepted if it is inside the
+ * interval of reals that round to \c val, i.e. within half an ulp. The product of the
+ * fraction and the power of 10 is exact for float and is corrected with fma() for double,
+ * and candidates too close to the interval boundary to be decided are rejected, so the
+ * result is always correct, though on rare occasions it may be a digit longer than the
+ * shortest one.
+ * If there is no such representation within \c maxPrec digits, the fraction is rounded
+ * to \c maxPrec digits. In both cases trailing zeroes are dropped.
+ * @param whole The integral part of \c val. Incremented if the fraction rounds up to 1
+ * @param fractional Receives the fractional digits as an integer
+ * @returns The number of fractional digits, can be zero
+ */
+template <uint8_t maxPrec, typename Val>
+uint8_t fpShortestFraction(Val val, size_t& whole, size_t& fractional)
+{
+    static_assert(maxPrec < sizeof(kFpPow10) / sizeof(kFpPow10[0]), "Precision too high");
+    double frac = (double)val - whole; // exact
+    uint8_t numDigits = maxPrec;
+    if (frac == 0)
+    {
+        fractional = 0;
+        return 0;
+    }
+    // half-distances to the neighbouring values, exact in double
+    static_assert(sizeof(Val) == 4 || sizeof(Val) == 8, "Unsupported floating point type");
+    typedef typename std::conditional<sizeof(Val) == 4, uint32_t, uint64_t>::type Bits;
+    Bits bits;
+    memcpy(&bits, &val, sizeof(val));
+    Val prev, next;
+    bits--;
+    memcpy(&prev, &bits, sizeof(val));
+    bits += 2;
+    memcpy(&next, &bits, sizeof(val));
+    double below = ((double)val - prev) / 2;
+    double above = ((double)next - val) / 2;
+    // whether there is a decimal with the given number of fractional digits in the interval,
+    // in which case it is the nearest one
+    auto tryPrec = [frac, below, above](uint8_t prec, uint32_t& digits)
+    {
+        double scale = kFpPow10[prec];
+        double scaled = frac * scale;
+        digits = (uint32_t)(scaled + 0.5); // < 10^9
+        double diff = (double)digits - scaled; // exact
+        if constexpr (sizeof(Val) > 4)
+        {
+            // the product may be inexact, correct the difference with the rounding error
+            diff -= fma(frac, scale, -scaled);
+        }
+        // else frac has 24 significant bits, and 10^prec is 5^prec (max 21 bits) * 2^prec,
+        // so the product fits exactly in double
+        double margin = (fabs(diff) + above * scale) * 0x1p-50;
+        return diff > margin - below * scale && diff < above * scale - margin;
+    };
+    // A decimal with n digits is also one with n+1 digits, so binary search for the fewest
+    uint32_t digits = 0;
+    uint8_t lo = 0, hi = maxPrec + 1;
+    while (lo < hi)
+    {
+        uint8_t mid = (lo + hi) / 2;
+        uint32_t candidate;
+        if (tryPrec(mid, candidate))
+        {
+            hi = numDigits = mid;
+            digits = candidate;
+        }
+        else
+        {
+            lo = mid + 1;
+        }
+    }
+    if (hi > maxPrec)
+    {
+        tryPrec(maxPrec, digits);
+    }
+    // if not found, digits is the fraction rounded to maxPrec digits
+    if (digits >= kFpPow10[numDigits])
+    {
+        whole++;
+        fractional = 0;
+        return 0;
+    }
+    fractional = digits;
+    while (numDigits && (fractional % 10 == 0))
+    {
+        fractional /= 10;
+        numDigits--;
+    }
+    return numDigits;
+}
+
 template<Flags flags=6, typename Val>
 typename std::enable_if<std::is_floating_point<Val>::value, char*>::type
 toString(char* buf, size_t bufsize, Val val, uint8_t minDigits=0, uint8_t minLen=0)
@@ -395,11 +521,20 @@ toString(char* buf, size_t bufsize, Val val, uint8_t minDigits=0, uint8_t minLen
             return nullptr;
         }
     }
+    const char* special = nullptr;
     if (std::numeric_limits<Val>::has_infinity && (val == std::numeric_limits<Val>::infinity()))
     {
-        *(buf++) = 'i';
-        *(buf++) = 'n';
-        *(buf++) = 'f';
+        special = "inf";
+    }
+    else if (val != val)
+    {
+        special = "nan";
+    }
+    if (special)
+    {
+        *(buf++) = special[0];
+        *(buf++) = special[1];
+        *(buf++) = special[2];
         if (!(flags & kDontNullTerminate))
         {
             *buf = 0;
@@ -407,21 +542,29 @@ toString(char* buf, size_t bufsize, Val val, uint8_t minDigits=0, uint8_t minLen
         return buf;
     }
 
-
     size_t whole = (size_t)(val);
-
-    // value to multiply the fractional part so that it becomes an int
-    enum: uint32_t { mult = Pow<10, prec>::value };
-    size_t fractional = (val - whole) * mult + 0.5;
-    if (fractional >= mult) //the part after the dot overflows to >= 1 due to rounding
+    size_t fractional;
+    uint8_t fracDigits;
+    if constexpr (flags & kShortest)
     {
-        //move the overflowed unit to the whole part and subtract it from
-        //the decimal
-        whole++;
-        fractional -= mult;
+        fracDigits = fpShortestFraction<prec>(val, whole, fractional);
+    }
+    else
+    {
+        // value to multiply the fractional part so that it becomes an int
+        enum: uint32_t { mult = Pow<10, prec>::value };
+        fracDigits = prec;
+        fractional = (val - whole) * mult + 0.5;
+        if (fractional >= mult) //the part after the dot overflows to >= 1 due to rounding
+        {
+            //move the overflowed unit to the whole part and subtract it from
+            //the decimal
+            whole++;
+            fractional -= mult;
+        }
     }
-    if (minLen > prec) {
-        minLen -= (prec + 1);
+    if (fracDigits && minLen > fracDigits) {
+        minLen -= (fracDigits + 1);
     }
     //we have some minimum space for null termination even if buffer is not enough
     auto originalBuf = buf;
@@ -431,14 +574,26 @@ toString(char* buf, size_t bufsize, Val val, uint8_t minDigits=0, uint8_t minLen
         assert(*originalBuf == 0); //assert null termination
         return nullptr;
     }
-    assert(buf < bufRealEnd);
+    if (!fracDigits) // only with kShortest
+    {
+        if (buf > bufend)
+        {
+            *originalBuf = 0;
+            return nullptr;
+        }
+        if ((flags & kDontNullTerminate) == 0)
+        {
+            *buf = 0;
+        }
+        return buf;
+    }
     if (bufend-buf < 2) //must have space at least for '.0' and optional null terminator
     {
         *originalBuf = 0;
         return nullptr;
     }
     *(buf++) = '.';
-    return toString<globalFlags(flags)|10>(buf, bufRealEnd-buf, fractional, prec);
+    return toString<globalFlags(flags)|10>(buf, bufRealEnd-buf, fractional, fracDigits);
 }
 
 template <class T, Flags aFlags>
@@ -456,7 +611,11 @@ struct FpFmt
  * Specifies that a number must be formatted as floating point
  * @param aFlags - the formatting flags, where the low 8 bits specify the floating
  * point precision, i.e. the minimum number of digits after the decimal point.
- * If the actual digits are fewer, then zeroes are appended
+ * If the actual digits are fewer, then zeroes are appended. With \c kShortest,
+ * the precision is the maximum number of digits after the decimal point, and only
+ * as many are output as needed for the string to parse back to the same value -
+ * i.e. 0.1f is formatted as "0.1" rather than "0.100000". An integral value is
+ * output without a decimal point
  * @param minDigits - the minimum number of digits for the whole part of the number
  * (before the decimal point). If the actual digits are fewer, zeroes are prepended
  * to the whole part of the number.
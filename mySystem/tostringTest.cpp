@@ -0,0 +1,385 @@
+// Host tests and benchmarks of the toString() number formatting, against snprintf
+// and the previous implementation, which is kept below as a reference
+// Build: g++ -O2 -std=gnu++17 tostringTest.cpp -o tostringTest
+#include "tostring.hpp"
+#include <chrono>
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace ref {
+template<Flags flags=10, typename Val>
+typename std::enable_if<std::is_unsigned<Val>::value
+                     && std::is_integral<Val>::value
+                     && !std::is_same<Val, char>::value, char*>::type
+toString(char* buf, size_t bufsize, Val val, uint8_t minDigits=0, uint16_t minLen=0)
+{
+    assert(buf);
+    assert(bufsize);
+
+    if ((flags & kDontNullTerminate) == 0) {
+        bufsize--;
+    }
+    if (bufsize < minLen) {
+        *buf = 0;
+        return nullptr;
+    }
+    enum: uint8_t { base = baseFromFlags(flags) };
+    DigitConverter<base, flags> digitConv;
+    char stagingBuf[digitConv.digitsPerByte * sizeof(Val)];
+    char* writePtr = stagingBuf;
+    do
+    {
+        Val digit = val % base;
+        *(writePtr++) = digitConv.toDigit(digit);
+        val /= base;
+    } while(val);
+
+    size_t numDigits = writePtr - stagingBuf;
+    size_t padLen;
+    if (minDigits && (numDigits < minDigits))
+    {
+        padLen = minDigits - numDigits;
+    }
+    else
+    {
+        padLen = 0;
+    }
+    size_t totalLen;
+    if ((flags & kNumPrefix) && (digitConv.prefixLen != 0))
+    {
+        totalLen = digitConv.prefixLen+padLen+numDigits;
+        if (bufsize < totalLen)
+        {
+            *buf = 0;
+            return nullptr;
+        }
+        buf = digitConv.putPrefix(buf);
+    }
+    else
+    {
+        totalLen = padLen + numDigits;
+        if (bufsize < totalLen)
+        {
+            *buf = 0;
+            return nullptr;
+        }
+    }
+
+    while (totalLen < minLen)
+    {
+        *(buf++) = ' ';
+        totalLen++;
+    }
+
+    for(;padLen; padLen--)
+    {
+        *(buf++) = '0';
+    }
+    // numDigits is at least one
+    do
+    {
+        *(buf++) = *(--writePtr);
+        numDigits--;
+
+    } while(numDigits);
+
+
+    if ((flags & kDontNullTerminate) == 0) {
+        *buf = 0;
+    }
+    return buf;
+}
+
+template<Flags flags=6, typename Val>
+typename std::enable_if<std::is_floating_point<Val>::value, char*>::type
+toString(char* buf, size_t bufsize, Val val, uint8_t minDigits=0, uint8_t minLen=0)
+{
+    enum: uint8_t { prec = precFromFlags(flags) };
+    if (!bufsize) {
+        return nullptr;
+    }
+    char* bufRealEnd = buf+bufsize;
+    if ((flags & kDontNullTerminate) == 0)
+        bufsize--;
+
+    char* bufend = buf+bufsize;
+    if (val < 0)
+    {
+        if (bufsize < 4) //at least '-0.0'
+        {
+            *buf = 0;
+            return nullptr;
+        }
+        *(buf++) = '-';
+        val = -val;
+    }
+    else
+    {
+        if (bufsize < 3)
+        {
+            *buf = 0;
+            return nullptr;
+        }
+    }
+    if (std::numeric_limits<Val>::has_infinity && (val == std::numeric_limits<Val>::infinity()))
+    {
+        *(buf++) = 'i';
+        *(buf++) = 'n';
+        *(buf++) = 'f';
+        if (!(flags & kDontNullTerminate))
+        {
+            *buf = 0;
+        }
+        return buf;
+    }
+
+
+    size_t whole = (size_t)(val);
+
+    // value to multiply the fractional part so that it becomes an int
+    enum: uint32_t { mult = Pow<10, prec>::value };
+    size_t fractional = (val - whole) * mult + 0.5;
+    if (fractional >= mult) //the part after the dot overflows to >= 1 due to rounding
+    {
+        //move the overflowed unit to the whole part and subtract it from
+        //the decimal
+        whole++;
+        fractional -= mult;
+    }
+    if (minLen > prec) {
+        minLen -= (prec + 1);
+    }
+    //we have some minimum space for null termination even if buffer is not enough
+    auto originalBuf = buf;
+    buf = toString<kDontNullTerminate|10>(buf, bufRealEnd-buf, whole, minDigits, minLen);
+    if (!buf)
+    {
+        assert(*originalBuf == 0); //assert null termination
+        return nullptr;
+    }
+    if (bufend-buf < 2) //must have space at least for '.0' and optional null terminator
+    {
+        *originalBuf = 0;
+        return nullptr;
+    }
+    *(buf++) = '.';
+    return toString<globalFlags(flags)|10>(buf, bufRealEnd-buf, fractional, prec);
+}
+
+}
+
+static uint64_t gRandState = 12345;
+uint32_t rnd()
+{
+    gRandState = gRandState * 6364136223846793005ull + 1442695040888963407ull;
+    return gRandState >> 32;
+}
+// random value with a random number of significant bits, to cover all digit counts
+template <typename T>
+T rndVal()
+{
+    uint64_t val = ((uint64_t)rnd() << 32) | rnd();
+    int bits = rnd() % (sizeof(T) * 8 + 1);
+    return bits ? (T)(val >> (64 - bits)) : 0;
+}
+float rndFloat(float maxVal)
+{
+    float val = ldexpf((float)rnd() / 4294967296.0f, -(int)(rnd() % 24));
+    return val * maxVal;
+}
+
+template <class F>
+double benchNs(int numIter, F&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numIter; i++) {
+        func(i);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / (double)numIter;
+}
+
+template <Flags flags, typename T>
+void checkInt(T val)
+{
+    char buf1[80], buf2[80];
+    uint8_t minDigits = (rnd() % 2) ? rnd() % 24 : 0;
+    uint16_t minLen = (rnd() % 2) ? rnd() % 40 : 0;
+    size_t bufsize = (rnd() % 4) ? sizeof(buf1) : 1 + rnd() % 30;
+    memset(buf1, 'x', sizeof(buf1));
+    memset(buf2, 'x', sizeof(buf2));
+    auto end1 = toString<flags>(buf1, bufsize, val, minDigits, minLen);
+    auto end2 = ref::toString<flags>(buf2, bufsize, val, minDigits, minLen);
+    assert((end1 ? end1 - buf1 : -1) == (end2 ? end2 - buf2 : -1));
+    assert(memcmp(buf1, buf2, end1 ? end1 - buf1 + 1 : 1) == 0);
+}
+
+template <typename T>
+void checkIntType()
+{
+    for (int i = 0; i < 200000; i++) {
+        T val = rndVal<T>();
+        checkInt<10>(val);
+        checkInt<16|kNumPrefix|kUpperCase>(val);
+        checkInt<16|kDontNullTerminate>(val);
+        checkInt<2|kNumPrefix>(val);
+        checkInt<8>(val);
+    }
+}
+
+void testIntEquivalence()
+{
+    checkIntType<uint8_t>();
+    checkIntType<uint16_t>();
+    checkIntType<uint32_t>();
+    checkIntType<uint64_t>();
+    char buf[32];
+    toString(buf, sizeof(buf), -1234567);
+    assert(strcmp(buf, "-1234567") == 0);
+    toString(buf, sizeof(buf), std::numeric_limits<int64_t>::min());
+    assert(strcmp(buf, "-9223372036854775808") == 0);
+}
+
+template <Flags flags, typename T>
+void checkFixedFp(T val)
+{
+    char buf1[64], buf2[64];
+    uint8_t minDigits = (rnd() % 2) ? rnd() % 12 : 0;
+    uint8_t minLen = (rnd() % 2) ? rnd() % 30 : 0;
+    size_t bufsize = (rnd() % 4) ? sizeof(buf1) : 1 + rnd() % 24;
+    auto end1 = toString<flags>(buf1, bufsize, val, minDigits, minLen);
+    auto end2 = ref::toString<flags>(buf2, bufsize, val, minDigits, minLen);
+    assert((end1 ? end1 - buf1 : -1) == (end2 ? end2 - buf2 : -1));
+    assert(!end1 || strcmp(buf1, buf2) == 0);
+}
+
+void testFixedFpEquivalence()
+{
+    for (int i = 0; i < 300000; i++) {
+        float val = rndFloat(1e6) * ((rnd() % 2) ? 1 : -1);
+        checkFixedFp<1>(val);
+        checkFixedFp<3>(val);
+        checkFixedFp<6>(val);
+        checkFixedFp<9>((double)val);
+    }
+}
+
+// the fewest fraction digits with which snprintf's output parses back to val
+int minRoundTripDigits(float val)
+{
+    char buf[64];
+    for (int prec = 0; prec <= 9; prec++) {
+        snprintf(buf, sizeof(buf), "%.*f", prec, val);
+        if (strtof(buf, nullptr) == val) {
+            return prec;
+        }
+    }
+    return -1;
+}
+
+template <Flags flags, typename T>
+const char* fmtShortest(T val)
+{
+    static char buf[64];
+    auto end = toString<kShortest|flags>(buf, sizeof(buf), val);
+    assert(end);
+    return buf;
+}
+
+void testShortest()
+{
+    assert(strcmp(fmtShortest<6>(0.1f), "0.1") == 0);
+    assert(strcmp(fmtShortest<6>(0.1), "0.1") == 0);
+    assert(strcmp(fmtShortest<9>(1.1f), "1.1") == 0);
+    assert(strcmp(fmtShortest<9>(-2.5f), "-2.5") == 0);
+    assert(strcmp(fmtShortest<6>(0.0f), "0") == 0);
+    assert(strcmp(fmtShortest<6>(100.0f), "100") == 0);
+    assert(strcmp(fmtShortest<3>(0.9999f), "1") == 0);
+    assert(strcmp(fmtShortest<3>(1.0f/3), "0.333") == 0);
+    assert(strcmp(fmtShortest<6>(NAN), "nan") == 0);
+    assert(strcmp(fmtShortest<6>(-INFINITY), "-inf") == 0);
+    char buf[8];
+    assert(toString<kShortest|6>(buf, 4, 123.0f) && strcmp(buf, "123") == 0);
+    assert(!toString<kShortest|6>(buf, 3, 123.0f) && buf[0] == 0);
+    assert(toString<kShortest|6>(buf, sizeof(buf), 1.5f, 0, 6) && strcmp(buf, "   1.5") == 0);
+
+    int longer = 0, total = 0;
+    for (int i = 0; i < 1000000; i++) {
+        float val = rndFloat(1e7);
+        const char* str = fmtShortest<9>(val);
+        int minDigits = minRoundTripDigits(val);
+        if (minDigits < 0) {
+            continue; // too small for 9 digits after the point
+        }
+        total++;
+        assert(strtof(str, nullptr) == val);
+        const char* dot = strchr(str, '.');
+        int digits = dot ? strlen(dot + 1) : 0;
+        assert(digits >= minDigits);
+        if (digits > minDigits) {
+            longer++;
+        }
+    }
+    // doubles round-trip if the precision allows, otherwise are rounded
+    for (int i = 0; i < 300000; i++) {
+        double val = (double)rnd() / (1 << (rnd() % 31)) + rnd() / 4294967296.0;
+        const char* str = fmtShortest<9>(val);
+        char ref[64];
+        snprintf(ref, sizeof(ref), "%.9f", val);
+        if (strtod(str, nullptr) != val) {
+            assert(strtod(str, nullptr) == strtod(ref, nullptr));
+        }
+    }
+    printf("shortest floats: %d of %d longer than the shortest round-trip\n", longer, total);
+}
+
+enum { kNumVals = 4096 };
+uint32_t gInts[kNumVals];
+uint32_t gFullInts[kNumVals];
+float gFloats[kNumVals];
+volatile size_t gSink;
+
+void bench()
+{
+    for (int i = 0; i < kNumVals; i++) {
+        gInts[i] = rndVal<uint32_t>();
+        gFullInts[i] = rnd();
+        gFloats[i] = rndFloat(1e5);
+    }
+    enum { kIter = 2000000 };
+    char buf[64];
+    auto report = [](const char* name, double snp, double old, double cur) {
+        printf("%-16s snprintf %5.1f ns, previous %5.1f ns, current %5.1f ns\n", name, snp, old, cur);
+    };
+    report("uint32",
+        benchNs(kIter, [&](int i) { gSink += snprintf(buf, sizeof(buf), "%u", gInts[i % kNumVals]); }),
+        benchNs(kIter, [&](int i) { gSink += ref::toString(buf, sizeof(buf), gInts[i % kNumVals]) - buf; }),
+        benchNs(kIter, [&](int i) { gSink += toString(buf, sizeof(buf), gInts[i % kNumVals]) - buf; }));
+    report("uint32 full",
+        benchNs(kIter, [&](int i) { gSink += snprintf(buf, sizeof(buf), "%u", gFullInts[i % kNumVals]); }),
+        benchNs(kIter, [&](int i) { gSink += ref::toString(buf, sizeof(buf), gFullInts[i % kNumVals]) - buf; }),
+        benchNs(kIter, [&](int i) { gSink += toString(buf, sizeof(buf), gFullInts[i % kNumVals]) - buf; }));
+    report("uint32 hex",
+        benchNs(kIter, [&](int i) { gSink += snprintf(buf, sizeof(buf), "%08x", gInts[i % kNumVals]); }),
+        benchNs(kIter, [&](int i) { gSink += ref::toString<16>(buf, sizeof(buf), gInts[i % kNumVals], 8) - buf; }),
+        benchNs(kIter, [&](int i) { gSink += toString<16>(buf, sizeof(buf), gInts[i % kNumVals], 8) - buf; }));
+    report("float %.6f",
+        benchNs(kIter, [&](int i) { gSink += snprintf(buf, sizeof(buf), "%.6f", gFloats[i % kNumVals]); }),
+        benchNs(kIter, [&](int i) { gSink += ref::toString(buf, sizeof(buf), gFloats[i % kNumVals]) - buf; }),
+        benchNs(kIter, [&](int i) { gSink += toString(buf, sizeof(buf), gFloats[i % kNumVals]) - buf; }));
+    report("float shortest",
+        benchNs(kIter, [&](int i) { gSink += snprintf(buf, sizeof(buf), "%.9g", gFloats[i % kNumVals]); }),
+        benchNs(kIter, [&](int i) { gSink += ref::toString<9>(buf, sizeof(buf), gFloats[i % kNumVals]) - buf; }),
+        benchNs(kIter, [&](int i) { gSink += toString<kShortest|9>(buf, sizeof(buf), gFloats[i % kNumVals]) - buf; }));
+}
+
+int main()
+{
+    testIntEquivalence();
+    testFixedFpEquivalence();
+    testShortest();
+    bench();
+    return 0;
+}
@@ -4,10 +4,71 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <sstream>
+#include <algorithm>
+#include <limits>
 
 const char* _utils_hexDigits = "0123456789abcdef";
+const uint8_t _utils_hexDigitVals[256] = {
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+};
 
-char* binToHex(const uint8_t* data, size_t len, char* str, char delim)
+// The word-at-a-time (SWAR) routines below load and store words in native byte order,
+// and assume a little-endian CPU, as both ESP32 and the host are. On big-endian,
+// they fall back to the scalar versions
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+    #define UTILS_PARSE_SWAR 1
+#endif
+
+typedef size_t SwarWord; // native register size - 4 bytes on ESP32, 8 on 64-bit hosts
+static constexpr SwarWord swarOnes() { return (SwarWord)-1 / 0xff; } // 0x0101...01
+static constexpr SwarWord swarBytes(uint8_t val) { return swarOnes() * val; }
+// high bit of each byte set where the byte is zero. Bits above the first zero byte may be bogus
+static inline SwarWord swarZeroBytes(SwarWord x)
+{
+    return (x - swarOnes()) & ~x & swarBytes(0x80);
+}
+static inline SwarWord swarLoad(const void* ptr)
+{
+    SwarWord word;
+    memcpy(&word, ptr, sizeof(word));
+    return word;
+}
+// Returns a pointer to the first occurrence of ch in [str, end), or end
+static const char* swarFind(const char* str, const char* end, char ch)
+{
+#ifdef UTILS_PARSE_SWAR
+    SwarWord pattern = swarBytes(ch);
+    for (; end - str >= (ptrdiff_t)sizeof(SwarWord); str += sizeof(SwarWord)) {
+        SwarWord found = swarZeroBytes(swarLoad(str) ^ pattern);
+        if (found) {
+            return str + (__builtin_ctzl(found) >> 3);
+        }
+    }
+#endif
+    for (; str < end; str++) {
+        if (*str == ch) {
+            break;
+        }
+    }
+    return str;
+}
+
+char* binToHexScalar(const uint8_t* data, size_t len, char* str, char delim)
 {
     auto end = data + len;
     if (delim) {
@@ -27,14 +88,68 @@ char* binToHex(const uint8_t* data, size_t len, char* str, char delim)
     *str = 0;
     return str;
 }
-bool hexToBin(const char* hex, size_t hexLen, uint8_t* bin, size_t binLen) {
+#ifdef UTILS_PARSE_SWAR
+// Converts 4 bytes to 8 hex digits, returned in a 64-bit word in memory order
+static inline uint64_t swarBinToHex4(const uint8_t* data)
+{
+    uint32_t in;
+    memcpy(&in, data, 4);
+    // spread the 4 bytes to the low byte of each 16-bit lane
+    uint64_t x = in;
+    x = (x | (x << 16)) & 0x0000ffff0000ffffull;
+    x = (x | (x << 8)) & 0x00ff00ff00ff00ffull;
+    // high nibble goes first, i.e. to the lower address
+    uint64_t nibbles = ((x >> 4) & 0x000f000f000f000full) | ((x & 0x000f000f000f000full) << 8);
+    // nibble + 6 has bit 4 set iff nibble >= 10
+    uint64_t isLetter = ((nibbles + 0x0606060606060606ull) >> 4) & 0x0101010101010101ull;
+    return nibbles + 0x3030303030303030ull + isLetter * ('a' - '0' - 10);
+}
+// The two hex digits of each byte value, in memory order
+struct HexPairTable
+{
+    uint16_t pairs[256];
+    constexpr HexPairTable(): pairs()
+    {
+        const char digits[] = "0123456789abcdef";
+        for (int i = 0; i < 256; i++) {
+            pairs[i] = (uint8_t)digits[i >> 4] | ((uint8_t)digits[i & 0x0f] << 8);
+        }
+    }
+};
+static constexpr HexPairTable kHexPairs;
+#endif
+char* binToHex(const uint8_t* data, size_t len, char* str, char delim)
+{
+#ifdef UTILS_PARSE_SWAR
+    if (!delim) {
+        // 4 input bytes -> 8 hex digits per step
+        auto end4 = data + (len & ~3);
+        for (; data < end4; data += 4, str += 8) {
+            uint64_t out = swarBinToHex4(data);
+            memcpy(str, &out, 8);
+        }
+        len &= 3;
+    } else {
+        // The digit pair and the delimiter are written with one 32-bit store per byte.
+        // Its 4th byte is overwritten by the next store, or by the null terminator
+        uint32_t delimBits = (uint32_t)(uint8_t)delim << 16;
+        for (auto end = data + len; data < end; data++, str += 3) {
+            uint32_t out = kHexPairs.pairs[*data] | delimBits;
+            memcpy(str, &out, 4);
+        }
+        len = 0;
+    }
+#endif
+    return binToHexScalar(data, len, str, delim);
+}
+bool hexToBinScalar(const char* hex, size_t hexLen, uint8_t* bin, size_t binLen) {
     if (hexLen != binLen * 2) {
         return false;
     }
     const char* psym = hex;
-    for (int i = 0; i < binLen; i++) {
-        uint8_t hi = hexDigitVal(*(psym++));
-        uint8_t low = hexDigitVal(*(psym++));
+    for (size_t i = 0; i < binLen; i++) {
+        uint8_t hi = hexDigitValScalar(*(psym++));
+        uint8_t low = hexDigitValScalar(*(psym++));
         if (hi > 0x0f || low > 0x0f) {
             return false;
         }
@@ -42,7 +157,41 @@ bool hexToBin(const char* hex, size_t hexLen, uint8_t* bin, size_t binLen) {
     }
     return true;
 }
-uint8_t hexDigitVal(char digit) {
+bool hexToBin(const char* hex, size_t hexLen, uint8_t* bin, size_t binLen) {
+    if (hexLen != binLen * 2) {
+        return false;
+    }
+#ifdef UTILS_PARSE_SWAR
+    // 8 hex digits -> 4 bytes per step, in a 64-bit word
+    const char* end8 = hex + (hexLen & ~7);
+    for (; hex < end8; hex += 8, bin += 4) {
+        uint64_t x;
+        memcpy(&x, hex, 8);
+        if (x & 0x8080808080808080ull) {
+            return false;
+        }
+        // bit 7 of each byte is set if byte >= bound. No carries between bytes, as all are < 0x80
+        auto ge = [](uint64_t x, uint8_t bound) { return x + 0x0101010101010101ull * (0x80 - bound); };
+        uint64_t isDigit = ge(x, '0') & ~ge(x, '9' + 1);
+        x |= 0x2020202020202020ull; // to lowercase, digits are not affected
+        uint64_t isLetter = ge(x, 'a') & ~ge(x, 'f' + 1);
+        if (((isDigit | isLetter) & 0x8080808080808080ull) != 0x8080808080808080ull) {
+            return false;
+        }
+        uint64_t nibbles = (x & 0x0f0f0f0f0f0f0f0full) + ((isLetter >> 7) & 0x0101010101010101ull) * 9;
+        // first digit of each pair is the high nibble
+        uint64_t bytes = ((nibbles & 0x00ff00ff00ff00ffull) << 4) | ((nibbles >> 8) & 0x00ff00ff00ff00ffull);
+        bytes = (bytes | (bytes >> 8)) & 0x0000ffff0000ffffull;
+        bytes = (bytes | (bytes >> 16)) & 0x00000000ffffffffull;
+        uint32_t out = bytes;
+        memcpy(bin, &out, 4);
+    }
+    hexLen &= 7;
+    binLen = hexLen / 2;
+#endif
+    return hexToBinScalar(hex, hexLen, bin, binLen);
+}
+uint8_t hexDigitValScalar(char digit) {
     if (digit >= '0' && digit <= '9') {
         return digit - '0';
     } else if (digit >= 'a' && digit <= 'f') {
@@ -70,47 +219,328 @@ std::string binToAscii(char* buf, int len, int lineLen)
     return result.str();
 }
 
-bool unescapeUrlParam(char* str, size_t len)
+bool unescapeUrlParamScalar(char* str, size_t len)
 {
     const char* rptr = str;
     char* wptr = str;
     const char* end = str + len;
     bool ok = true;
-    for (; rptr < end; rptr++, wptr++) {
-        char ch = *rptr;
+    while (rptr < end) {
+        char ch = *(rptr++);
         if (ch != '%') {
-            if (rptr != wptr) {
-                *wptr = ch;
-            }
+            *(wptr++) = ch;
+            continue;
+        }
+        if (end - rptr < 2) { // truncated escape
+            *(wptr++) = '?';
+            ok = false;
+            break;
+        }
+        auto highNibble = hexDigitValScalar(*(rptr++));
+        auto lowNibble = hexDigitValScalar(*(rptr++));
+        if (highNibble > 15 || lowNibble > 15) {
+            *(wptr++) = '?';
+            ok = false;
         } else {
-            rptr++;
-            auto highNibble = hexDigitVal(*(rptr++));
-            auto lowNibble = hexDigitVal(*rptr);
-            if (highNibble > 15 || lowNibble > 15) {
-                *wptr = '?';
-                ok = false;
-            }
-            *wptr = (highNibble << 4) | lowNibble;
+            *(wptr++) = (highNibble << 4) | lowNibble;
         }
     }
-    if (wptr < rptr) {
+    if (wptr < end) {
         *wptr = 0;
     }
     return ok;
 }
+bool unescapeUrlParam(char* str, size_t len)
+{
+    const char* end = str + len;
+    // fast path - nothing has to be moved till the first escape
+    const char* rptr = swarFind(str, end, '%');
+    char* wptr = (char*)rptr;
+    bool ok = true;
+    while (rptr < end) {
+        // rptr points to a '%'
+        if (end - rptr < 3) { // truncated escape
+            *(wptr++) = '?';
+            ok = false;
+            break;
+        }
+        auto highNibble = hexDigitVal(rptr[1]);
+        auto lowNibble = hexDigitVal(rptr[2]);
+        if (highNibble > 15 || lowNibble > 15) {
+            *(wptr++) = '?';
+            ok = false;
+        } else {
+            *(wptr++) = (highNibble << 4) | lowNibble;
+        }
+        rptr += 3;
+        // move the run of plain characters till the next escape
+        auto next = swarFind(rptr, end, '%');
+        memmove(wptr, rptr, next - rptr);
+        wptr += next - rptr;
+        rptr = next;
+    }
+    if (wptr < end) {
+        *wptr = 0;
+    }
+    return ok;
+}
+
+// Length-bounded number parsing. The syntax is that of strtol()/strtof(), and in the
+// common cases the input is parsed directly, without null-terminating a copy for libc
+static inline bool isSpaceChar(char ch)
+{
+    return ch == ' ' || (ch >= '\t' && ch <= '\r');
+}
+// value of a digit in bases up to 36, or 0xff
+static inline uint8_t digitValBase36(char ch)
+{
+    if (ch >= '0' && ch <= '9') {
+        return ch - '0';
+    }
+    ch |= 0x20; // to lower case
+    return (ch >= 'a' && ch <= 'z') ? ch - 'a' + 10 : 0xff;
+}
+#ifdef UTILS_PARSE_SWAR
+static inline bool swarIs8Digits(uint64_t word)
+{
+    // high nibbles must be 3, and adding 6 must not carry out of the low nibbles
+    return ((word & 0xf0f0f0f0f0f0f0f0ull) |
+           (((word + 0x0606060606060606ull) & 0xf0f0f0f0f0f0f0f0ull) >> 4)) == 0x3333333333333333ull;
+}
+// The first char is the most significant digit, and is in the lowest byte
+static inline uint32_t swarParse8Digits(uint64_t word)
+{
+    word -= 0x3030303030303030ull;
+    word = (word * 10) + (word >> 8); // pairs of digits, in every other byte
+    const uint64_t mask = 0x000000ff000000ffull;
+    word = (((word & mask) * (100 + (1000000ull << 32))) +
+            (((word >> 16) & mask) * (1 + (10000ull << 32)))) >> 32;
+    return word;
+}
+static inline bool swarIs4Digits(uint32_t word)
+{
+    return ((word & 0xf0f0f0f0) | (((word + 0x06060606) & 0xf0f0f0f0) >> 4)) == 0x33333333;
+}
+static inline uint32_t swarParse4Digits(uint32_t word)
+{
+    word -= 0x30303030;
+    word = (word * 10) + (word >> 8);
+    return (((word & 0x00ff00ff) * (1 + (100 << 16))) >> 16) & 0xffff;
+}
+#endif
+// Appends a run of decimal digits to \c val, 8 or 4 at a time where possible. \c val
+// wraps around if there are more than 19 digits, which callers must check
+// @returns the number of digits
+static inline size_t parseDecimalDigits(const char*& str, const char* end, uint64_t& val)
+{
+    auto start = str;
+#ifdef UTILS_PARSE_SWAR
+    while (end - str >= 8) {
+        uint64_t word;
+        memcpy(&word, str, 8);
+        if (!swarIs8Digits(word)) {
+            break;
+        }
+        val = val * 100000000 + swarParse8Digits(word);
+        str += 8;
+    }
+    if (end - str >= 4) {
+        uint32_t word;
+        memcpy(&word, str, 4);
+        if (swarIs4Digits(word)) {
+            val = val * 10000 + swarParse4Digits(word);
+            str += 4;
+        }
+    }
+#endif
+    for (; str < end; str++) {
+        uint8_t digit = *str - '0';
+        if (digit > 9) {
+            break;
+        }
+        val = val * 10 + digit;
+    }
+    return str - start;
+}
+
+bool strToIntChecked(const char* str, size_t len, long& result, int base, size_t* errPos)
+{
+    auto end = str + len;
+    auto ptr = str;
+    auto fail = [str, errPos](const char* pos) {
+        if (errPos) {
+            *errPos = pos - str;
+        }
+        return false;
+    };
+    if (base < 0 || base == 1 || base > 36) {
+        return fail(str);
+    }
+    while (ptr < end && isSpaceChar(*ptr)) {
+        ptr++;
+    }
+    bool neg = false;
+    if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+        neg = (*ptr == '-');
+        ptr++;
+    }
+    if ((base == 0 || base == 16) && (end - ptr >= 2) && ptr[0] == '0' && (ptr[1] | 0x20) == 'x') {
+        if (end - ptr == 2 || digitValBase36(ptr[2]) >= 16) { // just a zero followed by 'x'
+            result = 0;
+            return fail(ptr + 1);
+        }
+        ptr += 2;
+        base = 16;
+    } else if (base == 0) {
+        base = (ptr < end && *ptr == '0') ? 8 : 10;
+    }
+    // magnitude limit, LONG_MIN has one more than LONG_MAX
+    unsigned long limit = (unsigned long)std::numeric_limits<long>::max() + neg;
+    unsigned long val = 0;
+    bool overflow = false;
+    auto digitsStart = ptr;
+    if (base == 10) {
+        while (ptr < end && *ptr == '0') {
+            ptr++;
+        }
+        uint64_t val64 = 0;
+        size_t numDigits = parseDecimalDigits(ptr, end, val64);
+        if (numDigits > 19 || val64 > limit) {
+            overflow = true;
+        } else {
+            val = val64;
+        }
+    } else {
+        for (; ptr < end; ptr++) {
+            uint8_t digit = digitValBase36(*ptr);
+            if (digit >= base) {
+                break;
+            }
+            if (val > (limit - digit) / base) {
+                overflow = true;
+            } else {
+                val = val * base + digit;
+            }
+        }
+    }
+    if (ptr == digitsStart) {
+        return fail(str); // no digits
+    }
+    if (overflow) { // saturate, as strtol does
+        val = limit;
+    }
+    result = neg ? (long)(0 - val) : (long)val;
+    if (ptr != end) {
+        return fail(ptr);
+    }
+    if (errPos) {
+        *errPos = len;
+    }
+    return true;
+}
+
+// powers of 10 that are exact in float
+static const float kPow10Float[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10 };
+
+// Parses [digits][.digits][e[sign]digits], when the result can be computed exactly:
+// Mantissa that fits in the float significand and power of 10 that is exact in float.
+// Then a single float multiplication or division gives the correctly rounded result.
+// @returns false if the input is not a simple decimal or the fast path is not exact
+static bool strToFloatFast(const char* ptr, const char* end, float& result)
+{
+    bool neg = false;
+    if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+        neg = (*ptr == '-');
+        ptr++;
+    }
+    uint64_t mantissa = 0;
+    size_t numDigits = parseDecimalDigits(ptr, end, mantissa);
+    int exp = 0;
+    if (ptr < end && *ptr == '.') {
+        ptr++;
+        size_t numFrac = parseDecimalDigits(ptr, end, mantissa);
+        numDigits += numFrac;
+        exp = -(int)numFrac;
+    }
+    if (!numDigits || numDigits > 19) {
+        return false;
+    }
+    if (ptr < end && (*ptr | 0x20) == 'e') {
+        ptr++;
+        bool expNeg = false;
+        if (ptr < end && (*ptr == '-' || *ptr == '+')) {
+            expNeg = (*ptr == '-');
+            ptr++;
+        }
+        uint64_t expVal = 0;
+        size_t numExpDigits = parseDecimalDigits(ptr, end, expVal);
+        if (!numExpDigits || numExpDigits > 3) {
+            return false;
+        }
+        exp += expNeg ? -(int)expVal : (int)expVal;
+    }
+    if (ptr != end || mantissa > (1 << 24)) {
+        return false;
+    }
+    float val = mantissa;
+    if (exp < 0) {
+        if (exp < -10) {
+            return false;
+        }
+        val /= kPow10Float[-exp];
+    } else if (exp > 0) {
+        if (exp > 10) {
+            return false;
+        }
+        val *= kPow10Float[exp];
+    }
+    result = neg ? -val : val;
+    return true;
+}
+
+bool strToFloatChecked(const char* str, size_t len, float& result, size_t* errPos)
+{
+    auto end = str + len;
+    auto ptr = str;
+    while (ptr < end && isSpaceChar(*ptr)) {
+        ptr++;
+    }
+    if (strToFloatFast(ptr, end, result)) {
+        if (errPos) {
+            *errPos = len;
+        }
+        return true;
+    }
+    // Anything else - many digits, large exponents, inf/nan, hex, errors - is handled
+    // by strtof() on a null-terminated copy on the stack
+    char buf[64];
+    if (len >= sizeof(buf)) {
+        if (errPos) {
+            *errPos = 0;
+        }
+        return false;
+    }
+    memcpy(buf, str, len);
+    buf[len] = 0;
+    char* parseEnd;
+    result = strtof(buf, &parseEnd);
+    size_t pos = parseEnd - buf;
+    if (errPos) {
+        *errPos = pos;
+    }
+    return pos == len && len;
+}
 
 long strToInt(const char* str, size_t len, long defVal, int base)
 {
-    char* end;
-    long val = strtol(str, &end, base);
-    return (end == str + len) ? val : defVal;
+    long val;
+    return strToIntChecked(str, len, val, base) ? val : defVal;
 }
 
 float strToFloat(const char* str, size_t len, float defVal)
 {
-    char* end;
-    float val = strtod(str, &end);
-    return (end == str + len) ? val : defVal;
+    float val;
+    return strToFloatChecked(str, len, val) ? val : defVal;
 }
 
 void Substring::trimSpaces()
@@ -199,14 +629,50 @@ bool KeyValParser::parse(char pairDelim, char keyValDelim, int flags)
     }
 }
 
-Substring KeyValParser::strVal(const char* name)
+static int compareKeys(const Substring& a, const char* b, size_t bLen)
 {
-    for (auto& keyval: mKeyVals) {
-        if (strcmp(name, keyval.key.str) == 0) {
-            return keyval.val;
+    if (a.len != bLen) {
+        return (a.len < bLen) ? -1 : 1;
+    }
+    return memcmp(a.str, b, bLen);
+}
+void KeyValParser::buildIndex()
+{
+    mIndex.resize(mKeyVals.size());
+    for (size_t i = 0; i < mIndex.size(); i++) {
+        auto& key = mKeyVals[i].key;
+        mIndex[i] = { keyHash(key.str, key.len), (uint16_t)i };
+    }
+    // stable, so that the first of duplicate keys is found, same as without index
+    std::stable_sort(mIndex.begin(), mIndex.end(), [](const IndexEntry& a, const IndexEntry& b) {
+        return a.hash < b.hash;
+    });
+}
+int KeyValParser::findKey(const char* name, size_t len)
+{
+    if (mIndex.size() != mKeyVals.size()) { // no index
+        for (size_t i = 0; i < mKeyVals.size(); i++) {
+            if (compareKeys(mKeyVals[i].key, name, len) == 0) {
+                return i;
+            }
+        }
+        return -1;
+    }
+    uint32_t hash = keyHash(name, len);
+    auto it = std::lower_bound(mIndex.begin(), mIndex.end(), hash, [](const IndexEntry& entry, uint32_t hash) {
+        return entry.hash < hash;
+    });
+    for (; it != mIndex.end() && it->hash == hash; it++) {
+        if (compareKeys(mKeyVals[it->idx].key, name, len) == 0) {
+            return it->idx;
         }
     }
-    return Substring(nullptr, 0);
+    return -1;
+}
+Substring KeyValParser::strVal(const char* name)
+{
+    int idx = findKey(name, strlen(name));
+    return (idx < 0) ? Substring(nullptr, 0) : mKeyVals[idx].val;
 }
 long KeyValParser::intVal(const char* name, long defVal)
 {
@@ -234,6 +700,110 @@ KeyValParser::~KeyValParser()
     }
 }
 
+UrlEncodedParser::UrlEncodedParser(PairCb cb, void* userp, int maxKeyLen, int maxValLen,
+    uint8_t flags, char pairDelim, char keyValDelim)
+: mCb(cb), mUserp(userp), mMaxKeyLen(maxKeyLen), mMaxValLen(maxValLen), mFlags(flags),
+  mPairDelim(pairDelim), mKeyValDelim(keyValDelim)
+{
+    // one allocation for both buffers, each with space for a null terminator
+    mKey = (char*)malloc(maxKeyLen + maxValLen + 2);
+    mVal = mKey ? mKey + maxKeyLen + 1 : nullptr;
+    mError = !mKey;
+}
+UrlEncodedParser::~UrlEncodedParser()
+{
+    free(mKey);
+}
+void UrlEncodedParser::reset()
+{
+    mKeyLen = mValLen = 0;
+    mEscState = 0;
+    mInVal = mHasPair = false;
+    mError = !mKey;
+}
+bool UrlEncodedParser::putChar(char ch)
+{
+    mHasPair = true;
+    if (!mInVal) {
+        if (mKeyLen >= mMaxKeyLen) {
+            return false;
+        }
+        mKey[mKeyLen++] = (mFlags & KeyValParser::kKeysToLower) ? ::tolower(ch) : ch;
+        return true;
+    }
+    if (mValLen >= mMaxValLen) { // pass what we have so far
+        mKey[mKeyLen] = 0;
+        mVal[mValLen] = 0;
+        if (!mCb(mUserp, Substring(mKey, mKeyLen), Substring(mVal, mValLen), false)) {
+            return false;
+        }
+        mValLen = 0;
+    }
+    mVal[mValLen++] = ch;
+    return true;
+}
+bool UrlEncodedParser::endPair()
+{
+    if (!mHasPair) { // empty pair, i.e. && or leading/trailing delimiter
+        return true;
+    }
+    mKey[mKeyLen] = 0;
+    mVal[mValLen] = 0;
+    bool ok = mCb(mUserp, Substring(mKey, mKeyLen), Substring(mVal, mValLen), true);
+    mKeyLen = mValLen = 0;
+    mInVal = mHasPair = false;
+    return ok;
+}
+bool UrlEncodedParser::feed(const char* data, int len)
+{
+    if (mError) {
+        return false;
+    }
+    bool unescape = mFlags & KeyValParser::kUrlUnescape;
+    const char* end = data + len;
+    for (; data < end; data++) {
+        char ch = *data;
+        bool ok;
+        if (mEscState) {
+            auto nibble = hexDigitVal(ch);
+            if (nibble > 15) {
+                ok = false;
+            } else if (mEscState == 1) {
+                mEscHighNibble = nibble;
+                mEscState = 2;
+                continue;
+            } else {
+                mEscState = 0;
+                ok = putChar((mEscHighNibble << 4) | nibble); // never a delimiter
+            }
+        } else if (ch == mPairDelim) {
+            ok = endPair();
+        } else if (ch == mKeyValDelim && !mInVal) {
+            mInVal = mHasPair = true;
+            continue;
+        } else if (unescape && ch == '%') {
+            mEscState = 1;
+            mHasPair = true;
+            continue;
+        } else if (ch == '+' && (mFlags & KeyValParser::kPlusToSpace)) {
+            ok = putChar(' ');
+        } else {
+            ok = putChar(ch);
+        }
+        if (!ok) {
+            mError = true;
+            return false;
+        }
+    }
+    return true;
+}
+bool UrlEncodedParser::finish()
+{
+    bool ok = !mError && !mEscState && endPair();
+    reset();
+    return ok;
+}
+
 Substring urlGetFile(const char* url)
 {
     const char* start = nullptr;
@@ -276,13 +846,13 @@ std::string jsonStringEscape(const char* str)
     for (const char* ptr = str; *ptr; ptr++) {
         char ch = *ptr;
         switch (ch) {
-            case '\b': buf.append("\b", 2); break;
-            case '\f': buf.append("\f", 2); break;
-            case '\r': buf.append("\r", 2); break;
-            case '\n': buf.append("\n", 2); break;
-            case '\t': buf.append("\t", 2); break;
-            case '\"': buf.append("\"", 2); break;
-            case '\\': buf.append("\\", 2); break;
+            case '\b': buf.append("\\b", 2); break;
+            case '\f': buf.append("\\f", 2); break;
+            case '\r': buf.append("\\r", 2); break;
+            case '\n': buf.append("\\n", 2); break;
+            case '\t': buf.append("\\t", 2); break;
+            case '\"': buf.append("\\\"", 2); break;
+            case '\\': buf.append("\\\\", 2); break;
             default: buf += ch; break;
         }
     }
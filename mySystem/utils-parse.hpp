@@ -5,10 +5,20 @@
 #include <stdarg.h>
 #include <memory>
 #include <string>
+#include <string.h>
 //#include "buffer.hpp"
 
+/** Writes two hex digits per byte, each followed by \c delim unless it is 0, and a null
+ * terminator. \c str must have room for 2 or 3 chars per byte, plus the terminator
+ */
 char* binToHex(const uint8_t* data, size_t len, char* str, char delim=' ');
 bool hexToBin(const char* hex, size_t hexLen, uint8_t* bin, size_t binLen);
+// Byte-at-a-time reference implementations of the above and of hexDigitVal() and
+// unescapeUrlParam(), which process whole words at a time where possible
+char* binToHexScalar(const uint8_t* data, size_t len, char* str, char delim=' ');
+bool hexToBinScalar(const char* hex, size_t hexLen, uint8_t* bin, size_t binLen);
+uint8_t hexDigitValScalar(char digit);
+bool unescapeUrlParamScalar(char* str, size_t len);
 
 extern const char* _utils_hexDigits;
 template <typename T>
@@ -25,9 +35,27 @@ char* numToHex(T val, char* str)
     return str;
 }
 std::string binToAscii(char* buf, int len, int lineLen=32);
+/** Decodes %XX escapes in place. An invalid escape is replaced by '?' and false is returned.
+ * If the result is shorter than the input, it is null-terminated
+ */
 bool unescapeUrlParam(char* str, size_t len);
 
-uint8_t hexDigitVal(char digit);
+extern const uint8_t _utils_hexDigitVals[256];
+/** @returns the value of a hex digit, or 0xff if the char is not a hex digit */
+static inline uint8_t hexDigitVal(char digit) { return _utils_hexDigitVals[(uint8_t)digit]; }
+/** Parse a number from exactly \c len chars, which don't need to be null-terminated.
+ * The syntax is that of strtol() / strtof(), and the whole string must be consumed.
+ * An empty string is not a valid number. As with strtol(), integers that are out of range
+ * are saturated. Integers are parsed 8 decimal digits at a time, and simple decimal floats
+ * are converted exactly without calling libc. No heap allocation is done. Floats longer
+ * than 63 chars that need libc are rejected.
+ * @param errPos If not null, receives the offset of the first char that is not part
+ * of the number - \c len on success, 0 if there is no number at all
+ * @returns false if the string is not a valid number. \c result is set if a number
+ * was parsed, even if it is followed by invalid chars
+ */
+bool strToIntChecked(const char* str, size_t len, long& result, int base=10, size_t* errPos=nullptr);
+bool strToFloatChecked(const char* str, size_t len, float& result, size_t* errPos=nullptr);
 long strToInt(const char* str, size_t len, long defVal, int base=10);
 float strToFloat(const char* str, size_t len, float defVal);
 
@@ -45,6 +73,48 @@ struct Substring
     std::string toStdString() const { return str ? std::string(str, len) : std::string(); }
 };
 
+constexpr uint32_t keyHash(const char* str, size_t len)
+{
+    uint32_t hash = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (uint8_t)str[i]) * 16777619u;
+    }
+    return hash;
+}
+constexpr size_t constStrLen(const char* str)
+{
+    size_t len = 0;
+    while (str[len]) {
+        len++;
+    }
+    return len;
+}
+
+/** A set of key names, with lengths and hashes computed at compile time, for
+ * fetching the values of all keys of interest in one pass with KeyValParser::fetch():
+ *   static constexpr KeySet kKeys("ssid", "pass", "chan");
+ *   Substring vals[kKeys.size()];
+ *   parser.fetch(kKeys, vals);
+ */
+template <size_t N>
+struct KeySet
+{
+    const char* names[N];
+    uint32_t hashes[N];
+    uint16_t lens[N];
+    template <typename... Args>
+    constexpr KeySet(Args... keys): names{keys...}, hashes{}, lens{}
+    {
+        for (size_t i = 0; i < N; i++) {
+            lens[i] = constStrLen(names[i]);
+            hashes[i] = keyHash(names[i], lens[i]);
+        }
+    }
+    static constexpr size_t size() { return N; }
+};
+template <typename... Args>
+KeySet(Args...) -> KeySet<sizeof...(Args)>;
+
 class KeyValParser
 {
 public:
@@ -57,10 +127,18 @@ protected:
     char* mBuf;
     size_t mSize;
     std::vector<KeyVal> mKeyVals;
+    struct IndexEntry
+    {
+        uint32_t hash;
+        uint16_t idx;
+    };
+    std::vector<IndexEntry> mIndex; // key hashes with mKeyVals indexes, sorted by hash
     bool mOwn;
+    int findKey(const char* name, size_t len);
     KeyValParser() {} // ctor to inherit when derived class has its own initialization
 public:
-    enum Flags: uint8_t { kUrlUnescape = 1, kTrimSpaces = 2, kKeysToLower = 4 };
+    enum Flags: uint8_t { kUrlUnescape = 1, kTrimSpaces = 2, kKeysToLower = 4,
+        kPlusToSpace = 8 /* only supported by UrlEncodedParser */ };
     const std::vector<KeyVal>& keyVals() const { return mKeyVals; }
     std::vector<KeyVal>& keyVals() { return mKeyVals; }
     /** Creates the parser, no parsing is peformed yet.
@@ -72,11 +150,96 @@ public:
      *  Each Substring is null-terminated, and the length does not include the null terminator
      */
     bool parse(char pairDelim, char keyValDelim, int flags);
+    /** Builds an index of the key hashes, which makes lookups O(log n). Worth it
+     * when a handler looks up more than a few keys. Must be called again if keyVals()
+     * is modified.
+     */
+    void buildIndex();
+    /** Looks up all keys of the set in a single pass over the pairs. Keys that are
+     * not found get a null Substring.
+     * @returns the number of keys found
+     */
+    template <size_t N>
+    int fetch(const KeySet<N>& keys, Substring (&vals)[N]) const
+    {
+        int found = 0;
+        for (auto& val: vals) {
+            val = Substring(nullptr, 0);
+        }
+        for (auto& kv: mKeyVals) {
+            uint32_t hash = 0;
+            bool haveHash = false;
+            for (size_t i = 0; i < N; i++) {
+                if (keys.lens[i] != kv.key.len || vals[i].str) {
+                    continue;
+                }
+                if (!haveHash) {
+                    hash = keyHash(kv.key.str, kv.key.len);
+                    haveHash = true;
+                }
+                if (keys.hashes[i] == hash && memcmp(keys.names[i], kv.key.str, kv.key.len) == 0) {
+                    vals[i] = kv.val;
+                    found++;
+                    break;
+                }
+            }
+        }
+        return found;
+    }
     Substring strVal(const char* name);
     long intVal(const char* name, long defVal);
     float floatVal(const char* name, float defVal);
 };
 
+/** Push-style parser for url-encoded key-value pairs, i.e. query strings and
+ * application/x-www-form-urlencoded bodies. Input is fed in arbitrary chunks, and each
+ * pair is passed to a callback as soon as it is complete, with URL escapes decoded
+ * even if they are split between chunks. Memory use is fixed by the maximum key and
+ * value lengths, regardless of the input size. Longer values are passed to the callback
+ * in several pieces, with \c complete set to false for all but the last one.
+ * Keys longer than the maximum are an error. A key without a value is passed with an
+ * empty value. Supported flags are kUrlUnescape, kKeysToLower and kPlusToSpace.
+ */
+class UrlEncodedParser
+{
+public:
+    /** The key and value are null-terminated. Return false to abort parsing */
+    typedef bool (*PairCb)(void* userp, const Substring& key, const Substring& val, bool complete);
+protected:
+    PairCb mCb;
+    void* mUserp;
+    char* mKey;
+    char* mVal;
+    int mMaxKeyLen;
+    int mMaxValLen;
+    int mKeyLen = 0;
+    int mValLen = 0;
+    uint8_t mFlags;
+    char mPairDelim;
+    char mKeyValDelim;
+    uint8_t mEscState = 0; // number of hex digits of a %XX escape received so far, plus one
+    uint8_t mEscHighNibble = 0;
+    bool mInVal = false;
+    bool mHasPair = false; // got some input since the last pair delimiter
+    bool mError = false;
+    bool putChar(char ch);
+    bool endPair();
+public:
+    UrlEncodedParser(PairCb cb, void* userp, int maxKeyLen=64, int maxValLen=256,
+        uint8_t flags=KeyValParser::kUrlUnescape|KeyValParser::kPlusToSpace,
+        char pairDelim='&', char keyValDelim='=');
+    ~UrlEncodedParser();
+    /** @returns false if the input is invalid, or the callback aborted parsing */
+    bool feed(const char* data, int len);
+    /** Must be called at the end of input, to deliver the last pair. Resets the
+     * parser, so it can be reused
+     * @returns false if there was an error at any point during parsing
+     */
+    bool finish();
+    void reset();
+    bool hasError() const { return mError; }
+};
+
 long parseInt(const char* str, long defltVal, int base = 10);
 
 std::string jsonStringEscape(const char* str);
@@ -0,0 +1,427 @@
+// Host tests and microbenchmarks for utils-parse.
+// Build: g++ -O2 -std=gnu++17 -I../hostStubs utils-parseTest.cpp utils-parse.cpp utils.cpp -o utils-parseTest
+#include "utils-parse.hpp"
+#include "utils.hpp"
+#include <chrono>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <math.h>
+#include <errno.h>
+#include <limits.h>
+
+static const char* kParamNames[] = {
+    "ssid", "pass", "hostname", "ip", "gw", "mask", "dns", "chan", "mode", "vol",
+    "eq0", "eq1", "eq2", "eq3", "eq4", "url", "name", "bt", "sleep", "led"
+};
+enum { kNumParams = sizeof(kParamNames) / sizeof(kParamNames[0]) };
+
+std::string makeQuery()
+{
+    std::string query;
+    for (int i = 0; i < kNumParams; i++) {
+        if (i) {
+            query += '&';
+        }
+        query.append(kParamNames[i]).append("=").append(std::to_string(i * 7));
+    }
+    return query;
+}
+
+template <class F>
+double benchNs(int numIter, F&& func)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < numIter; i++) {
+        func();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / (double)numIter;
+}
+
+void testKeyValLookup()
+{
+    auto query = makeQuery();
+    KeyValParser plain(&query[0], query.size() + 1);
+    assert(plain.parse('&', '=', KeyValParser::kUrlUnescape));
+    auto query2 = makeQuery();
+    KeyValParser indexed(&query2[0], query2.size() + 1);
+    assert(indexed.parse('&', '=', KeyValParser::kUrlUnescape));
+    indexed.buildIndex();
+
+    static constexpr KeySet kKeys("ssid", "pass", "hostname", "ip", "gw", "mask", "dns", "chan", "mode", "vol",
+        "eq0", "eq1", "eq2", "eq3", "eq4", "url", "name", "bt", "sleep", "led", "missing");
+    Substring vals[kKeys.size()];
+    assert(plain.fetch(kKeys, vals) == kNumParams);
+    assert(!vals[kNumParams].str);
+    for (int i = 0; i < kNumParams; i++) {
+        long expected = i * 7;
+        assert(plain.intVal(kParamNames[i], -1) == expected);
+        assert(indexed.intVal(kParamNames[i], -1) == expected);
+        assert(vals[i].toInt(-1) == expected);
+    }
+    assert(!indexed.strVal("missing").str && !indexed.strVal("").str);
+
+    enum { kIter = 200000 };
+    long sum = 0;
+    auto lookupAll = [&sum](KeyValParser& parser) {
+        return [&sum, &parser]() {
+            for (int i = 0; i < kNumParams; i++) {
+                sum += parser.strVal(kParamNames[i]).len;
+            }
+        };
+    };
+    double linearNs = benchNs(kIter, lookupAll(plain));
+    double indexNs = benchNs(kIter, lookupAll(indexed));
+    double fetchNs = benchNs(kIter, [&]() {
+        plain.fetch(kKeys, vals);
+        sum += vals[0].len;
+    });
+    printf("%d lookups: linear %.0f ns, hash index %.0f ns, key set fetch %.0f ns (%ld)\n",
+        kNumParams, linearNs, indexNs, fetchNs, sum);
+}
+
+static uint32_t gRandState = 12345;
+uint32_t rnd()
+{
+    gRandState = gRandState * 1103515245 + 12345;
+    return gRandState >> 8;
+}
+
+void testHexEquivalence()
+{
+    for (int ch = 0; ch < 256; ch++) {
+        assert(hexDigitVal(ch) == hexDigitValScalar(ch));
+    }
+    // binToHex: every byte value at every position within a word, all tail lengths
+    uint8_t bin[64];
+    char hex1[200], hex2[200];
+    for (int len = 0; len <= 19; len++) {
+        for (int pos = 0; pos < len; pos++) {
+            for (int val = 0; val < 256; val++) {
+                for (int i = 0; i < len; i++) {
+                    bin[i] = rnd();
+                }
+                bin[pos] = val;
+                for (char delim: {'\0', ' ', ':', '\xff'}) {
+                    auto end1 = binToHex(bin, len, hex1, delim);
+                    auto end2 = binToHexScalar(bin, len, hex2, delim);
+                    assert(end1 - hex1 == end2 - hex2 && strcmp(hex1, hex2) == 0);
+                }
+            }
+        }
+    }
+    // hexToBin: every pair of chars at every position within an 8-char group
+    uint8_t out1[32], out2[32];
+    for (int pos = 0; pos < 16; pos += 2) {
+        for (int pair = 0; pair < 65536; pair++) {
+            binToHexScalar(bin, 8, hex1, 0);
+            hex1[pos] = pair >> 8;
+            hex1[pos + 1] = pair & 0xff;
+            bool ok1 = hexToBin(hex1, 16, out1, 8);
+            bool ok2 = hexToBinScalar(hex1, 16, out2, 8);
+            assert(ok1 == ok2 && (!ok1 || memcmp(out1, out2, 8) == 0));
+        }
+    }
+    for (int i = 0; i < 100000; i++) {
+        int len = rnd() % 32;
+        for (int j = 0; j < len; j++) {
+            bin[j] = rnd();
+        }
+        binToHexScalar(bin, len, hex1, 0);
+        if (rnd() % 4 == 0) {
+            hex1[rnd() % (2 * len + 1)] = rnd(); // maybe corrupt
+        }
+        bool ok1 = hexToBin(hex1, 2 * len, out1, len);
+        bool ok2 = hexToBinScalar(hex1, 2 * len, out2, len);
+        assert(ok1 == ok2 && (!ok1 || memcmp(out1, out2, len) == 0));
+    }
+}
+
+bool unescapeEquals(const std::string& input)
+{
+    std::string s1 = input, s2 = input;
+    bool ok1 = unescapeUrlParam(&s1[0], s1.size());
+    bool ok2 = unescapeUrlParamScalar(&s2[0], s2.size());
+    return ok1 == ok2 && s1 == s2;
+}
+
+void testUnescapeEquivalence()
+{
+    // every possible escape at every position within a word, plus truncated ones
+    for (int pos = 0; pos < 10; pos++) {
+        std::string prefix(pos, 'a');
+        for (int hi = 0; hi < 256; hi++) {
+            for (int lo = 0; lo < 256; lo++) {
+                std::string esc = prefix + '%' + (char)hi + (char)lo;
+                assert(unescapeEquals(esc));
+                assert(unescapeEquals(esc + "tail+text%"));
+            }
+            assert(unescapeEquals(prefix + '%' + (char)hi));
+        }
+    }
+    static const char kChars[] = "%%+aZ09fF/ ";
+    for (int i = 0; i < 300000; i++) {
+        std::string str(rnd() % 40, 0);
+        for (auto& ch: str) {
+            ch = (rnd() % 4) ? kChars[rnd() % (sizeof(kChars) - 1)] : (char)rnd();
+        }
+        assert(unescapeEquals(str));
+    }
+}
+
+void benchHex()
+{
+    enum { kLen = 4096, kIter = 5000 };
+    std::unique_ptr<uint8_t[]> bin(new uint8_t[kLen]);
+    std::unique_ptr<char[]> hex(new char[kLen * 3 + 1]);
+    for (int i = 0; i < kLen; i++) {
+        bin[i] = rnd();
+    }
+    auto mbps = [](double ns) { return kLen / ns * 1000; };
+    double scalar = benchNs(kIter, [&]() { binToHexScalar(bin.get(), kLen, hex.get(), 0); });
+    double swar = benchNs(kIter, [&]() { binToHex(bin.get(), kLen, hex.get(), 0); });
+    printf("binToHex:         scalar %6.0f MB/s, SWAR %6.0f MB/s\n", mbps(scalar), mbps(swar));
+    scalar = benchNs(kIter, [&]() { hexToBinScalar(hex.get(), kLen * 2, bin.get(), kLen); });
+    swar = benchNs(kIter, [&]() { hexToBin(hex.get(), kLen * 2, bin.get(), kLen); });
+    printf("hexToBin:         scalar %6.0f MB/s, SWAR %6.0f MB/s (input)\n", mbps(scalar) * 2, mbps(swar) * 2);
+    // after hexToBin, which needs the output without delimiters
+    scalar = benchNs(kIter, [&]() { binToHexScalar(bin.get(), kLen, hex.get(), ' '); });
+    swar = benchNs(kIter, [&]() { binToHex(bin.get(), kLen, hex.get(), ' '); });
+    printf("binToHex, delim:  scalar %6.0f MB/s, SWAR %6.0f MB/s\n", mbps(scalar), mbps(swar));
+
+    // typical URL: long plain runs with a few escapes
+    std::string url;
+    while (url.size() < kLen) {
+        url.append("/music/Some%20Artist/album_name/track-01.mp3?x=");
+    }
+    std::string work;
+    scalar = benchNs(kIter, [&]() { work = url; unescapeUrlParamScalar(&work[0], work.size()); });
+    swar = benchNs(kIter, [&]() { work = url; unescapeUrlParam(&work[0], work.size()); });
+    printf("unescapeUrlParam: scalar %6.0f MB/s, SWAR %6.0f MB/s\n", mbps(scalar), mbps(swar));
+}
+
+void checkStrToInt(const std::string& str, int base)
+{
+    char* end;
+    long expected = strtol(str.c_str(), &end, base);
+    size_t expectedPos = end - str.c_str();
+    long val = 0x5a5a;
+    size_t errPos = 12345;
+    bool ok = strToIntChecked(str.data(), str.size(), val, base, &errPos);
+    assert(ok == (expectedPos == str.size() && !str.empty()));
+    assert(errPos == expectedPos);
+    if (expectedPos) {
+        assert(val == expected);
+    }
+}
+
+void checkStrToFloat(const std::string& str)
+{
+    char* end;
+    float expected = strtof(str.c_str(), &end);
+    size_t expectedPos = end - str.c_str();
+    float val = 0;
+    size_t errPos = 12345;
+    bool ok = strToFloatChecked(str.data(), str.size(), val, &errPos);
+    assert(ok == (expectedPos == str.size() && !str.empty()));
+    assert(errPos == expectedPos);
+    if (expectedPos) {
+        assert(memcmp(&val, &expected, sizeof(val)) == 0 || (isnan(val) && isnan(expected)));
+    }
+}
+
+std::string rndString(const char* chars, int maxLen)
+{
+    std::string str(rnd() % (maxLen + 1), 0);
+    int numChars = strlen(chars);
+    for (auto& ch: str) {
+        ch = (rnd() % 16) ? chars[rnd() % numChars] : (char)rnd();
+    }
+    return str;
+}
+
+void testStrToNumEquivalence()
+{
+    static const char kIntChars[] = "0123456789000999 \t+-xXaAfFgzZ";
+    for (int i = 0; i < 2000000; i++) {
+        std::string str = rndString(kIntChars, 30);
+        for (int base: {10, 16, 0, 8, 2, 36}) {
+            checkStrToInt(str, base);
+        }
+    }
+    for (long val: {0L, 1L, -1L, LONG_MAX, LONG_MIN, LONG_MAX - 1, LONG_MIN + 1}) {
+        checkStrToInt(std::to_string(val), 10);
+        checkStrToInt(std::to_string(val) + "0", 10); // out of range
+    }
+    for (int i = 0; i < 2000000; i++) {
+        long val = (long)(((uint64_t)rnd() << 32) | rnd()) >> (rnd() % 64);
+        checkStrToInt(std::to_string(val), 10);
+        checkStrToInt(std::string(rnd() % 12, '0') + std::to_string(val), 10);
+    }
+    static const char kFloatChars[] = "0123456789012345678901234567890123456789..eE+- \tx";
+    for (int i = 0; i < 2000000; i++) {
+        checkStrToFloat(rndString(kFloatChars, 30));
+    }
+    char buf[64];
+    for (int i = 0; i < 2000000; i++) {
+        // exercise the exact fast path around its limits
+        uint32_t mantissa = rnd() % ((1 << 24) + 10);
+        int exp = (int)(rnd() % 30) - 15;
+        switch (rnd() % 3) {
+            case 0: snprintf(buf, sizeof(buf), "%ue%d", mantissa, exp); break;
+            case 1: snprintf(buf, sizeof(buf), "%u.%0*u", mantissa / 1000, 3, mantissa % 1000); break;
+            default: snprintf(buf, sizeof(buf), "%.*g", (int)(rnd() % 12), ldexpf(mantissa, exp)); break;
+        }
+        checkStrToFloat(buf);
+    }
+    for (const char* str: {"inf", "-nan", "1e40", "1e-50", "0x1p3", ".5", "5.", ".", "-", "1e", "1e+", " 1"}) {
+        checkStrToFloat(str);
+    }
+}
+
+void benchStrToNum()
+{
+    enum { kIter = 1000000 };
+    static const char* kInts[] = { "0", "42", "-1234", "65535", "123456789", "-2000000000" };
+    static const char* kFloats[] = { "0.5", "3.14159", "-23.75", "440", "1e-3", "0.000123" };
+    enum { kNum = sizeof(kInts) / sizeof(kInts[0]) };
+    static_assert(kNum == sizeof(kFloats) / sizeof(kFloats[0]), "");
+    // the length is known from the Substring in real use
+    size_t intLens[kNum], floatLens[kNum];
+    for (int i = 0; i < kNum; i++) {
+        intLens[i] = strlen(kInts[i]);
+        floatLens[i] = strlen(kFloats[i]);
+    }
+    long sum = 0;
+    float fsum = 0;
+    double libc = benchNs(kIter, [&]() {
+        for (auto str: kInts) {
+            char* end;
+            sum += strtol(str, &end, 10);
+        }
+    });
+    double ours = benchNs(kIter, [&]() {
+        for (int i = 0; i < kNum; i++) {
+            sum += strToInt(kInts[i], intLens[i], 0);
+        }
+    });
+    printf("%d ints:   strtol %5.1f ns, strToInt   %5.1f ns (%ld)\n", kNum, libc, ours, sum);
+    libc = benchNs(kIter, [&]() {
+        for (auto str: kFloats) {
+            char* end;
+            fsum += strtof(str, &end);
+        }
+    });
+    ours = benchNs(kIter, [&]() {
+        for (int i = 0; i < kNum; i++) {
+            fsum += strToFloat(kFloats[i], floatLens[i], 0);
+        }
+    });
+    printf("%d floats: strtof %5.1f ns, strToFloat %5.1f ns (%f)\n", kNum, libc, ours, fsum);
+}
+
+// Minimal httpd request, for httpParseUrlEncodedBody(), which receives the whole body at once
+struct TestRequest: public httpd_req_t
+{
+    std::string body;
+    size_t recvPos = 0;
+    TestRequest(const std::string& aBody): httpd_req_t{}, body(aBody)
+    {
+        content_len = body.size();
+    }
+};
+int httpd_req_recv(httpd_req_t* req, char* buf, size_t len)
+{
+    auto& test = *static_cast<TestRequest*>(req);
+    len = std::min(len, test.body.size() - test.recvPos);
+    memcpy(buf, test.body.data() + test.recvPos, len);
+    test.recvPos += len;
+    return len;
+}
+size_t httpd_req_get_url_query_len(httpd_req_t*) { return 0; }
+esp_err_t httpd_req_get_url_query_str(httpd_req_t*, char*, size_t) { return ESP_ERR_NOT_FOUND; }
+
+struct PairLog
+{
+    std::string log;
+    static bool onPair(void* userp, const Substring& key, const Substring& val, bool complete)
+    {
+        auto& self = *static_cast<PairLog*>(userp);
+        assert(key.str[key.len] == 0 && val.str[val.len] == 0);
+        self.log.append(key.str, key.len).append(1, '\0').append(val.str, val.len)
+            .append(complete ? "\1" : "\2", 1);
+        return true;
+    }
+};
+// Splits the input at every offset, including inside %XX escapes and at delimiters,
+// and feeds it byte by byte. The pairs and the result must be the same as when
+// the body is parsed in one piece
+void checkUrlEncodedSplits(const std::string& body, int maxKeyLen, int maxValLen)
+{
+    assert(body.size() < 128); // fits in the receive buffer of httpParseUrlEncodedBody()
+    PairLog expected;
+    UrlEncodedParser refParser(PairLog::onPair, &expected, maxKeyLen, maxValLen);
+    TestRequest req(body);
+    bool expectedOk = httpParseUrlEncodedBody(&req, refParser) == ESP_OK;
+    assert(req.recvPos == body.size() || !expectedOk);
+
+    PairLog actual;
+    UrlEncodedParser parser(PairLog::onPair, &actual, maxKeyLen, maxValLen);
+    for (size_t split = 0; split <= body.size(); split++) {
+        actual.log.clear();
+        bool ok = parser.feed(body.data(), split);
+        ok = ok && parser.feed(body.data() + split, body.size() - split);
+        ok = parser.finish() && ok;
+        assert(ok == expectedOk);
+        assert(actual.log == expected.log);
+    }
+    actual.log.clear();
+    bool ok = true;
+    for (size_t i = 0; i < body.size() && ok; i++) {
+        ok = parser.feed(body.data() + i, 1);
+    }
+    ok = parser.finish() && ok;
+    assert(ok == expectedOk);
+    assert(actual.log == expected.log);
+}
+void testUrlEncodedSplits()
+{
+    static const char* kBodies[] = {
+        "",
+        "a=1",
+        "ssid=My+Net%20%41%42c&pass=p%26ss%3Dword&&empty=&novalue&x=%7e%7E",
+        "%6B%65%79=%76al&k%2B=v%2b+&=noKey&last",
+        "long=0123456789abcdefghijklmnopqrstuvwxyz%41%42%43&short=1",
+        "truncated=%4",
+        "bad=%zz&after=1",
+        "bad2=%4g",
+        "keyIsTooLong0123456789=1",
+        "trailing=&",
+    };
+    for (auto body: kBodies) {
+        checkUrlEncodedSplits(body, 16, 64);
+        // values delivered in several pieces
+        checkUrlEncodedSplits(body, 16, 5);
+    }
+    static const char kChars[] = "%%%&&==+aZ09fF";
+    for (int i = 0; i < 3000; i++) {
+        std::string str(rnd() % 60, 0);
+        for (auto& ch: str) {
+            ch = (rnd() % 8) ? kChars[rnd() % (sizeof(kChars) - 1)] : (char)rnd();
+        }
+        checkUrlEncodedSplits(str, 8, 12);
+    }
+}
+int main()
+{
+    testStrToNumEquivalence();
+    benchStrToNum();
+    testHexEquivalence();
+    testUnescapeEquivalence();
+    benchHex();
+    testKeyValLookup();
+    testUrlEncodedSplits();
+    return 0;
+}
@@ -41,6 +41,28 @@ UrlParams::UrlParams(httpd_req_t* req)
     }
 }
 
+esp_err_t httpParseUrlEncodedBody(httpd_req_t* req, UrlEncodedParser& parser)
+{
+    char buf[128];
+    for (int remain = req->content_len; remain > 0;) {
+        int recvLen;
+        for (int numWaits = 0; numWaits < 4; numWaits++) {
+            recvLen = httpd_req_recv(req, buf, std::min(remain, (int)sizeof(buf)));
+            if (recvLen != HTTPD_SOCK_ERR_TIMEOUT) {
+                break;
+            }
+        }
+        if (recvLen <= 0) {
+            return ESP_FAIL;
+        }
+        remain -= recvLen;
+        if (!parser.feed(buf, recvLen)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+    }
+    return parser.finish() ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
 int16_t utils::currentCpuFreq() {
     rtc_cpu_freq_config_t conf;
     rtc_clk_cpu_freq_get_config(&conf);
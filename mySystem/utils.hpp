@@ -66,7 +66,7 @@ public:
     }
     static constexpr const uint32_t kSpiRamStartAddr = 0x3F800000;
     static bool isInSpiRam(void* addr) {
-        return (uint32_t)addr >= kSpiRamStartAddr && (uint32_t)addr < (kSpiRamStartAddr + 4 * 1024 * 1024);
+        return (uintptr_t)addr >= kSpiRamStartAddr && (uintptr_t)addr < (kSpiRamStartAddr + 4 * 1024 * 1024);
     }
     constexpr uint32_t static log2(uint32_t n) noexcept
     {
@@ -75,11 +75,25 @@ public:
     static int16_t currentCpuFreq();
 };
 
+/** DynBuffer allocator that places buffers in SPI RAM, if available */
+struct SpiRamAllocator
+{
+    void* allocate(size_t size) { return utils::mallocTrySpiram(size); }
+    void* reallocate(void* ptr, size_t size) { return utils::reallocTrySpiram(ptr, size); }
+    void deallocate(void* ptr) { free(ptr); }
+};
+typedef BasicDynBuffer<0, SpiRamAllocator> SpiRamDynBuffer;
+
 class UrlParams: public KeyValParser
 {
 public:
     UrlParams(httpd_req_t* req);
 };
+/** Receives the request body in small chunks and feeds it to the parser, so that
+ * large form posts can be processed without buffering them
+ * @returns ESP_FAIL on receive error, ESP_ERR_INVALID_ARG if parsing failed
+ */
+esp_err_t httpParseUrlEncodedBody(httpd_req_t* req, UrlEncodedParser& parser);
 
 class FileHandle: public std::unique_ptr<FILE, void(*)(FILE*)>
 {